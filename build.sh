@@ -17,6 +17,7 @@ tar -czf linux/tlsm.tar.gz src --transform s/src/tlsm-src/
 cp config linux/config
 cp Kconfig.diff linux/Kconfig.diff
 cp Makefile.diff linux/Makefile.diff
+cp proc_base.diff linux/proc_base.diff
 
 patch -N linux/PKGBUILD PKGBUILD.diff
 
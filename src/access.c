@@ -1,13 +1,35 @@
-#include <linux/semaphore.h>
+#include <linux/completion.h>
 
 #include "tlsm.h"
 #include "access.h"
 #include "utils.h"
 #include "fs.h"
+#include "cgroups.h"
+#include "net.h"
+#include "verdict.h"
+#include "ruleset.h"
+#include "capture.h"
+#include "pseudofs.h"
 
 static unsigned long long request_count = 0;
 
-int tlsmd_request(tlsm_category_t cat, struct access *access_request)
+/**
+ * tlsm_fallback_verdict - verdict of an ask or analyze policy when tlsmd does not answer
+ */
+static int tlsm_fallback_verdict(const struct policy *pol)
+{
+    switch (pol->opts.fallback)
+    {
+    case TLSM_FALLBACK_ALLOW:
+        return 0;
+    case TLSM_FALLBACK_DENY:
+        return -EPERM;
+    default:
+        return default_allow ? 0 : -EPERM;
+    }
+}
+
+int tlsmd_request(const struct policy *pol, struct access *access_request)
 {
     // ask user
     kuid_t uid;
@@ -16,7 +38,14 @@ int tlsmd_request(tlsm_category_t cat, struct access *access_request)
     if (__kuid_val(uid) == 0) // Don't block root actions for now
         return 0;
 
-    if (cat == TLSM_ASK)
+    // nobody would answer, do not make the task wait for the timeout
+    if (!tlsm_watchdog_alive(__kuid_val(uid)))
+    {
+        printk(KERN_DEBUG "[TLSM][ACCESS] no watchdog for uid %d, using the default verdict", __kuid_val(uid));
+        return tlsm_fallback_verdict(pol);
+    }
+
+    if (pol->category == TLSM_ASK)
     {
         access_request->supervised = 1;
     }
@@ -27,60 +56,105 @@ int tlsmd_request(tlsm_category_t cat, struct access *access_request)
 
     struct task_struct *curr = get_current();
     struct tlsm_task_security *ts = get_task_security(curr);
-    struct op_stat *stats;
-    stats = kzalloc(sizeof(*stats) * TLSM_OPS_LEN, GFP_KERNEL);
-    memcpy(stats, ts->stats, sizeof(struct op_stat) * TLSM_OPS_LEN);
 
     access_request->subject = get_exe_path_for_task(curr);
     access_request->score = ts->score;
     access_request->score_delta = DEFAULT_SCORE_UPDATE;
 
-    struct fs_request *fs_req = create_fs_request(__kuid_val(uid), *access_request, stats, request_count++);
-    if (!fs_req)
+    bool joined;
+    struct fs_request *fs_req = create_fs_request(__kuid_val(uid), *access_request, pol->id, ts->stats, request_count++, &joined);
+    if (IS_ERR(fs_req))
     {
-        kfree(stats);
         kfree(access_request->subject);
-        return -EPERM;
+        if (PTR_ERR(fs_req) != -EBUSY)
+            return -EPERM;
+        // too many pending requests, tlsmd would not answer this one in time anyway
+        return READ_ONCE(pending_overflow) == TLSM_OVERFLOW_FAIL ? -EAGAIN : tlsm_fallback_verdict(pol);
     }
 
-    int ret = down_timeout(&(fs_req->sem), msecs_to_jiffies(request_timeout * 1000));
-    if (ret == 0 && fs_req->answer != NULL)
+    // the watchdog may have exited since it was checked
+    if (!joined && signal_watchdog(__kuid_val(uid), fs_req->number) != 0)
     {
-        // acquire was successfull
-        int res = fs_req->answer->allow;
-        printk(KERN_DEBUG "[TLSM][ACCESS] semaphore OK, got answer %d", res);
-        access_request->score_delta = fs_req->answer->score_delta;
-        kfree(stats);
-        kfree(access_request->subject);
         remove_fs_file(fs_req);
-        return -res;
+        kfree(access_request->subject);
+        return tlsm_fallback_verdict(pol);
+    }
+
+    // a joined request is completed by its creator at the latest, when its own timeout expires
+    unsigned int timeout_ms = pol->opts.timeout_ms ? pol->opts.timeout_ms : request_timeout * 1000;
+    wait_for_completion_timeout(&fs_req->answered, msecs_to_jiffies(timeout_ms));
+    int verdict;
+    struct fs_answer *answer = READ_ONCE(fs_req->answer);
+    if (answer)
+    {
+        printk(KERN_DEBUG "[TLSM][ACCESS] request answered, got answer %d", answer->allow);
+        access_request->score_delta = answer->score_delta;
+        verdict = -answer->allow;
     }
     else
     {
         // timeout or other issue
-        printk(KERN_DEBUG "[TLSM][ACCESS] semaphore timeout or answer parsing failure (or another, unspecified issue)");
-        kfree(stats);
-        kfree(access_request->subject);
+        printk(KERN_DEBUG "[TLSM][ACCESS] request timeout or answer parsing failure (or another, unspecified issue)");
+        verdict = tlsm_fallback_verdict(pol);
+    }
+
+    // before the subject is freed, joined requests compare it
+    if (joined)
+        put_fs_request(fs_req);
+    else
         remove_fs_file(fs_req);
-        return -EPERM;
+    kfree(access_request->subject);
+    return verdict;
+}
+
+/**
+ * tlsm_score_verdict - decide an analyze policy from the task's score, if it is clear cut
+ *
+ * Return: true if the verdict was set, false if tlsmd must analyze the request
+ */
+static bool tlsm_score_verdict(const struct policy *pol, struct access *access_request, int *verdict)
+{
+    if (__kuid_val(current_uid()) == 0) // root actions are not blocked, see tlsmd_request()
+        return false;
+
+    unsigned int score = get_task_security(get_current())->score;
+    if (score < pol->opts.deny_below)
+    {
+        access_request->score_delta = pol->opts.deny_delta;
+        *verdict = -EPERM;
+        return true;
     }
+    if (score > pol->opts.allow_above)
+    {
+        access_request->score_delta = pol->opts.allow_delta;
+        *verdict = 0;
+        return true;
+    }
+    return false;
 }
 
 /**
  * process_policy - process a policy depending on its category (allow, deny, ask)
  *
  * Return 0 if the operation is allowed or -EPERM is not allowed.
- * For "ask" policies, ask the user via security fs. If answer times out or error, default to -EPERM.
+ * For "ask" policies, ask the user via security fs. If no watchdog answers in time, use the
+ * policy's default verdict. "analyze" policies go to tlsmd too, unless the task's score is
+ * out of their thresholds.
  */
 int process_policy(struct policy *pol, struct access* access_request)
 {
+    int verdict;
+
     switch (pol->category)
     {
     case TLSM_ANALYZE:
-        return tlsmd_request(TLSM_ANALYZE, access_request);
+        // only the scores between the thresholds need tlsmd
+        if (tlsm_score_verdict(pol, access_request, &verdict))
+            return verdict;
+        return tlsmd_request(pol, access_request);
         break;
     case TLSM_ASK:
-        return tlsmd_request(TLSM_ASK, access_request);
+        return tlsmd_request(pol, access_request);
         break;
 
     case TLSM_ALLOW:
@@ -93,83 +167,301 @@ int process_policy(struct policy *pol, struct access* access_request)
     }
 }
 
-int autorize_access(struct access access_request)
+/**
+ * tlsm_plist_match - find the first rule of a list that applies to an access request
+ *
+ * Must be called with tlsm_policies_sem held.
+ * Return: the matching rule, NULL if no rule applies
+ */
+static const struct tlsm_rule *tlsm_plist_match(struct plist *l, struct access *access_request, struct tlsm_str *exe)
+{
+    if (!l->compiled)
+        return NULL;
+    return tlsm_ruleset_match(l->compiled, access_request, exe);
+}
+
+/**
+ * tlsm_current_exe - get the interned executable path of the current task
+ *
+ * Return: a reference on the path, NULL if it cannot be resolved
+ */
+static struct tlsm_str *tlsm_current_exe(void)
 {
-    struct policy_node *pointer = tlsm_policies->head;
+    struct tlsm_str *exe = tlsm_task_exe(get_current());
+    if (exe)
+        return exe;
+
+    // not cached (task did not execve since TLSM init), resolve it
+    char *exe_path = get_exe_path_for_task(get_current());
+    if (!exe_path)
+        return NULL;
+    exe = tlsm_str_intern(exe_path, strlen(exe_path));
+    kfree(exe_path);
+    return exe;
+}
+
+/**
+ * tlsm_resolve_object - get the path of the object of an access, if it was not given
+ *
+ * Return: the buffer to free once the object is not needed anymore
+ */
+static char *tlsm_resolve_object(struct access *access_request)
+{
+    if (access_request->object)
+        return NULL;
+
+    if (access_request->dest)
+    {
+        char *addr = kmalloc(TLSM_NET_ADDR_LEN, GFP_KERNEL);
+        if (addr)
+            tlsm_net_format(access_request->dest, addr, TLSM_NET_ADDR_LEN);
+        access_request->object = addr ? addr : "";
+        return addr;
+    }
+    if (!access_request->path)
+        return NULL;
+
+    char *buf = kmalloc(PATH_MAX, GFP_KERNEL);
+    char *res = buf ? d_path(access_request->path, buf, PATH_MAX) : ERR_PTR(-ENOMEM);
+    access_request->object = IS_ERR(res) ? "" : res;
+    return buf;
+}
+
+/**
+ * tlsm_capture_access - record an access request in the running capture, before any cache
+ * @latent: see autorize_file_modes()
+ */
+static void tlsm_capture_access(const struct access *a, u8 latent)
+{
+    struct access access_request = *a;
+    const char *object = NULL;
+    char *buf = NULL;
+
+    struct tlsm_str *exe = tlsm_current_exe();
+    if (!exe)
+        return;
+
+    // signal rules match the receiver, kept where the object would be
+    if (access_request.op == TLSM_SIGNAL)
+    {
+        if (access_request.target)
+            object = access_request.target->str;
+    }
+    else
+    {
+        buf = tlsm_resolve_object(&access_request);
+        object = access_request.object;
+    }
+
+    tlsm_capture_record(&access_request, latent, exe, object);
+    kfree(buf);
+    tlsm_str_put(exe);
+}
+
+/**
+ * __autorize_access - verdict of an access request
+ *
+ * For TLSM_FILE_OPEN, access_request->mode is left with the modes the verdict is for: the ones
+ * of the matching policy, or all of them if none matched.
+ * Return: 0 if the access is allowed, -EPERM otherwise
+ */
+static int __autorize_access(struct access *a)
+{
+    struct access access_request = *a;
+
+    // nothing to do if no policy can apply to this operation
+    if (!tlsm_rules_for_op(access_request.op))
+        return 0;
 
     struct task_struct *task = get_current();
     struct tlsm_task_security *ts = get_task_security(task);
 
-    char *exe_path = get_exe_path_for_task(task);
+    struct tlsm_str *exe = tlsm_current_exe();
+    if (!exe)
+        return 0;
+    u64 cgid = tlsm_task_cgroup_id(task);
 
-    struct policy *p;
-    while (pointer)
+    const struct tlsm_rule *r = NULL;
+    struct policy matched = {};
+    struct tlsm_verdict_key key;
+    struct tlsm_sock_verdict_key sock_key;
+    char *buf = NULL;
+    int answer;
+
+    // same program, same file and same policies as a previous access: reuse its verdict
+    bool cacheable = access_request.path && tlsm_verdict_key_init(&key, access_request.path, access_request.op, access_request.mode, exe, cgid);
+    if (cacheable && tlsm_verdict_lookup(&key, &answer, &matched.id, &a->mode))
     {
-        p = pointer->policy;
-        if (p->category == TLSM_ANALYZE)
+        if (!matched.id)
         {
-            if (strcmp(exe_path, p->subject) == 0)
-                goto apply;
+            tlsm_str_put(exe);
+            return 0;
         }
-        else if (p->op == access_request.op)
+        goto autorize_access_verdict;
+    }
+
+    // same program sending to the same destination as the socket's last datagram
+    if (access_request.sk)
+    {
+        tlsm_sock_verdict_key_init(&sock_key, access_request.dest, exe, cgid);
+        if (tlsm_sock_verdict_lookup(access_request.sk, &sock_key, &answer, &matched.id))
         {
-            if (strncmp(exe_path, p->subject, strlen(p->subject)) == 0)
+            if (!matched.id)
             {
-                switch (access_request.op)
-                {
-                case TLSM_FILE_OPEN:
-                    if (strstr(access_request.object, p->object) != NULL)
-                        goto apply;
-                    break;
-
-                case TLSM_SOCKET_BIND:
-                case TLSM_SOCKET_CONNECT:
-                    if (strncmp(access_request.object, p->object, strlen(p->object)) == 0 || strncmp(p->object, "any", strlen(p->object)) == 0)
-                        goto apply;
-                    break;
-                case TLSM_SIGNAL:
-                    goto apply;
-                    break;
-                case TLSM_EXECVE:
-                    if (strncmp(access_request.object, p->object, strlen(p->object)) == 0 || strncmp(p->object, "any", strlen(p->object)) == 0)
-                        goto apply;
-                    break;
-                default:
-                    break;
-                }
+                tlsm_str_put(exe);
+                return 0;
             }
+            goto autorize_access_verdict;
         }
-        pointer = pointer->next;
     }
 
-    kfree(exe_path);
+    buf = tlsm_resolve_object(&access_request);
 
-    // allowing operation if not handled
-    return 0;
+    down_read(&tlsm_policies_sem);
+
+    // the policies of the task's cgroup come first, then the global ones
+    struct tlsm_cgroup_policies *set = tlsm_cgroup_find(cgid);
+    if (set)
+        r = tlsm_plist_match(set->policies, &access_request, exe);
+    if (!r)
+        r = tlsm_plist_match(tlsm_policies, &access_request, exe);
+
+    if (!r)
+    {
+        up_read(&tlsm_policies_sem);
+        if (cacheable)
+            tlsm_verdict_store(&key, 0, 0, a->mode);
+        if (access_request.sk)
+            tlsm_sock_verdict_store(access_request.sk, &sock_key, 0, 0);
+        kfree(buf);
+        tlsm_str_put(exe);
+
+        // allowing operation if not handled
+        return 0;
+    }
+
+    // the policy can be deleted while an ask request is pending, keep what is needed of it
+    matched.id = r->id;
+    matched.category = r->category;
+    matched.opts.timeout_ms = r->timeout_ms;
+    matched.opts.fallback = r->fallback;
+    if (r->category == TLSM_ANALYZE)
+    {
+        matched.opts.allow_above = r->allow_above;
+        matched.opts.deny_below = r->deny_below;
+        matched.opts.allow_delta = r->allow_delta;
+        matched.opts.deny_delta = r->deny_delta;
+    }
+    else if (r->op == TLSM_FILE_OPEN)
+    {
+        // the other modes may be decided by a later policy
+        a->mode &= r->modes;
+    }
+    up_read(&tlsm_policies_sem);
+
+    answer = process_policy(&matched, &access_request);
+
+    // ask and analyze verdicts are up to tlsmd, every access goes to it
+    if (matched.category == TLSM_ALLOW || matched.category == TLSM_DENY)
+    {
+        if (cacheable)
+            tlsm_verdict_store(&key, answer, matched.id, a->mode);
+        if (access_request.sk)
+            tlsm_sock_verdict_store(access_request.sk, &sock_key, answer, matched.id);
+    }
 
-apply:
-    int answer = process_policy(p, &access_request);
+autorize_access_verdict:
     ts->stats[access_request.op].total++;
 
     score_update(&ts->score, access_request.score_delta);
 
     if (answer == 0)
     {
-        kfree(exe_path);
+        kfree(buf);
+        tlsm_str_put(exe);
         return 0;
     }
     else
     {
         ts->stats[access_request.op].deny++;
-        p->hit_count++;
-        printk(KERN_DEBUG "[TLSM][ACCESS][BLOCK] %s %s %s (%llu time, %u score)", exe_path, tlsm_ops2str(access_request.op), access_request.object, ts->stats[access_request.op].deny, ts->score);
+        tlsm_policy_hit(cgid, matched.id);
+        if (access_request.object)
+            printk(KERN_DEBUG "[TLSM][ACCESS][BLOCK] %s %s %s (%llu time, %u score)", exe->str, tlsm_ops2str(access_request.op), access_request.object, ts->stats[access_request.op].deny, ts->score);
+        else if (access_request.path)
+            printk(KERN_DEBUG "[TLSM][ACCESS][BLOCK] %s %s %pd (cached, %llu time, %u score)", exe->str, tlsm_ops2str(access_request.op), access_request.path->dentry, ts->stats[access_request.op].deny, ts->score);
+        else
+            printk(KERN_DEBUG "[TLSM][ACCESS][BLOCK] %s %s port %u (cached, %llu time, %u score)", exe->str, tlsm_ops2str(access_request.op), access_request.port, ts->stats[access_request.op].deny, ts->score);
         // rejecting operation
-        kfree(exe_path);
+        kfree(buf);
+        tlsm_str_put(exe);
 
         return -EPERM;
     }
 }
 
+int autorize_access(struct access access_request)
+{
+    if (tlsm_capturing())
+        tlsm_capture_access(&access_request, 0);
+    return __autorize_access(&access_request);
+}
+
+/**
+ * autorize_file_modes - check access modes of an open file, each at most once per policy epoch
+ * @modes: TLSM_MODE_* the file is used for now
+ * @latent: modes it may be used for later, decided now only if the policy for @modes covers them
+ *
+ * The verdicts are kept in the file's blob, which is all later reads, writes and mappings in
+ * the same modes look at.
+ * Return: 0 if every mode of @modes is allowed, -EPERM otherwise
+ */
+int autorize_file_modes(struct file *f, u8 modes, u8 latent)
+{
+    u64 epoch = tlsm_verdict_epoch();
+    u8 checked = 0;
+    u8 denied = 0;
+
+    if (tlsm_file_verdict_lookup(f, modes, &denied))
+        return denied ? -EPERM : 0;
+
+    // one record for all the checks below, the replay splits the modes as they are split here
+    if (tlsm_capturing())
+    {
+        struct access access_request = {
+            .op = TLSM_FILE_OPEN,
+            .path = &f->f_path,
+            .mode = modes,
+        };
+        tlsm_capture_access(&access_request, latent);
+    }
+
+    // pseudo filesystem or anonymous file no open policy names: allowed without resolving its path
+    if (!tlsm_pseudofs_may_match(f))
+    {
+        tlsm_file_verdict_store(f, epoch, modes | latent, 0);
+        return 0;
+    }
+
+    u8 todo = modes | latent;
+    while (todo & modes)
+    {
+        struct access access_request = {
+            .op = TLSM_FILE_OPEN,
+            .path = &f->f_path,
+            .mode = todo,
+        };
+
+        if (__autorize_access(&access_request) != 0)
+            denied |= access_request.mode;
+        checked |= access_request.mode;
+        // the latent modes the first policy does not cover are checked on their first use
+        todo = modes & ~checked;
+    }
+
+    tlsm_file_verdict_store(f, epoch, checked, denied);
+    return denied & modes ? -EPERM : 0;
+}
+
 int allow_req_fs_op(struct task_struct *t)
 {
     char *exe_path = get_exe_path_for_task(t);
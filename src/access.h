@@ -4,6 +4,9 @@
 #include "common.h"
 #include "tlsm.h"
 
+struct sock;
+struct tlsm_sock_dest;
+
 #define DEFAULT_SCORE_UPDATE 0 // use a negative value to decrease score
 
 struct access
@@ -16,11 +19,29 @@ struct access
     char *subject;
     char *object;
     void *meta;
+
+    // TLSM_FILE_OPEN and TLSM_EXECVE
+    const struct path *path; // object is resolved from it only if the verdict is not cached
+
+    // TLSM_FILE_OPEN
+    u8 mode; // TLSM_MODE_* to check, reduced by autorize_access() to the ones its verdict is for
+
+    // TLSM_SIGNAL
+    int signal;
+    struct tlsm_str *target; // receiver's executable, NULL if unknown
+
+    // TLSM_SOCKET_BIND, TLSM_SOCKET_CONNECT and TLSM_SOCKET_SEND
+    int family; // -1 if the address is too short to hold one
+    u8 protocol; // TLSM_PROTO_* of the socket, 0 for others
+    u16 port;    // inet and inet6 only
+    const struct tlsm_sock_dest *dest; // inet and inet6, object is formatted from it if needed
+    struct sock *sk; // TLSM_SOCKET_SEND, keeps the last verdict
 };
 
 int process_policy(struct policy *pol, struct access *access_request);
 int autorize_access(struct access access_request);
+int autorize_file_modes(struct file *f, u8 modes, u8 latent);
 int allow_req_fs_op(struct task_struct *t);
-int tlsmd_request(tlsm_category_t cat, struct access *access_request);
+int tlsmd_request(const struct policy *pol, struct access *access_request);
 
 #endif // ACCESS_H
\ No newline at end of file
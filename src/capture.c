@@ -0,0 +1,304 @@
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#include "capture.h"
+#include "access.h"
+#include "intern.h"
+#include "mem.h"
+
+#define TLSM_CAPTURE_READ_MAX (256 * 1024) // bytes copied to userspace per read
+
+bool tlsm_capture_active = false;
+
+/* records are appended at head and read from tail, both count bytes since the capture started.
+ * A record that does not fit is dropped, the reader is behind. */
+static struct
+{
+    char *buf;
+    size_t size; // multiple of 8, so are the records
+    u64 head;
+    u64 tail;
+    u64 recorded;
+    u64 dropped;
+} tlsm_capture;
+
+static DEFINE_SPINLOCK(tlsm_capture_lock); // protects tlsm_capture and tlsm_capture_active
+static DEFINE_MUTEX(tlsm_capture_mutex);    // one reader or command at a time
+static DECLARE_WAIT_QUEUE_HEAD(tlsm_capture_wait);
+
+static void tlsm_capture_put(u64 pos, const void *data, size_t len)
+{
+    size_t off = pos % tlsm_capture.size;
+    size_t first = min(len, tlsm_capture.size - off);
+
+    if (!len)
+        return;
+    memcpy(tlsm_capture.buf + off, data, first);
+    memcpy(tlsm_capture.buf, (const char *)data + first, len - first);
+}
+
+static void tlsm_capture_get(u64 pos, void *data, size_t len)
+{
+    size_t off = pos % tlsm_capture.size;
+    size_t first = min(len, tlsm_capture.size - off);
+
+    memcpy(data, tlsm_capture.buf + off, first);
+    memcpy((char *)data + first, tlsm_capture.buf, len - first);
+}
+
+/**
+ * tlsm_capture_record - append an access request to the capture buffer
+ * @latent: TLSM_FILE_OPEN, modes decided with the ones of the access if the same policy covers them
+ * @object: the resolved object, the receiver's executable for TLSM_SIGNAL, NULL if there is none
+ *
+ * Nothing is allocated, the record is copied in the buffer under its lock.
+ */
+void tlsm_capture_record(const struct access *a, u8 latent, const struct tlsm_str *exe, const char *object)
+{
+    static const char zeros[8];
+    struct tlsm_capture_record rec = {};
+
+    rec.time_ns = ktime_get_ns();
+    rec.subject_len = min_t(u32, exe->len, TLSM_CAPTURE_MAX_STR);
+    rec.object_len = object ? strnlen(object, TLSM_CAPTURE_MAX_STR) : 0;
+    rec.size = ALIGN(sizeof(rec) + rec.subject_len + rec.object_len, 8);
+    rec.op = a->op;
+    if (a->op == TLSM_FILE_OPEN)
+    {
+        rec.mode = a->mode;
+        rec.latent = latent;
+    }
+    else if (a->op == TLSM_SIGNAL)
+    {
+        rec.signal = a->signal;
+    }
+    else if (tlsm_op_is_socket(a->op))
+    {
+        rec.family = a->family;
+        rec.protocol = a->protocol;
+        rec.port = a->port;
+    }
+
+    spin_lock(&tlsm_capture_lock);
+    if (!tlsm_capture_active)
+        goto record_out;
+    if (tlsm_capture.size - (tlsm_capture.head - tlsm_capture.tail) < rec.size)
+    {
+        tlsm_capture.dropped++;
+        goto record_out;
+    }
+
+    u64 pos = tlsm_capture.head;
+    tlsm_capture_put(pos, &rec, sizeof(rec));
+    pos += sizeof(rec);
+    tlsm_capture_put(pos, exe->str, rec.subject_len);
+    pos += rec.subject_len;
+    tlsm_capture_put(pos, object, rec.object_len);
+    pos += rec.object_len;
+    tlsm_capture_put(pos, zeros, tlsm_capture.head + rec.size - pos);
+    tlsm_capture.head += rec.size;
+    tlsm_capture.recorded++;
+    spin_unlock(&tlsm_capture_lock);
+
+    wake_up_interruptible(&tlsm_capture_wait);
+    return;
+
+record_out:
+    spin_unlock(&tlsm_capture_lock);
+}
+
+/**
+ * tlsm_capture_start - start a new capture in a buffer of capture_buffer_kb
+ *
+ * Records of the previous capture that were not read are lost.
+ * Return: 0 on success, -EINVAL if the buffer size is 0, -ENOMEM if it cannot be allocated
+ */
+static int tlsm_capture_start(void)
+{
+    size_t size = ALIGN_DOWN((size_t)READ_ONCE(capture_buffer_kb) * 1024, 8);
+    char *old;
+    size_t old_size;
+
+    if (!size)
+        return -EINVAL;
+    char *buf = vmalloc(size);
+    if (!buf)
+        return -ENOMEM;
+    tlsm_mem_account(TLSM_MEM_CAPTURE, 1, size);
+
+    spin_lock(&tlsm_capture_lock);
+    old = tlsm_capture.buf;
+    old_size = tlsm_capture.size;
+    tlsm_capture.buf = buf;
+    tlsm_capture.size = size;
+    tlsm_capture.head = 0;
+    tlsm_capture.tail = 0;
+    tlsm_capture.recorded = 0;
+    tlsm_capture.dropped = 0;
+    tlsm_capture_active = true;
+    spin_unlock(&tlsm_capture_lock);
+
+    if (old)
+    {
+        vfree(old);
+        tlsm_mem_account(TLSM_MEM_CAPTURE, -1, -(long)old_size);
+    }
+    printk(KERN_DEBUG "[TLSM][CAPTURE] started, %zu bytes buffer", size);
+    return 0;
+}
+
+/**
+ * tlsm_capture_release - free the buffer of a stopped capture once it has been read
+ *
+ * Must be called with tlsm_capture_mutex held.
+ */
+static void tlsm_capture_release(void)
+{
+    char *buf = NULL;
+    size_t size = 0;
+
+    spin_lock(&tlsm_capture_lock);
+    if (!tlsm_capture_active && tlsm_capture.head == tlsm_capture.tail)
+    {
+        buf = tlsm_capture.buf;
+        size = tlsm_capture.size;
+        tlsm_capture.buf = NULL;
+        tlsm_capture.size = 0;
+    }
+    spin_unlock(&tlsm_capture_lock);
+
+    if (buf)
+    {
+        vfree(buf);
+        tlsm_mem_account(TLSM_MEM_CAPTURE, -1, -(long)size);
+    }
+}
+
+/**
+ * tlsm_capture_command - handle a write to the capture file, "start" or "stop"
+ *
+ * A stopped capture can still be read, until its last record.
+ * Return: 0 on success, negative error code otherwise
+ */
+int tlsm_capture_command(const char *cmd)
+{
+    int err = 0;
+
+    mutex_lock(&tlsm_capture_mutex);
+    if (sysfs_streq(cmd, "start"))
+    {
+        err = tlsm_capture_start();
+    }
+    else if (sysfs_streq(cmd, "stop"))
+    {
+        spin_lock(&tlsm_capture_lock);
+        tlsm_capture_active = false;
+        spin_unlock(&tlsm_capture_lock);
+        wake_up_interruptible(&tlsm_capture_wait);
+        tlsm_capture_release();
+        printk(KERN_DEBUG "[TLSM][CAPTURE] stopped, %llu records, %llu dropped", tlsm_capture.recorded, tlsm_capture.dropped);
+    }
+    else
+    {
+        err = -EINVAL;
+    }
+    mutex_unlock(&tlsm_capture_mutex);
+    return err;
+}
+
+static bool tlsm_capture_readable(void)
+{
+    return READ_ONCE(tlsm_capture.head) != READ_ONCE(tlsm_capture.tail) || !READ_ONCE(tlsm_capture_active);
+}
+
+/**
+ * tlsm_capture_read - read whole records, waiting for some while the capture is running
+ *
+ * Return: bytes read, 0 once a stopped capture has been read entirely, -EINVAL if @count
+ *         cannot hold the next record, negative error code otherwise
+ */
+ssize_t tlsm_capture_read(struct file *file, char __user *buf, size_t count)
+{
+    size_t len = min_t(size_t, count, TLSM_CAPTURE_READ_MAX);
+    size_t n = 0;
+    ssize_t res;
+
+    if (mutex_lock_interruptible(&tlsm_capture_mutex))
+        return -ERESTARTSYS;
+
+    while (!tlsm_capture_readable())
+    {
+        mutex_unlock(&tlsm_capture_mutex);
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(tlsm_capture_wait, tlsm_capture_readable()))
+            return -ERESTARTSYS;
+        if (mutex_lock_interruptible(&tlsm_capture_mutex))
+            return -ERESTARTSYS;
+    }
+
+    char *kbuf = kvmalloc(len, GFP_KERNEL);
+    if (!kbuf)
+    {
+        res = -ENOMEM;
+        goto read_out;
+    }
+
+    // records are only consumed once copied: the mutex keeps other readers and start/stop out
+    // meanwhile, and writers neither move the tail nor write in [tail, head). The lock is only
+    // taken to read the head, with the records it publishes, then to move the tail.
+    spin_lock(&tlsm_capture_lock);
+    u64 tail = tlsm_capture.tail;
+    u64 head = tlsm_capture.head;
+    spin_unlock(&tlsm_capture_lock);
+
+    while (tail + n != head)
+    {
+        struct tlsm_capture_record rec;
+
+        tlsm_capture_get(tail + n, &rec, sizeof(rec));
+        if (n + rec.size > len)
+            break;
+        tlsm_capture_get(tail + n, kbuf + n, rec.size);
+        n += rec.size;
+    }
+    bool left = tail + n != head;
+
+    if (!n)
+        res = left ? -EINVAL : 0;
+    else if (copy_to_user(buf, kbuf, n))
+        res = -EFAULT;
+    else
+    {
+        spin_lock(&tlsm_capture_lock);
+        tlsm_capture.tail = tail + n;
+        spin_unlock(&tlsm_capture_lock);
+        res = n;
+    }
+    kvfree(kbuf);
+    tlsm_capture_release();
+
+read_out:
+    mutex_unlock(&tlsm_capture_mutex);
+    return res;
+}
+
+/**
+ * tlsm_capture_show - print the state of the capture, one "name value" line per counter
+ */
+void tlsm_capture_show(struct seq_file *m)
+{
+    spin_lock(&tlsm_capture_lock);
+    seq_printf(m, "active\t%d\n", tlsm_capture_active);
+    seq_printf(m, "buffer\t%zu\n", tlsm_capture.size);
+    seq_printf(m, "unread\t%llu\n", tlsm_capture.head - tlsm_capture.tail);
+    seq_printf(m, "recorded\t%llu\n", tlsm_capture.recorded);
+    seq_printf(m, "dropped\t%llu\n", tlsm_capture.dropped);
+    spin_unlock(&tlsm_capture_lock);
+}
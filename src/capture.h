@@ -0,0 +1,71 @@
+#ifndef _TLSM_CAPTURE_H
+#define _TLSM_CAPTURE_H
+
+/* capture of the access requests, replayed offline against other rulesets (tools/replay).
+ * The record layout below is shared with userspace, it must not depend on the kernel. */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+typedef uint8_t u8;
+typedef int8_t s8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+#endif
+
+#define TLSM_CAPTURE_MAGIC "TLSMCAP" // with its NUL, first 8 bytes of a saved capture
+#define TLSM_CAPTURE_VERSION 1
+#define TLSM_CAPTURE_MAX_STR 4095 // longer subjects and objects are truncated
+
+/* a saved capture starts with this header, the records follow as read from the capture file */
+struct tlsm_capture_header
+{
+    char magic[8];
+    u32 version;
+    u32 record_size; // sizeof(struct tlsm_capture_record)
+};
+
+/* one access request, followed by its subject then its object, without NULs */
+struct tlsm_capture_record
+{
+    u64 time_ns;     // CLOCK_MONOTONIC
+    u16 size;        // of the record and its strings, padded to a multiple of 8
+    u16 subject_len;
+    u16 object_len;  // 0 if the access has no object
+    u16 port;        // TLSM_SOCKET_*, inet and inet6 only
+    u8 op;           // tlsm_ops_t
+    u8 mode;         // TLSM_FILE_OPEN, TLSM_MODE_* used now
+    u8 latent;       // TLSM_FILE_OPEN, TLSM_MODE_* decided now if the policy for mode covers them
+    s8 family;       // TLSM_SOCKET_*, -1 if the address is too short to hold one
+    u8 protocol;     // TLSM_SOCKET_*, TLSM_PROTO_*
+    u8 signal;       // TLSM_SIGNAL, the object is then the receiver's executable
+    u8 pad[2];
+};
+
+#ifdef __KERNEL__
+#include <linux/fs.h>
+#include <linux/seq_file.h>
+
+#include "tlsm.h"
+
+struct access;
+
+extern bool tlsm_capture_active;
+
+void tlsm_capture_record(const struct access *a, u8 latent, const struct tlsm_str *exe, const char *object);
+int tlsm_capture_command(const char *cmd);
+ssize_t tlsm_capture_read(struct file *file, char __user *buf, size_t count);
+void tlsm_capture_show(struct seq_file *m);
+
+/**
+ * tlsm_capturing - checks if access requests are being captured, the only cost when they are not
+ */
+static inline bool tlsm_capturing(void)
+{
+    return unlikely(READ_ONCE(tlsm_capture_active));
+}
+#endif
+
+#endif // _TLSM_CAPTURE_H
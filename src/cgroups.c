@@ -0,0 +1,219 @@
+#include <linux/cgroup.h>
+#include <linux/hashtable.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+
+#include "cgroups.h"
+#include "utils.h"
+#include "fs.h"
+#include "mem.h"
+
+#define TLSM_CGROUP_BITS 6
+
+static DEFINE_HASHTABLE(tlsm_cgroup_sets, TLSM_CGROUP_BITS); // protected by tlsm_policies_sem
+static unsigned int tlsm_cgroup_count = 0;
+
+/**
+ * tlsm_cgroup_resolve - get the id of a cgroup from its path in the cgroup v2 hierarchy
+ *
+ * Return: 0 on success, -ENOENT if there is no such cgroup
+ */
+int tlsm_cgroup_resolve(const char *path, u64 *cgid)
+{
+#ifdef CONFIG_CGROUPS
+    struct cgroup *cgrp = cgroup_get_from_path(path);
+    if (IS_ERR(cgrp))
+    {
+        printk(KERN_ERR "[TLSM][CGROUP][ERROR] no cgroup at %s", path);
+        return -ENOENT;
+    }
+
+    *cgid = cgroup_id(cgrp);
+    cgroup_put(cgrp);
+    return 0;
+#else
+    return -EOPNOTSUPP;
+#endif
+}
+
+/**
+ * tlsm_cgroup_lookup - find a set from its cgroup id
+ *
+ * Must be called under tlsm_policies_sem or rcu_read_lock().
+ */
+static struct tlsm_cgroup_policies *tlsm_cgroup_lookup(u64 cgid)
+{
+    struct tlsm_cgroup_policies *set;
+
+    hash_for_each_possible_rcu(tlsm_cgroup_sets, set, node, cgid, lockdep_is_held(&tlsm_policies_sem))
+    {
+        if (set->cgid == cgid)
+            return set;
+    }
+    return NULL;
+}
+
+/**
+ * tlsm_task_cgroup_id - get the id of the cgroup v2 whose policies apply to a task
+ *
+ * The task's own cgroup, or its nearest ancestor with policies: the ones of a container also
+ * apply in the cgroups created below it (systemd scopes, nested runtimes).
+ * Return: the cgroup id, 0 when no cgroup has policies for the task
+ */
+u64 tlsm_task_cgroup_id(struct task_struct *t)
+{
+    u64 cgid = 0;
+
+#ifdef CONFIG_CGROUPS
+    if (!READ_ONCE(tlsm_cgroup_count))
+        return 0;
+
+    rcu_read_lock();
+    for (struct cgroup *cgrp = task_dfl_cgroup(t); cgrp; cgrp = cgroup_parent(cgrp))
+    {
+        if (tlsm_cgroup_lookup(cgroup_id(cgrp)))
+        {
+            cgid = cgroup_id(cgrp);
+            break;
+        }
+    }
+    rcu_read_unlock();
+#endif
+
+    return cgid;
+}
+
+struct tlsm_cgroup_policies *tlsm_cgroup_find(u64 cgid)
+{
+    if (!cgid)
+        return NULL;
+    return tlsm_cgroup_lookup(cgid);
+}
+
+/**
+ * tlsm_cgroup_create - get the policy set of a cgroup, creating an empty one if needed
+ *
+ * Return: the set, ERR_PTR(-ENOSPC) if there are max_cgroup_sets already, ERR_PTR(-ENOMEM) on
+ *         allocation failure
+ */
+struct tlsm_cgroup_policies *tlsm_cgroup_create(u64 cgid, const char *path)
+{
+    unsigned int max_sets = READ_ONCE(max_cgroup_sets);
+    struct tlsm_cgroup_policies *set = tlsm_cgroup_find(cgid);
+    if (set)
+        return set;
+
+    if (max_sets && tlsm_cgroup_count >= max_sets)
+    {
+        printk(KERN_ERR "[TLSM][CGROUP][ERROR] %u cgroups have policies already (max_cgroup_sets)", tlsm_cgroup_count);
+        return ERR_PTR(-ENOSPC);
+    }
+
+    set = kzalloc(sizeof(*set), GFP_KERNEL);
+    if (!set)
+        return ERR_PTR(-ENOMEM);
+
+    set->cgid = cgid;
+    set->path = kstrdup(path, GFP_KERNEL);
+    set->policies = tlsm_plist_new();
+    if (!set->path || !set->policies)
+    {
+        kfree(set->path);
+        tlsm_plist_free(set->policies);
+        kfree(set);
+        return ERR_PTR(-ENOMEM);
+    }
+
+    hash_add_rcu(tlsm_cgroup_sets, &set->node, cgid);
+    WRITE_ONCE(tlsm_cgroup_count, tlsm_cgroup_count + 1);
+    tlsm_mem_account(TLSM_MEM_CGROUP, 1, sizeof(*set) + strlen(path) + 1);
+    printk(KERN_DEBUG "[TLSM][CGROUP] new policy set for %s (id %llu)", path, cgid);
+    return set;
+}
+
+static void tlsm_cgroup_remove(struct tlsm_cgroup_policies *set)
+{
+    hash_del_rcu(&set->node);
+    WRITE_ONCE(tlsm_cgroup_count, tlsm_cgroup_count - 1);
+    printk(KERN_DEBUG "[TLSM][CGROUP] removed policy set of %s", set->path);
+    tlsm_mem_account(TLSM_MEM_CGROUP, -1, -(long)(sizeof(*set) + strlen(set->path) + 1));
+
+    // the hooks only read the ids of the sets without tlsm_policies_sem
+    tlsm_plist_free(set->policies);
+    kfree(set->path);
+    kfree_rcu(set, rcu);
+}
+
+/**
+ * tlsm_cgroup_remove_if_empty - drop the policy set of a cgroup once it has no policies left
+ */
+void tlsm_cgroup_remove_if_empty(struct tlsm_cgroup_policies *set)
+{
+    if (!set || set->policies->count)
+        return;
+    tlsm_cgroup_remove(set);
+}
+
+/**
+ * tlsm_cgroup_prune - drop the policy sets of the cgroups that were removed
+ *
+ * Their ids are never reused, no task can match them again, and their path no longer resolves
+ * to delete them.
+ * Return: the number of sets dropped
+ */
+int tlsm_cgroup_prune(void)
+{
+    int removed = 0;
+
+#ifdef CONFIG_CGROUPS
+    struct tlsm_cgroup_policies *set;
+    struct hlist_node *tmp;
+    int bkt;
+
+    hash_for_each_safe(tlsm_cgroup_sets, bkt, tmp, set, node)
+    {
+        struct cgroup *cgrp = cgroup_get_from_id(set->cgid);
+        if (!IS_ERR(cgrp))
+        {
+            cgroup_put(cgrp);
+            continue;
+        }
+        tlsm_cgroup_remove(set);
+        removed++;
+    }
+#endif
+
+    return removed;
+}
+
+/**
+ * tlsm_cgroup_foreach - call fn on the policies of every cgroup
+ */
+void tlsm_cgroup_foreach(void (*fn)(struct plist *policies))
+{
+    struct tlsm_cgroup_policies *set;
+    int bkt;
+
+    hash_for_each(tlsm_cgroup_sets, bkt, set, node)
+        fn(set->policies);
+}
+
+/**
+ * tlsm_cgroup_show - list every cgroup policy, one tab-separated line per policy
+ */
+void tlsm_cgroup_show(struct seq_file *m)
+{
+    struct tlsm_cgroup_policies *set;
+    int bkt;
+
+    hash_for_each(tlsm_cgroup_sets, bkt, set, node)
+    {
+        for (struct policy_node *n = set->policies->head; n; n = n->next)
+        {
+            struct policy *p = n->policy;
+            seq_printf(m, "%s\t%llu\t%s\t%s\t%s\t%s\t%lld\t", set->path, p->id, p->subject->str, tlsm_cat2str(p->category), tlsm_ops2str(p->op), p->object ? p->object->str : "", atomic64_read(&p->hit_count));
+            tlsm_show_options(m, p);
+            seq_putc(m, '\n');
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef _TLSM_CGROUPS_H
+#define _TLSM_CGROUPS_H
+
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/seq_file.h>
+
+#include "tlsm.h"
+
+/* policies attached to a cgroup (v2), evaluated before the global ones for its tasks and the
+ * tasks of its descendants that have no set of their own */
+struct tlsm_cgroup_policies
+{
+    u64 cgid;
+    char *path; // as given when the set was created, for listing
+    struct plist *policies;
+    struct hlist_node node; // looked up under RCU by the hooks, see tlsm_task_cgroup_id()
+    struct rcu_head rcu;
+};
+
+int tlsm_cgroup_resolve(const char *path, u64 *cgid);
+u64 tlsm_task_cgroup_id(struct task_struct *t);
+
+/* the following require tlsm_policies_sem, held for writing when changing sets */
+struct tlsm_cgroup_policies *tlsm_cgroup_find(u64 cgid);
+struct tlsm_cgroup_policies *tlsm_cgroup_create(u64 cgid, const char *path);
+void tlsm_cgroup_remove_if_empty(struct tlsm_cgroup_policies *set);
+int tlsm_cgroup_prune(void);
+void tlsm_cgroup_show(struct seq_file *m);
+void tlsm_cgroup_foreach(void (*fn)(struct plist *policies));
+
+#endif // _TLSM_CGROUPS_H
@@ -1,4 +1,9 @@
+#ifdef __KERNEL__
 #include <linux/string.h>
+#else
+#include <string.h>
+#endif
+
 #include "common.h"
 
 const char *tlsm_cat2str(tlsm_category_t category)
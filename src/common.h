@@ -1,6 +1,13 @@
 #ifndef TLSM_COMMON_H
 #define TLSM_COMMON_H
 
+#ifndef __KERNEL__
+/* common.c and rule.c also build in userspace (tools/replay), their errors go to stderr */
+#include <stdio.h>
+#define KERN_ERR ""
+#define printk(fmt, ...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
+#endif
+
 typedef enum tlsm_category
 {
     TLSM_ALLOW, // must be first so TLSM_ALLOW equals 0 !!
@@ -29,7 +36,7 @@ tlsm_category_t str2tlsm_cat(const char *str);
 /* TLSM OPERATIONS */
 /* to add a new operation, one must *at least* add the operation in the enum and in the op2str table */
 
-#define TLSM_OPS_LEN 6
+#define TLSM_OPS_LEN 7
 
 // must be synchronized with the enum in TLSMD !!
 typedef enum tlsm_ops
@@ -40,6 +47,7 @@ typedef enum tlsm_ops
     TLSM_SOCKET_CONNECT,
     TLSM_SIGNAL,
     TLSM_EXECVE,
+    TLSM_SOCKET_SEND, // datagrams sent to an explicit address (sendto, sendmsg)
 } tlsm_ops_t;
 
 static const struct
@@ -54,10 +62,40 @@ static const struct
     {TLSM_SOCKET_CONNECT, "connect", 1},
     {TLSM_SIGNAL, "signal", 0},
     {TLSM_EXECVE, "execve", 1},
+    {TLSM_SOCKET_SEND, "send", 1},
 };
 
 const char *tlsm_ops2str(tlsm_ops_t op);
 tlsm_ops_t str2tlsm_ops(const char *str);
 int tlsm_op2argc(tlsm_ops_t op);
 
+/**
+ * tlsm_op_is_socket - checks if an operation takes the family, proto and port options
+ */
+static inline int tlsm_op_is_socket(tlsm_ops_t op)
+{
+    return op == TLSM_SOCKET_BIND || op == TLSM_SOCKET_CONNECT || op == TLSM_SOCKET_SEND;
+}
+
+
+/* TLSM FILE ACCESS MODES */
+/* what an open file is used for, open policies can be restricted to some of them (mode=) */
+
+#define TLSM_MODE_READ 0x1
+#define TLSM_MODE_WRITE 0x2
+#define TLSM_MODE_APPEND 0x4 // writes to a file opened with O_APPEND, "write" policies cover it too
+#define TLSM_MODE_EXEC 0x8   // mapped with PROT_EXEC
+#define TLSM_MODE_ALL 0xf
+
+static const struct
+{
+    unsigned char val;
+    const char *str;
+} mode2str[] = {
+    {TLSM_MODE_READ, "read"},
+    {TLSM_MODE_WRITE | TLSM_MODE_APPEND, "write"},
+    {TLSM_MODE_APPEND, "append"},
+    {TLSM_MODE_EXEC, "exec"},
+};
+
 #endif /* TLSM_COMMON_H */
\ No newline at end of file
@@ -5,95 +5,477 @@
 #include <linux/string.h>
 #include <linux/namei.h>
 #include <linux/limits.h>
+#include <linux/seq_file.h>
+#include <linux/hashtable.h>
 
 #include "fs.h"
 #include "tlsm.h"
 #include "utils.h"
 #include "access.h"
 #include "common.h"
+#include "cgroups.h"
+#include "net.h"
+#include "verdict.h"
+#include "mem.h"
+#include "ruleset.h"
+#include "capture.h"
+#include "pseudofs.h"
 
 struct dentry *tlsm_fs_root = NULL;
 
-unsigned long long last_read = 0;
+/* pending ask and analyze requests, by uid: the limits are per user and per program of a
+ * user, so admitting a request only walks the requester's bucket */
 
-static ssize_t tlsm_read(struct file *file, char __user *buf,
-						 size_t count, loff_t *ppos)
+#define TLSM_PENDING_BITS 6
+
+static DEFINE_HASHTABLE(tlsm_pending, TLSM_PENDING_BITS);
+static DEFINE_SPINLOCK(tlsm_pending_lock); // protects tlsm_pending and tlsm_pending_stats
+
+static struct
 {
-	char *fpath = kzalloc(sizeof(char) * PATH_MAX, GFP_KERNEL);
-	if (unlikely(!fpath))
-		return 0;
+	unsigned int depth;	 // requests waiting for tlsmd
+	unsigned int waiters; // tasks waiting on them, coalesced ones included
+	u64 admitted;
+	u64 coalesced;
+	u64 rejected_total;
+	u64 rejected_user;
+	u64 rejected_subject;
+	u64 unanswered; // timed out, or tlsmd could not be signaled
+} tlsm_pending_stats;
+
+/* list_policies / list_policies_raw */
+/* each reader gets its own cursor so a read can resume where the previous one stopped,
+ * without re-walking the list from its head (and without disturbing other readers) */
+
+struct tlsm_list_cursor
+{
+	struct policy_node *node; // node found at index pos
+	loff_t pos;
+	unsigned long long generation; // tlsm_policies generation the cursor is valid for
+	int raw; // tab-separated output for tools
+};
+
+static void *tlsm_list_start(struct seq_file *m, loff_t *pos)
+{
+	struct tlsm_list_cursor *cur = m->private;
+	struct policy_node *node;
+	loff_t i;
+
+	down_read(&tlsm_policies_sem);
 
-	char *res = d_path(&file->f_path, fpath, PATH_MAX);
-	printk(KERN_DEBUG "[TLSM][FS] read to file %s, out buff size %lu", res, count);
+	if (cur->node && cur->pos == *pos && cur->generation == tlsm_policies->generation)
+		return cur->node;
 
-	int rlen = 0;
-	long pos = *ppos;
+	// list changed or unexpected seek, walk again from the head
+	node = tlsm_policies->head;
+	for (i = 0; node && i < *pos; i++)
+		node = node->next;
 
-	char *kbuf;
-	kbuf = memdup_user_nul(buf, count);
-	if (IS_ERR(kbuf))
+	cur->node = node;
+	cur->pos = *pos;
+	cur->generation = tlsm_policies->generation;
+	return node;
+}
+
+static void *tlsm_list_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct tlsm_list_cursor *cur = m->private;
+	struct policy_node *node = ((struct policy_node *)v)->next;
+
+	(*pos)++;
+	cur->node = node;
+	cur->pos = *pos;
+	return node;
+}
+
+static void tlsm_list_stop(struct seq_file *m, void *v)
+{
+	up_read(&tlsm_policies_sem);
+}
+
+/**
+ * tlsm_show_options - print the non-default options of a policy, space separated
+ */
+void tlsm_show_options(struct seq_file *m, struct policy *p)
+{
+	const char *sep = "";
+
+	if (p->op == TLSM_SIGNAL && p->opts.sigmask != ~0ULL)
 	{
-		kfree(fpath);
-		return PTR_ERR(kbuf);
+		seq_printf(m, "%ssig=", sep);
+		for (int sig = 1; sig <= 64; sig++)
+		{
+			if (p->opts.sigmask & BIT_ULL(sig - 1))
+				seq_printf(m, "%s%d", p->opts.sigmask & (BIT_ULL(sig - 1) - 1) ? "," : "", sig);
+		}
+		sep = " ";
+	}
+	if (p->target)
+	{
+		seq_printf(m, "%starget=%s", sep, p->target->str);
+		sep = " ";
+	}
+	if (p->opts.timeout_ms)
+	{
+		seq_printf(m, "%stimeout=%ums", sep, p->opts.timeout_ms);
+		sep = " ";
+	}
+	if (p->opts.fallback != TLSM_FALLBACK_DEFAULT)
+	{
+		seq_printf(m, "%sdefault=%s", sep, p->opts.fallback == TLSM_FALLBACK_ALLOW ? "allow" : "deny");
+		sep = " ";
+	}
+	if (p->op == TLSM_FILE_OPEN && p->opts.modes != TLSM_MODE_ALL)
+	{
+		u8 shown = 0;
+		seq_printf(m, "%smode=", sep);
+		for (int i = 0; i < ARRAY_SIZE(mode2str); i++)
+		{
+			// "write" includes append, do not print it again
+			if ((p->opts.modes & mode2str[i].val) == mode2str[i].val && (shown & mode2str[i].val) != mode2str[i].val)
+			{
+				seq_printf(m, "%s%s", shown ? "," : "", mode2str[i].str);
+				shown |= mode2str[i].val;
+			}
+		}
+		sep = " ";
+	}
+	if (p->category == TLSM_ANALYZE && p->opts.allow_above != UINT_MAX)
+	{
+		seq_printf(m, "%sallow_above=%u:%d", sep, p->opts.allow_above, p->opts.allow_delta);
+		sep = " ";
+	}
+	if (p->category == TLSM_ANALYZE && p->opts.deny_below)
+	{
+		seq_printf(m, "%sdeny_below=%u:%d", sep, p->opts.deny_below, p->opts.deny_delta);
+		sep = " ";
+	}
+	if (!tlsm_op_is_socket(p->op))
+		return;
+	if (p->opts.families != ~0ULL)
+	{
+		seq_printf(m, "%sfamily=", sep);
+		for (int family = 0; family < 64; family++)
+		{
+			if (p->opts.families & BIT_ULL(family))
+				seq_printf(m, "%s%d", p->opts.families & (BIT_ULL(family) - 1) ? "," : "", family);
+		}
+		sep = " ";
+	}
+	if (p->opts.protocols != TLSM_PROTO_ANY)
+	{
+		seq_printf(m, "%sproto=%s%s%s", sep, p->opts.protocols & TLSM_PROTO_TCP ? "tcp" : "",
+			   p->opts.protocols == (TLSM_PROTO_TCP | TLSM_PROTO_UDP) ? "," : "", p->opts.protocols & TLSM_PROTO_UDP ? "udp" : "");
+		sep = " ";
+	}
+	for (int i = 0; i < p->opts.nports; i++)
+	{
+		seq_printf(m, "%s%s%u", i ? "," : sep, i ? "" : "port=", p->opts.ports[i].lo);
+		if (p->opts.ports[i].hi != p->opts.ports[i].lo)
+			seq_printf(m, "-%u", p->opts.ports[i].hi);
+	}
+}
+
+static int tlsm_list_show(struct seq_file *m, void *v)
+{
+	struct tlsm_list_cursor *cur = m->private;
+	struct policy *p = ((struct policy_node *)v)->policy;
+
+	if (cur->raw)
+	{
+		seq_printf(m, "%llu\t%s\t%s\t%s\t%s\t%lld\t", p->id, p->subject->str, tlsm_cat2str(p->category), tlsm_ops2str(p->op), p->object ? p->object->str : "", atomic64_read(&p->hit_count));
+		tlsm_show_options(m, p);
+		seq_putc(m, '\n');
+	}
+	else
+	{
+		seq_printf(m, "rule #%llu : %s %s %s %s ", p->id, p->subject->str, tlsm_cat2str(p->category), tlsm_ops2str(p->op), p->object ? p->object->str : NULL);
+		tlsm_show_options(m, p);
+		seq_printf(m, " (hit count %lld)\n", atomic64_read(&p->hit_count));
+	}
+	return 0;
+}
+
+static const struct seq_operations tlsm_list_seq_ops = {
+	.start = tlsm_list_start,
+	.next = tlsm_list_next,
+	.stop = tlsm_list_stop,
+	.show = tlsm_list_show,
+};
+
+static int tlsm_list_open(struct inode *inode, struct file *file)
+{
+	struct tlsm_list_cursor *cur;
+
+	cur = __seq_open_private(file, &tlsm_list_seq_ops, sizeof(*cur));
+	if (!cur)
+		return -ENOMEM;
+
+	// i_private is set for the machine-readable file
+	cur->raw = inode->i_private != NULL;
+	return 0;
+}
+
+static const struct file_operations tlsm_list_ops = {
+	.open = tlsm_list_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release_private,
+};
+
+/**
+ * tlsm_del_policy - handles a del_policy command, on the global policies or on a cgroup's ones
+ *
+ * Supported commands:
+ *   <id> or "id <id>"  remove one policy
+ *   "subject <path>"   remove every policy of a subject
+ *   "op <op>"          remove every policy for an operation
+ *   "all"              replace the policies by an empty list in one step
+ *
+ * A cgroup policy set is dropped once it is empty.
+ * Return: 0 on success, negative error code otherwise
+ */
+static int tlsm_del_policy(const char *cgroup_path, char *cmd)
+{
+	struct tlsm_words w;
+	struct plist *fresh = NULL;
+	struct plist *old = NULL;
+	u64 cgid = 0;
+	int ret = 0;
+	u64 id;
+
+	if (str_split(cmd, ' ', &w) != 0 || w.count == 0)
+		return -EINVAL;
+
+	if (cgroup_path)
+	{
+		ret = tlsm_cgroup_resolve(cgroup_path, &cgid);
+		if (ret)
+			goto del_out;
+	}
+
+	if (w.count == 1 && strcmp(w.word[0], "all") == 0)
+	{
+		// allocate before taking the lock, swapping is then a pointer assignment
+		fresh = tlsm_plist_new();
+		if (!fresh)
+		{
+			ret = -ENOMEM;
+			goto del_out;
+		}
 	}
 
-	if (strncmp((const char *)&file->f_path.dentry->d_iname, "list_policies", 13) == 0 && strlen((const char *)&file->f_path.dentry->d_iname) == 13)
+	down_write(&tlsm_policies_sem);
+
+	struct tlsm_cgroup_policies *set = NULL;
+	struct plist **target = &tlsm_policies;
+	if (cgroup_path)
 	{
-		printk(KERN_DEBUG "[TLSM][FS] read list_policies request (count=%zd, pos=%ld)", count, pos);
-		struct policy_node *curr = tlsm_policies->head;
+		if (tlsm_cgroup_prune())
+		{
+			tlsm_net_filter_rebuild();
+			tlsm_pseudofs_filter_rebuild();
+		}
+		set = tlsm_cgroup_find(cgid);
+		if (!set)
+		{
+			printk(KERN_ERR "[TLSM][FS][ERROR] cgroup %s has no policies", cgroup_path);
+			ret = -ENOENT;
+			goto del_unlock;
+		}
+		target = &set->policies;
+	}
 
-		// select if this is a new read from the beginning
-		// or the continuation of a previous read
-		unsigned long long i = 0;
-		if (pos > 0)
+	if (fresh)
+	{
+		// keep generations increasing so list cursors on the old list are dropped
+		fresh->generation = (*target)->generation + 1;
+		old = *target;
+		*target = fresh;
+		fresh = NULL;
+		printk(KERN_DEBUG "[TLSM][FS] flushed all policies");
+	}
+	else if (w.count == 2 && strcmp(w.word[0], "subject") == 0)
+	{
+		int removed = tlsm_plist_del_subject(*target, w.word[1]);
+		printk(KERN_DEBUG "[TLSM][FS] removed %d rules of subject %s", removed, w.word[1]);
+	}
+	else if (w.count == 2 && strcmp(w.word[0], "op") == 0)
+	{
+		tlsm_ops_t op = str2tlsm_ops(w.word[1]);
+		if (op == TLSM_OP_UNDEFINED && strcmp(w.word[1], tlsm_ops2str(TLSM_OP_UNDEFINED)) != 0)
 		{
-			i = last_read;
+			printk(KERN_ERR "[TLSM][FS][ERROR] cannot parse operation %s", w.word[1]);
+			ret = -EINVAL;
 		}
 		else
 		{
-			last_read = 0;
+			int removed = tlsm_plist_del_op(*target, op);
+			printk(KERN_DEBUG "[TLSM][FS] removed %d rules for op %s", removed, w.word[1]);
 		}
+	}
+	else if ((w.count == 1 || (w.count == 2 && strcmp(w.word[0], "id") == 0)) && kstrtou64(w.word[w.count - 1], 10, &id) == 0)
+	{
+		if (tlsm_plist_del(*target, id) != 0)
+		{
+			printk(KERN_ERR "[TLSM][FS][ERROR] no existing rule with id %llu", id);
+			ret = -EINVAL;
+		}
+	}
+	else
+	{
+		printk(KERN_ERR "[TLSM][FS] failed to parse del_policy command");
+		ret = -EINVAL;
+	}
 
-		// seek to last read policy
-		for (unsigned long long j = 0; j < i; j++)
+	// rules of removed policies are only killed, the filters keep their bits until the list is
+	// compacted: they may let accesses reach a ruleset that matches none of them, nothing more
+	if (ret == 0)
+	{
+		if (tlsm_ruleset_compact(*target))
 		{
-			if (curr)
-				curr = curr->next;
+			tlsm_net_filter_rebuild();
+			tlsm_pseudofs_filter_rebuild();
 		}
+		tlsm_verdict_flush();
+	}
+	tlsm_cgroup_remove_if_empty(set);
+
+del_unlock:
+	up_write(&tlsm_policies_sem);
+	tlsm_plist_free(old);
+	tlsm_plist_free(fresh);
+del_out:
+	return ret;
+}
+
+/**
+ * tlsm_add_policy - parses and adds policies, one per line, to the global policies or to a cgroup's ones
+ *
+ * Either every policy is added or none is, and the list is compiled once. The policies are not
+ * added if the list would have more than max_rules, or if the policy state is above
+ * max_policy_memory_kb once they are compiled.
+ * Return: 0 on success, negative error code otherwise (-ENOSPC past a limit)
+ */
+static int tlsm_add_policy(const char *cgroup_path, char *rules)
+{
+	u64 cgid = 0;
+	int res;
+
+	if (cgroup_path)
+	{
+		res = tlsm_cgroup_resolve(cgroup_path, &cgid);
+		if (res)
+			return res;
+	}
 
-		while (curr && count - rlen > 512)
+	int count = 1;
+	for (char *c = rules; *c; c++)
+	{
+		if (*c == '\n')
+			count++;
+	}
+
+	struct policy **policies = kcalloc(count, sizeof(*policies), GFP_KERNEL);
+	if (!policies)
+		return -ENOMEM;
+
+	char *rule;
+	int parsed = 0;
+	while ((rule = strsep(&rules, "\n")) != NULL)
+	{
+		if (!*rule)
+			continue;
+		policies[parsed] = parse_policy(rule);
+		if (policies[parsed] == NULL)
 		{
-			struct policy *p = curr->policy;
-			int j = scnprintf(&kbuf[rlen], count - rlen, "rule #%lld : %s %s %s %s (hit count %lld)\n", i, p->subject, tlsm_cat2str(p->category), tlsm_ops2str(p->op), p->object, p->hit_count);
-			rlen += j;
-			i++;
-			curr = curr->next;
+			printk(KERN_ERR "[TLSM][FS] cannot create policy");
+			res = -EINVAL;
+			goto add_out;
 		}
-		last_read = i;
+		parsed++;
 	}
-	else
+
+	down_write(&tlsm_policies_sem);
+	struct tlsm_cgroup_policies *set = NULL;
+	struct plist *target = tlsm_policies;
+	res = 0;
+	if (cgroup_path)
 	{
-		printk(KERN_DEBUG "[TLSM][ERROR] fs error - cannot read this file");
+		// sets of removed cgroups would count in max_cgroup_sets forever
+		if (tlsm_cgroup_prune())
+		{
+			tlsm_net_filter_rebuild();
+			tlsm_pseudofs_filter_rebuild();
+		}
+		set = tlsm_cgroup_create(cgid, cgroup_path);
+		if (IS_ERR(set))
+		{
+			res = PTR_ERR(set);
+			set = NULL;
+			target = NULL;
+		}
+		else
+		{
+			target = set->policies;
+		}
 	}
 
-	kfree(fpath);
+	int added = 0;
+	bool compiled = false;
+	if (res == 0 && max_rules && target->count + parsed > max_rules)
+	{
+		printk(KERN_ERR "[TLSM][FS][ERROR] %d more rules would exceed max_rules (%u)", parsed, max_rules);
+		res = -ENOSPC;
+	}
+	while (res == 0 && added < parsed)
+	{
+		res = tlsm_plist_add(target, policies[added]);
+		if (res == 0)
+			added++;
+	}
+	if (res == 0)
+		res = tlsm_ruleset_compile(target);
+	if (res == 0 && tlsm_mem_policy_over_limit())
+	{
+		printk(KERN_ERR "[TLSM][FS][ERROR] %d more rules would exceed max_policy_memory_kb (%u)", parsed, max_policy_memory_kb);
+		compiled = true;
+		res = -ENOSPC;
+	}
 
-	if (rlen == 0 || !count)
+	if (res == 0)
 	{
-		kfree(kbuf);
-		return 0;
+		for (int i = 0; i < parsed; i++)
+		{
+			tlsm_net_filter_add(policies[i]);
+			tlsm_pseudofs_filter_add(policies[i]);
+		}
+		tlsm_verdict_flush();
+		parsed = 0; // owned by the list now
 	}
-	else if (copy_to_user(buf, kbuf, rlen))
+	else if (target)
 	{
-		kfree(kbuf);
-		return -EFAULT;
+		// the compiled ruleset was left unchanged unless it went over the memory limit, then
+		// it is compiled again without the new policies (shrinks in place, only its DFAs can
+		// fail to be built)
+		for (int i = 0; i < added; i++)
+			tlsm_plist_del(target, policies[i]->id);
+		if (compiled)
+			tlsm_ruleset_compile(target);
+		memmove(policies, policies + added, (parsed - added) * sizeof(*policies));
+		parsed -= added;
+		tlsm_cgroup_remove_if_empty(set);
 	}
+	up_write(&tlsm_policies_sem);
 
-	if (kbuf)
-		kfree(kbuf);
+	if (res != 0)
+		printk(KERN_ERR "[TLSM][FS] cannot add new rules");
 
-	*ppos += rlen;
-	return rlen;
+add_out:
+	for (int i = 0; i < parsed; i++)
+		tlsm_policy_free(policies[i]);
+	kfree(policies);
+	return res;
 }
 
 static ssize_t tlsm_write(struct file *file, const char __user *buf,
@@ -114,52 +496,45 @@ static ssize_t tlsm_write(struct file *file, const char __user *buf,
 
 	if (strncmp((const char *)&file->f_path.dentry->d_iname, "add_policy", 10) == 0 && strlen((const char *)&file->f_path.dentry->d_iname) == 10)
 	{
-		struct policy *p = parse_policy(state);
-
-		if (p == NULL)
+		int ret = tlsm_add_policy(NULL, state);
+		if (ret < 0)
 		{
-			printk(KERN_ERR "[TLSM][FS] cannot create policy");
 			kfree(fpath);
 			kfree(state);
-			return -EINVAL;
+			return ret;
 		}
-		else
+	}
+	else if (strncmp((const char *)&file->f_path.dentry->d_iname, "del_policy", 10) == 0 && strlen((const char *)&file->f_path.dentry->d_iname) == 10)
+	{
+		int ret = tlsm_del_policy(NULL, state);
+		if (ret < 0)
 		{
-			int res = tlsm_plist_add(tlsm_policies, p);
-
-			if (res != 0)
-			{
-				printk(KERN_ERR "[TLSM][FS] cannot add new rule");
-				tlsm_policy_free(p);
-			}
+			kfree(fpath);
+			kfree(state);
+			return ret;
 		}
 	}
-	else if (strncmp((const char *)&file->f_path.dentry->d_iname, "del_policy", 10) == 0 && strlen((const char *)&file->f_path.dentry->d_iname) == 10)
+	else if (strncmp((const char *)&file->f_path.dentry->d_iname, "cgroup_add_policy", 17) == 0 || strncmp((const char *)&file->f_path.dentry->d_iname, "cgroup_del_policy", 17) == 0)
 	{
-		int target;
+		// "<cgroup path> <policy or del_policy command>"
+		int add = strncmp((const char *)&file->f_path.dentry->d_iname, "cgroup_add_policy", 17) == 0;
+		char *cmd = state;
+		char *cgroup_path = strsep(&cmd, " ");
+		int ret = -EINVAL;
 
-		// Remove trailing '\n'
-		int len = strlen(state);
-		if (*(state + len - 1) == '\n')
-			*(state + len - 1) = '\0';
-
-		int ret = kstrtoint(state, 10, &target);
-		if (ret == 0)
+		if (cmd && *cgroup_path)
 		{
-			if (tlsm_plist_del(tlsm_policies, target) != 0)
-			{
-				printk(KERN_ERR "[TLSM][FS][ERROR] no existing rule at index %d", target);
-				kfree(fpath);
-				kfree(state);
-				return -EINVAL;
-			}
+			if (add)
+				ret = tlsm_add_policy(cgroup_path, cmd);
+			else
+				ret = tlsm_del_policy(cgroup_path, cmd);
 		}
-		else
+
+		if (ret < 0)
 		{
-			printk(KERN_ERR "[TLSM][FS] failed to parse policy index, error %d", ret);
 			kfree(fpath);
 			kfree(state);
-			return -EINVAL;
+			return ret;
 		}
 	}
 	else if (strncmp((const char *)&file->f_path.dentry->d_iname, "add_watchdog", 12) == 0 && strlen((const char *)&file->f_path.dentry->d_iname) == 12)
@@ -167,14 +542,19 @@ static ssize_t tlsm_write(struct file *file, const char __user *buf,
 		struct tlsm_watchdog *nw = parse_watchdog(state);
 		if (nw != NULL)
 		{
+			spin_lock(&tlsm_watchdogs_lock);
 			size_t bef = list_count_nodes(&tlsm_watchdogs);
 			list_add_tail(&nw->node, &tlsm_watchdogs);
 			size_t after = list_count_nodes(&tlsm_watchdogs);
+			spin_unlock(&tlsm_watchdogs_lock);
 			printk(KERN_DEBUG "[TLSM][FS] Adding watchdog, %zu->%zu", bef, after);
 		}
 		else
 		{
 			printk(KERN_ERR "[TLSM][FS][ERROR] Cannot create new watchdog");
+			kfree(fpath);
+			kfree(state);
+			return -EINVAL;
 		}
 	}
 	else
@@ -188,87 +568,198 @@ static ssize_t tlsm_write(struct file *file, const char __user *buf,
 	return count;
 }
 
-static const struct file_operations tlsm_ops = {
-	.read = tlsm_read,
-	.write = tlsm_write,
+static int tlsm_cgroup_list_show(struct seq_file *m, void *v)
+{
+	down_read(&tlsm_policies_sem);
+	tlsm_cgroup_show(m);
+	up_read(&tlsm_policies_sem);
+	return 0;
+}
+
+static int tlsm_cgroup_list_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tlsm_cgroup_list_show, NULL);
+}
+
+static const struct file_operations tlsm_cgroup_list_ops = {
+	.open = tlsm_cgroup_list_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
 };
 
-static ssize_t tlsm_req_read(struct file *file, char __user *buf,
-							 size_t count, loff_t *ppos)
+static int tlsm_stats_show(struct seq_file *m, void *v)
 {
-	if (allow_req_fs_op(get_current()))
-		return 0;
+	tlsm_mem_show(m);
+	return 0;
+}
 
-	char *fpath = kzalloc(sizeof(char) * PATH_MAX, GFP_KERNEL);
-	if (unlikely(!fpath))
-		return 0;
+static int tlsm_requests_show(struct seq_file *m, void *v)
+{
+	spin_lock(&tlsm_pending_lock);
+	seq_printf(m, "pending\t%u\n", tlsm_pending_stats.depth);
+	seq_printf(m, "waiting\t%u\n", tlsm_pending_stats.waiters);
+	seq_printf(m, "admitted\t%llu\n", tlsm_pending_stats.admitted);
+	seq_printf(m, "coalesced\t%llu\n", tlsm_pending_stats.coalesced);
+	seq_printf(m, "rejected_total\t%llu\n", tlsm_pending_stats.rejected_total);
+	seq_printf(m, "rejected_user\t%llu\n", tlsm_pending_stats.rejected_user);
+	seq_printf(m, "rejected_subject\t%llu\n", tlsm_pending_stats.rejected_subject);
+	seq_printf(m, "unanswered\t%llu\n", tlsm_pending_stats.unanswered);
+	spin_unlock(&tlsm_pending_lock);
+	return 0;
+}
 
-	char *res = d_path(&file->f_path, fpath, PATH_MAX);
-	printk(KERN_DEBUG "[TLSM][FS] read to file %s, out buff size %lu", res, count);
+static int tlsm_requests_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tlsm_requests_show, NULL);
+}
 
-	int rlen = 0;
-	long pos = *ppos;
+static const struct file_operations tlsm_requests_ops = {
+	.open = tlsm_requests_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
-	char *kbuf;
-	kbuf = memdup_user_nul(buf, count);
-	if (IS_ERR(kbuf))
-	{
-		kfree(fpath);
-		return PTR_ERR(kbuf);
-	}
+static int tlsm_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tlsm_stats_show, NULL);
+}
 
-	struct fs_request *req = (struct fs_request *)file->f_inode->i_private;
+static const struct file_operations tlsm_stats_ops = {
+	.open = tlsm_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
-	if (strncmp((const char *)&file->f_path.dentry->d_iname, "request_", 8) == 0)
-	{
-		// serialize supervised or not
-		int k = scnprintf(&kbuf[pos], count - pos, "%hd %d\n", req->access_request.supervised, req->access_request.score);
-		rlen += k;
-		pos += k;
+static int tlsm_capture_status_show(struct seq_file *m, void *v)
+{
+	tlsm_capture_show(m);
+	return 0;
+}
 
-		// serialize access_request, human-readable format
-		k = scnprintf(&kbuf[pos], count - pos, "%s trying to %s %s\n", req->access_request.subject, tlsm_ops2str(req->access_request.op), req->access_request.object);
-		rlen += k;
-		pos += k;
-		printk(KERN_DEBUG "[TLSM][FS] read buffer content %d out of %zd", rlen, count);
+static int tlsm_capture_status_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tlsm_capture_status_show, NULL);
+}
 
-		// serialize op_stat
-		for (int i = 0; i < TLSM_OPS_LEN; i++)
-		{
-			k = scnprintf(&kbuf[pos], count - pos, "%lld %lld\n", req->stats[i].deny, req->stats[i].total);
-			rlen += k;
-			pos += k;
-		}
-	}
-	else
+static const struct file_operations tlsm_capture_status_ops = {
+	.open = tlsm_capture_status_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static ssize_t tlsm_capture_file_read(struct file *file, char __user *buf,
+									  size_t count, loff_t *ppos)
+{
+	ssize_t res = tlsm_capture_read(file, buf, count);
+
+	if (res > 0)
+		*ppos += res;
+	return res;
+}
+
+static ssize_t tlsm_capture_file_write(struct file *file, const char __user *buf,
+									   size_t count, loff_t *ppos)
+{
+	char *cmd = memdup_user_nul(buf, count);
+	if (IS_ERR(cmd))
+		return PTR_ERR(cmd);
+
+	int ret = tlsm_capture_command(cmd);
+	kfree(cmd);
+	return ret < 0 ? ret : count;
+}
+
+// "start" and "stop" are written to it, the records of the capture are read from it
+static const struct file_operations tlsm_capture_ops = {
+	.read = tlsm_capture_file_read,
+	.write = tlsm_capture_file_write,
+	.llseek = noop_llseek,
+};
+
+static const struct file_operations tlsm_ops = {
+	.write = tlsm_write,
+};
+
+/**
+ * tlsm_request_put - drop a reference on a request, freeing it with the last one
+ */
+static void tlsm_request_put(struct fs_request *req)
+{
+	if (refcount_dec_and_test(&req->ref))
 	{
-		printk(KERN_DEBUG "[TLSM][ERROR] fs error");
+		tlsm_mem_free(TLSM_MEM_ANSWER, req->answer);
+		tlsm_mem_free(TLSM_MEM_REQUEST, req);
 	}
+}
 
-	kfree(fpath);
+/* an open request file holds a reference on its request: tlsmd can read or answer it after
+ * the requester gave up, the request is then removed and the file refuses both */
 
-	if (*ppos >= rlen || !count)
-	{
-		kfree(kbuf);
+static int tlsm_req_open(struct inode *inode, struct file *file)
+{
+	spin_lock(&tlsm_pending_lock);
+	struct fs_request *req = inode->i_private;
+	if (req)
+		refcount_inc(&req->ref);
+	spin_unlock(&tlsm_pending_lock);
+
+	if (!req)
+		return -ENOENT;
+	file->private_data = req;
+	return 0;
+}
+
+static int tlsm_req_release(struct inode *inode, struct file *file)
+{
+	tlsm_request_put(file->private_data);
+	return 0;
+}
+
+// supervised and score, the access, then the deny and total counts of each operation
+#define TLSM_REQ_TEXT_MAX (2 * PATH_MAX + 64 + TLSM_OPS_LEN * 44)
+
+static ssize_t tlsm_req_read(struct file *file, char __user *buf,
+							 size_t count, loff_t *ppos)
+{
+	struct fs_request *req = file->private_data;
+
+	if (allow_req_fs_op(get_current()))
 		return 0;
-	}
 
-	if (copy_to_user(buf, kbuf, rlen))
+	char *kbuf = kmalloc(TLSM_REQ_TEXT_MAX, GFP_KERNEL);
+	if (!kbuf)
+		return -ENOMEM;
+
+	// the subject and object are freed by the requester once the request is removed
+	spin_lock(&tlsm_pending_lock);
+	if (req->removed)
 	{
+		spin_unlock(&tlsm_pending_lock);
 		kfree(kbuf);
-		return -EFAULT;
+		return -ENOENT;
 	}
-
-	if (kbuf)
-		kfree(kbuf);
-
-	*ppos += rlen;
-	return rlen;
+	const struct access *a = &req->access_request;
+	int len = scnprintf(kbuf, TLSM_REQ_TEXT_MAX, "%hd %d\n%s trying to %s %s\n", a->supervised, a->score,
+						a->subject, tlsm_ops2str(a->op), a->object);
+	for (int i = 0; i < TLSM_OPS_LEN; i++)
+		len += scnprintf(kbuf + len, TLSM_REQ_TEXT_MAX - len, "%lld %lld\n", req->stats[i].deny, req->stats[i].total);
+	spin_unlock(&tlsm_pending_lock);
+
+	ssize_t res = simple_read_from_buffer(buf, count, ppos, kbuf, len);
+	kfree(kbuf);
+	return res;
 }
 
 static ssize_t tlsm_req_write(struct file *file, const char __user *buf,
 							  size_t count, loff_t *ppos)
 {
+	struct fs_request *req = file->private_data;
+	int err = 0;
+
 	if (allow_req_fs_op(get_current()))
 	{
 		*ppos += count;
@@ -282,35 +773,42 @@ static ssize_t tlsm_req_write(struct file *file, const char __user *buf,
 		return PTR_ERR(state);
 	}
 
-	struct fs_request *req = (struct fs_request *)file->f_inode->i_private;
+	struct fs_answer *answer = parse_answer(state);
+	kfree(state);
+	if (!answer)
+		return -EINVAL;
+
+	// the first answer is the one waiters read, later ones and late ones are refused
+	spin_lock(&tlsm_pending_lock);
+	if (req->removed)
+		err = -ENOENT;
+	else if (req->answer)
+		err = -EALREADY;
+	else
+		WRITE_ONCE(req->answer, answer);
+	spin_unlock(&tlsm_pending_lock);
 
-	char *fpath = kzalloc(sizeof(char) * PATH_MAX, GFP_KERNEL);
-	if (unlikely(!fpath))
+	if (err)
 	{
-		kfree(state);
-		return count;
+		printk(KERN_DEBUG "[TLSM][FS] answer to request %llu refused (%d)", req->number, err);
+		tlsm_mem_free(TLSM_MEM_ANSWER, answer);
+		return err;
 	}
+	printk(KERN_DEBUG "[TLSM][FS] request %llu answered", req->number);
 
-	char *res = d_path(&file->f_path, fpath, PATH_MAX);
-	printk(KERN_DEBUG "[TLSM] write to request file %s", res);
-
-	req->answer = parse_answer(state);
-
-	// wake up lsm hook pending on user response
-	up(&(req->sem));
-
-	if (state)
-		kfree(state);
-
-	kfree(fpath);
+	// wake up lsm hooks pending on user response
+	complete_all(&req->answered);
 
 	*ppos += count;
 	return count;
 }
 
 static const struct file_operations tlsm_reqfile_ops = {
+	.open = tlsm_req_open,
 	.read = tlsm_req_read,
 	.write = tlsm_req_write,
+	.release = tlsm_req_release,
+	.llseek = default_llseek,
 };
 
 /**
@@ -325,36 +823,146 @@ static int tlsm_interface_init(void)
 	securityfs_create_file("add_watchdog", 0666, tlsm_fs_root, NULL, &tlsm_ops);
 	securityfs_create_file("add_policy", 0600, tlsm_fs_root, NULL, &tlsm_ops);
 	securityfs_create_file("del_policy", 0600, tlsm_fs_root, NULL, &tlsm_ops);
-	securityfs_create_file("list_policies", 0600, tlsm_fs_root, NULL, &tlsm_ops);
+	securityfs_create_file("list_policies", 0600, tlsm_fs_root, NULL, &tlsm_list_ops);
+	securityfs_create_file("list_policies_raw", 0600, tlsm_fs_root, (void *)1, &tlsm_list_ops);
+	securityfs_create_file("cgroup_add_policy", 0600, tlsm_fs_root, NULL, &tlsm_ops);
+	securityfs_create_file("cgroup_del_policy", 0600, tlsm_fs_root, NULL, &tlsm_ops);
+	securityfs_create_file("cgroup_list_policies", 0600, tlsm_fs_root, NULL, &tlsm_cgroup_list_ops);
+	securityfs_create_file("stats", 0400, tlsm_fs_root, NULL, &tlsm_stats_ops);
+	securityfs_create_file("requests", 0444, tlsm_fs_root, NULL, &tlsm_requests_ops);
+	securityfs_create_file("capture", 0600, tlsm_fs_root, NULL, &tlsm_capture_ops);
+	securityfs_create_file("capture_status", 0400, tlsm_fs_root, NULL, &tlsm_capture_status_ops);
 	return 0;
 }
 
 fs_initcall(tlsm_interface_init);
 
+/**
+ * tlsm_request_same - whether a pending request asks the same thing as an access
+ */
+static bool tlsm_request_same(const struct fs_request *req, int uid, u64 policy_id, const struct access *a)
+{
+	const struct access *b = &req->access_request;
+
+	return req->uid == uid && req->policy_id == policy_id && b->op == a->op &&
+		   b->mode == a->mode && b->signal == a->signal && b->family == a->family &&
+		   b->protocol == a->protocol && b->port == a->port &&
+		   strcmp(b->subject ?: "", a->subject ?: "") == 0 && strcmp(b->object ?: "", a->object ?: "") == 0;
+}
+
+/**
+ * tlsm_request_admit - add a request to the pending ones, unless there are too many of them, of its
+ * user or of its program
+ * @joined: set to the pending request @req is the same as, when requests are coalesced
+ *
+ * Return: 0 if @req was added or joined another one, -EBUSY if a limit is reached
+ */
+static int tlsm_request_admit(struct fs_request *req, struct fs_request **joined)
+{
+	unsigned int max_total = READ_ONCE(max_pending);
+	unsigned int max_user = READ_ONCE(max_pending_per_uid);
+	unsigned int max_subject = READ_ONCE(max_pending_per_subject);
+	bool coalesce = READ_ONCE(pending_overflow) == TLSM_OVERFLOW_COALESCE;
+	unsigned int user = 0;
+	unsigned int subject = 0;
+	struct fs_request *pending;
+
+	spin_lock(&tlsm_pending_lock);
+	hash_for_each_possible(tlsm_pending, pending, pending_node, req->uid)
+	{
+		if (pending->uid != req->uid)
+			continue;
+		if (coalesce && tlsm_request_same(pending, req->uid, req->policy_id, &req->access_request))
+		{
+			refcount_inc(&pending->ref);
+			tlsm_pending_stats.waiters++;
+			tlsm_pending_stats.coalesced++;
+			spin_unlock(&tlsm_pending_lock);
+			*joined = pending;
+			return 0;
+		}
+		user++;
+		if (strcmp(pending->access_request.subject ?: "", req->access_request.subject ?: "") == 0)
+			subject++;
+	}
+
+	if (max_total && tlsm_pending_stats.depth >= max_total)
+	{
+		tlsm_pending_stats.rejected_total++;
+		spin_unlock(&tlsm_pending_lock);
+		return -EBUSY;
+	}
+	if (max_user && user >= max_user)
+	{
+		tlsm_pending_stats.rejected_user++;
+		spin_unlock(&tlsm_pending_lock);
+		return -EBUSY;
+	}
+	if (max_subject && subject >= max_subject)
+	{
+		tlsm_pending_stats.rejected_subject++;
+		spin_unlock(&tlsm_pending_lock);
+		return -EBUSY;
+	}
+
+	hash_add(tlsm_pending, &req->pending_node, req->uid);
+	tlsm_pending_stats.depth++;
+	tlsm_pending_stats.waiters++;
+	tlsm_pending_stats.admitted++;
+	spin_unlock(&tlsm_pending_lock);
+	*joined = NULL;
+	return 0;
+}
+
 /**
  * create_fs_request - create a new file associated with a access request
+ * @joined: set if the returned request is an identical pending one (see TLSM_OVERFLOW_COALESCE),
+ *          whose file already exists and whose answer is shared
  *
- * Returns the fs_request associated with the created file. Can return NULL
+ * The request stays pending, and counted in the limits of its user and program, until
+ * remove_fs_file(). Tasks that joined it release it with put_fs_request().
+ * Returns the fs_request associated with the created file. Can return an ERR_PTR, -EBUSY if
+ * the request was not admitted
  */
-struct fs_request *create_fs_request(int uid, struct access access_request, struct op_stat *stats, int request_number)
+struct fs_request *create_fs_request(int uid, struct access access_request, u64 policy_id, const struct op_stat *stats, int request_number, bool *joined)
 {
 	if (!tlsm_fs_root)
 	{
 		printk(KERN_ERR "[TLSM][FS][ERROR] attemped to create user request file but fs not initialized");
-		return NULL;
+		return ERR_PTR(-ENOENT);
 	}
 
+	// from a mempool, asks still reach tlsmd under memory pressure
 	struct fs_request *req;
-	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	req = tlsm_mem_alloc(TLSM_MEM_REQUEST);
 	if (!req)
-		return NULL;
-
-	printk(KERN_DEBUG "[TLSM][FS] creating request file for uid %d, request %d", uid, request_number);
+		return ERR_PTR(-ENOMEM);
 
 	req->number = request_number;
+	req->uid = uid;
+	req->policy_id = policy_id;
 	memcpy(&req->access_request, &access_request, sizeof(struct access));
-	req->stats = stats;
-	sema_init(&req->sem, 0); // init caller wake-up semaphore
+	memcpy(req->stats, stats, sizeof(req->stats));
+	init_completion(&req->answered); // init caller wake-up completion
+	refcount_set(&req->ref, 1);
+
+	struct fs_request *same;
+	int err = tlsm_request_admit(req, &same);
+	if (err || same)
+	{
+		tlsm_mem_free(TLSM_MEM_REQUEST, req);
+		if (err)
+		{
+			printk(KERN_DEBUG "[TLSM][FS] too many pending requests for uid %d, request %d not admitted", uid, request_number);
+			return ERR_PTR(err);
+		}
+		printk(KERN_DEBUG "[TLSM][FS] request %d of uid %d waits for the answer to request %llu", request_number, uid, same->number);
+		*joined = true;
+		return same;
+	}
+	*joined = false;
+
+	printk(KERN_DEBUG "[TLSM][FS] creating request file for uid %d, request %d", uid, request_number);
 
 	// convert numbers to string
 	char buf[16];
@@ -379,8 +987,9 @@ struct fs_request *create_fs_request(int uid, struct access access_request, stru
 			if (IS_ERR(user_fsdir))
 			{
 				printk(KERN_ERR "[TLSM][FS][ERROR] lookup failed");
-				kfree(req);
-				return NULL;
+				req->request_file = NULL;
+				remove_fs_file(req);
+				return ERR_CAST(user_fsdir);
 			}
 		}
 		else
@@ -408,8 +1017,6 @@ struct fs_request *create_fs_request(int uid, struct access access_request, stru
 	req->request_file->d_inode->i_gid = current_gid();
 	req->request_file->d_inode->i_uid = current_uid();
 
-	signal_watchdog(uid, request_number);
-
 	if (lookedup)
 		dput(user_fsdir);
 
@@ -418,14 +1025,48 @@ struct fs_request *create_fs_request(int uid, struct access access_request, stru
 fs_request_fail:
 	if (lookedup)
 		dput(user_fsdir);
-	kfree(req);
-	return NULL;
+	req->request_file = NULL;
+	remove_fs_file(req);
+	return ERR_PTR(-ENOENT);
 }
 
+/**
+ * put_fs_request - release a request joined by create_fs_request()
+ */
+void put_fs_request(struct fs_request *req)
+{
+	spin_lock(&tlsm_pending_lock);
+	tlsm_pending_stats.waiters--;
+	spin_unlock(&tlsm_pending_lock);
+
+	tlsm_request_put(req);
+}
+
+/**
+ * remove_fs_file - end a request, answered or not, and release it
+ *
+ * Called by the task that created the request, before it frees the subject and object. Tasks
+ * still waiting for the same answer are woken up, with it if there was one. Request files
+ * still open keep the request until they are closed, without reading or answering it.
+ */
 void remove_fs_file(struct fs_request *req)
 {
-	printk(KERN_DEBUG "[TLSM][FS] removing file %s", req->request_file->d_iname);
-	securityfs_remove(req->request_file);
-	kfree(req->answer);
-	kfree(req);
+	spin_lock(&tlsm_pending_lock);
+	hash_del(&req->pending_node);
+	tlsm_pending_stats.depth--;
+	if (!req->answer)
+		tlsm_pending_stats.unanswered++;
+	req->removed = true;
+	// request files opened from now on find no request
+	if (req->request_file)
+		d_inode(req->request_file)->i_private = NULL;
+	spin_unlock(&tlsm_pending_lock);
+	complete_all(&req->answered);
+
+	if (req->request_file)
+	{
+		printk(KERN_DEBUG "[TLSM][FS] removing file %s", req->request_file->d_iname);
+		securityfs_remove(req->request_file);
+	}
+	put_fs_request(req);
 }
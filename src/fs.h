@@ -1,7 +1,9 @@
 #ifndef TLSM_FS_H
 #define TLSM_FS_H
 
-#include <linux/semaphore.h>
+#include <linux/completion.h>
+#include <linux/refcount.h>
+#include <linux/seq_file.h>
 
 #include "access.h"
 #include "common.h"
@@ -10,6 +12,11 @@
 #define TLSM_REQ_ALLOW 0
 #define TLSM_REQ_DENY 1
 
+// what happens to an ask or analyze request past the max_pending_* limits
+#define TLSM_OVERFLOW_DEFAULT 0  // the policy's default verdict
+#define TLSM_OVERFLOW_FAIL 1     // -EAGAIN, the caller can retry
+#define TLSM_OVERFLOW_COALESCE 2 // default verdict, and identical requests always share one answer
+
 struct fs_answer
 {
     int allow;
@@ -19,15 +26,23 @@ struct fs_answer
 struct fs_request
 {
     unsigned long long number;
-    struct access access_request;
-    struct semaphore sem;
-    struct fs_answer *answer;
+    struct access access_request; // subject and object belong to the requester
+    struct completion answered;   // by tlsmd, or when the requester gives up
+    struct fs_answer *answer;     // set once, under tlsm_pending_lock
     struct dentry *request_file;
-    struct op_stat *stats;
+    struct op_stat stats[TLSM_OPS_LEN]; // requester's stats when the request was made
+
+    int uid;
+    u64 policy_id;
+    refcount_t ref; // requester, the tasks waiting for the same answer and open request files
+    bool removed;   // by remove_fs_file(), under tlsm_pending_lock: no longer read or answered
+    struct hlist_node pending_node;
 };
 
 struct fs_request *
-create_fs_request(int uid, struct access access_request, struct op_stat *stats, int request_number);
+create_fs_request(int uid, struct access access_request, u64 policy_id, const struct op_stat *stats, int request_number, bool *joined);
 void remove_fs_file(struct fs_request *req);
+void put_fs_request(struct fs_request *req);
+void tlsm_show_options(struct seq_file *m, struct policy *p);
 
 #endif // TLSM_FS_H
\ No newline at end of file
@@ -0,0 +1,857 @@
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/stringhash.h>
+
+#define tlsm_glob_alloc(size) kvzalloc(size, GFP_KERNEL)
+#define tlsm_glob_free(p) kvfree(p)
+#define tlsm_glob_sort(base, num, size, cmp) sort(base, num, size, cmp, NULL)
+#else
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define tlsm_glob_alloc(size) calloc(1, size)
+#define tlsm_glob_free(p) free(p)
+#define tlsm_glob_sort(base, num, size, cmp) qsort(base, num, size, cmp)
+#endif
+
+#include "glob.h"
+
+#define TLSM_BITS_PER_LONG (8 * sizeof(unsigned long))
+#define TLSM_BITS_TO_LONGS(n) (((n) + TLSM_BITS_PER_LONG - 1) / TLSM_BITS_PER_LONG)
+
+static inline void tlsm_bit_set(unsigned long *map, u32 n)
+{
+    map[n / TLSM_BITS_PER_LONG] |= 1UL << (n % TLSM_BITS_PER_LONG);
+}
+
+static inline bool tlsm_bit_test(const unsigned long *map, u32 n)
+{
+    return map[n / TLSM_BITS_PER_LONG] & (1UL << (n % TLSM_BITS_PER_LONG));
+}
+
+/* Pattern elements */
+/* a pattern is read one element at a time, an element starts at an offset of the pattern and
+ * the end of the pattern is an element of its own. Offsets are the states of the pattern NFA. */
+
+enum tlsm_glob_el
+{
+    TLSM_EL_END,
+    TLSM_EL_CHAR, // literal, '?' or class
+    TLSM_EL_STAR,
+    TLSM_EL_DSTAR,
+};
+
+/**
+ * tlsm_glob_class_end - offset of the ']' closing the class opened at off
+ *
+ * Return: the offset, or len if the class is not closed ('[' is then a literal)
+ */
+static u32 tlsm_glob_class_end(const char *pat, u32 len, u32 off)
+{
+    u32 i = off + 1;
+
+    if (i < len && (pat[i] == '!' || pat[i] == '^'))
+        i++;
+    if (i < len && pat[i] == ']') // first ']' is part of the class
+        i++;
+    while (i < len && pat[i] != ']')
+    {
+        if (pat[i] == '\\')
+            i++;
+        i++;
+    }
+    return i < len ? i : len;
+}
+
+/**
+ * tlsm_glob_el - type of the element at off
+ *
+ * Return: the type, *next is set to the offset of the following element
+ */
+static enum tlsm_glob_el tlsm_glob_el(const char *pat, u32 len, u32 off, u32 *next)
+{
+    if (off >= len)
+    {
+        *next = len;
+        return TLSM_EL_END;
+    }
+
+    switch (pat[off])
+    {
+    case '*':
+        if (off + 1 < len && pat[off + 1] == '*')
+        {
+            *next = off + 2;
+            return TLSM_EL_DSTAR;
+        }
+        *next = off + 1;
+        return TLSM_EL_STAR;
+    case '[':
+    {
+        u32 end = tlsm_glob_class_end(pat, len, off);
+        *next = end < len ? end + 1 : off + 1;
+        return TLSM_EL_CHAR;
+    }
+    case '\\':
+        *next = off + 1 < len ? off + 2 : off + 1;
+        return TLSM_EL_CHAR;
+    default:
+        *next = off + 1;
+        return TLSM_EL_CHAR;
+    }
+}
+
+/**
+ * tlsm_glob_class_next - read one character of a class, resolving escapes
+ */
+static unsigned char tlsm_glob_class_next(const char *pat, u32 end, u32 *i)
+{
+    if (pat[*i] == '\\' && *i + 1 < end)
+        (*i)++;
+    return (unsigned char)pat[(*i)++];
+}
+
+/**
+ * tlsm_glob_has - checks if the TLSM_EL_CHAR element at off matches c
+ */
+static bool tlsm_glob_has(const char *pat, u32 len, u32 off, unsigned char c)
+{
+    switch (pat[off])
+    {
+    case '?':
+        return c != '/';
+    case '\\':
+        return off + 1 < len ? (unsigned char)pat[off + 1] == c : c == '\\';
+    case '[':
+    {
+        u32 end = tlsm_glob_class_end(pat, len, off);
+        if (end >= len)
+            return c == '[';
+
+        u32 i = off + 1;
+        bool negated = pat[i] == '!' || pat[i] == '^';
+        bool found = false;
+        if (negated)
+            i++;
+
+        bool first = true;
+        while (i < end && (first || pat[i] != ']'))
+        {
+            unsigned char lo = tlsm_glob_class_next(pat, end, &i);
+            unsigned char hi = lo;
+            if (i + 1 < end && pat[i] == '-')
+            {
+                i++;
+                hi = tlsm_glob_class_next(pat, end, &i);
+            }
+            if (c >= lo && c <= hi)
+                found = true;
+            first = false;
+        }
+        return negated ? !found && c != '/' : found;
+    }
+    default:
+        return (unsigned char)pat[off] == c;
+    }
+}
+
+/**
+ * tlsm_glob_is_pattern - checks if a string uses any of the glob special characters
+ */
+bool tlsm_glob_is_pattern(const char *str, u32 len)
+{
+    for (u32 i = 0; i < len; i++)
+    {
+        if (str[i] == '*' || str[i] == '?' || str[i] == '[' || str[i] == '\\')
+            return true;
+    }
+    return false;
+}
+
+/**
+ * tlsm_glob_valid - checks the syntax of a pattern
+ *
+ * Return: false if the pattern is too long or has a reversed class range
+ */
+bool tlsm_glob_valid(const char *pat, u32 len)
+{
+    if (len > TLSM_GLOB_MAX_LEN)
+        return false;
+
+    for (u32 off = 0; off < len;)
+    {
+        u32 next;
+        tlsm_glob_el(pat, len, off, &next);
+
+        if (pat[off] == '[' && next > off + 1)
+        {
+            u32 end = next - 1;
+            u32 i = off + 1;
+            bool first = true;
+            if (pat[i] == '!' || pat[i] == '^')
+                i++;
+            while (i < end && (first || pat[i] != ']'))
+            {
+                unsigned char lo = tlsm_glob_class_next(pat, end, &i);
+                if (i + 1 < end && pat[i] == '-')
+                {
+                    i++;
+                    if (tlsm_glob_class_next(pat, end, &i) < lo)
+                        return false;
+                }
+                first = false;
+            }
+        }
+        off = next;
+    }
+    return true;
+}
+
+/**
+ * tlsm_glob_init - describe a pattern, moving its leading and trailing "**" to flags
+ */
+void tlsm_glob_init(struct tlsm_glob *g, const char *str, u32 len, u8 flags, u32 id)
+{
+    // a trailing "**" that is not escaped
+    if (len >= 2 && str[len - 1] == '*' && str[len - 2] == '*')
+    {
+        u32 escapes = 0;
+        while (escapes < len - 2 && str[len - 3 - escapes] == '\\')
+            escapes++;
+        if (escapes % 2 == 0)
+        {
+            len -= 2;
+            flags |= TLSM_GLOB_PREFIX;
+        }
+    }
+    if (len >= 2 && str[0] == '*' && str[1] == '*')
+    {
+        str += 2;
+        len -= 2;
+        flags &= ~TLSM_GLOB_ANCHORED;
+    }
+    // only stars left: the pattern matches every string
+    u32 stars = 0;
+    while (stars < len && str[stars] == '*')
+        stars++;
+    if (stars == len && (!(flags & TLSM_GLOB_ANCHORED) || (flags & TLSM_GLOB_PREFIX)))
+    {
+        len = 0;
+        flags |= TLSM_GLOB_ANCHORED | TLSM_GLOB_PREFIX;
+    }
+    if (!len)
+        flags |= TLSM_GLOB_ANCHORED;
+
+    g->pat = str;
+    g->len = len;
+    g->flags = flags;
+    g->id = id;
+}
+
+/* Single pattern matching */
+
+static void tlsm_glob_closure(const struct tlsm_glob *g, unsigned long *set, u32 off)
+{
+    for (;;)
+    {
+        u32 next;
+        tlsm_bit_set(set, off);
+        enum tlsm_glob_el el = tlsm_glob_el(g->pat, g->len, off, &next);
+        if (el != TLSM_EL_STAR && el != TLSM_EL_DSTAR)
+            return;
+        off = next;
+    }
+}
+
+/**
+ * tlsm_glob_match - match one pattern, without a DFA
+ *
+ * Linear in the string length times the pattern length, for patterns that are not compiled.
+ */
+bool tlsm_glob_match(const struct tlsm_glob *g, const char *str)
+{
+    unsigned long cur[TLSM_BITS_TO_LONGS(TLSM_GLOB_MAX_LEN + 1)] = {0};
+    unsigned long next[TLSM_BITS_TO_LONGS(TLSM_GLOB_MAX_LEN + 1)];
+
+    if (g->len > TLSM_GLOB_MAX_LEN)
+        return false;
+
+    tlsm_glob_closure(g, cur, 0);
+    for (;; str++)
+    {
+        if (tlsm_bit_test(cur, g->len))
+        {
+            if ((g->flags & TLSM_GLOB_PREFIX) || !*str)
+                return true;
+        }
+        if (!*str)
+            return false;
+
+        bool alive = false;
+        memset(next, 0, sizeof(next));
+        for (u32 off = 0; off < g->len; off++)
+        {
+            u32 after;
+            if (!tlsm_bit_test(cur, off))
+                continue;
+
+            switch (tlsm_glob_el(g->pat, g->len, off, &after))
+            {
+            case TLSM_EL_CHAR:
+                if (tlsm_glob_has(g->pat, g->len, off, *str))
+                    tlsm_glob_closure(g, next, after);
+                break;
+            case TLSM_EL_STAR:
+                if (*str != '/')
+                    tlsm_glob_closure(g, next, off);
+                break;
+            case TLSM_EL_DSTAR:
+                tlsm_glob_closure(g, next, off);
+                break;
+            default:
+                break;
+            }
+        }
+        if (!(g->flags & TLSM_GLOB_ANCHORED))
+            tlsm_glob_closure(g, next, 0);
+
+        for (u32 i = 0; i < TLSM_BITS_TO_LONGS(TLSM_GLOB_MAX_LEN + 1); i++)
+        {
+            cur[i] = next[i];
+            alive |= next[i] != 0;
+        }
+        if (!alive)
+            return false;
+    }
+}
+
+/* DFA construction */
+/* subset construction over the positions of every pattern. Positions reached from the start of
+ * an unanchored pattern are in every state, they are kept out of the state lists ("implicit") and
+ * their moves are computed once per byte class. */
+
+struct tlsm_dfa_builder
+{
+    const struct tlsm_glob *globs;
+    u32 nglobs;
+    u32 npos;
+    u32 *base;      // first position of each glob
+    u32 *pos_glob;  // glob of each position
+    u8 *implicit;   // positions in every state
+    u32 *stamp;     // generation a position was last added in
+    u32 gen;
+
+    u8 classes[256];
+    u32 nclasses;
+    unsigned char rep[256]; // a byte of each class
+
+    u32 *tmp; // positions being collected
+    u32 ntmp;
+
+    // states, their sorted position lists are stored one after the other in pool
+    u32 nstates;
+    u32 max_states;
+    u32 *state_off;
+    u32 *state_len;
+    u32 *state_hash;
+    u32 *pool;
+    u32 pool_len;
+    u32 pool_cap;
+    u32 *table; // open addressing, state index + 1
+    u32 table_size;
+
+    u16 *next;
+    u32 *umove_off; // per class, moves of the implicit positions (in umove)
+    u32 *umove_len;
+    u32 *umove;
+};
+
+static bool tlsm_dfa_grow(u32 **array, u32 *cap, u32 needed)
+{
+    if (needed <= *cap)
+        return true;
+
+    u32 new_cap = *cap ? *cap : 64;
+    while (new_cap < needed)
+        new_cap *= 2;
+
+    u32 *new_array = tlsm_glob_alloc(new_cap * sizeof(u32));
+    if (!new_array)
+        return false;
+    if (*array)
+        memcpy(new_array, *array, *cap * sizeof(u32));
+    tlsm_glob_free(*array);
+    *array = new_array;
+    *cap = new_cap;
+    return true;
+}
+
+static u32 tlsm_dfa_hash(const u32 *list, u32 len)
+{
+    u32 h = 2166136261u;
+    for (u32 i = 0; i < len; i++)
+        h = (h ^ list[i]) * 16777619u;
+    return h;
+}
+
+static int tlsm_dfa_cmp_u32(const void *a, const void *b)
+{
+    u32 x = *(const u32 *)a;
+    u32 y = *(const u32 *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void tlsm_dfa_add(struct tlsm_dfa_builder *b, u32 pos)
+{
+    for (;;)
+    {
+        if (b->stamp[pos] == b->gen)
+            return;
+        b->stamp[pos] = b->gen;
+        if (!b->implicit[pos])
+            b->tmp[b->ntmp++] = pos;
+
+        const struct tlsm_glob *g = &b->globs[b->pos_glob[pos]];
+        u32 off = pos - b->base[b->pos_glob[pos]];
+        u32 next;
+        enum tlsm_glob_el el = tlsm_glob_el(g->pat, g->len, off, &next);
+        if (el != TLSM_EL_STAR && el != TLSM_EL_DSTAR)
+            return;
+        pos = b->base[b->pos_glob[pos]] + next;
+    }
+}
+
+static void tlsm_dfa_move(struct tlsm_dfa_builder *b, const u32 *list, u32 len, unsigned char c)
+{
+    for (u32 i = 0; i < len; i++)
+    {
+        u32 pos = list[i];
+        u32 glob = b->pos_glob[pos];
+        const struct tlsm_glob *g = &b->globs[glob];
+        u32 off = pos - b->base[glob];
+        u32 next;
+
+        switch (tlsm_glob_el(g->pat, g->len, off, &next))
+        {
+        case TLSM_EL_CHAR:
+            if (tlsm_glob_has(g->pat, g->len, off, c))
+                tlsm_dfa_add(b, b->base[glob] + next);
+            break;
+        case TLSM_EL_STAR:
+            if (c != '/')
+                tlsm_dfa_add(b, pos);
+            break;
+        case TLSM_EL_DSTAR:
+            tlsm_dfa_add(b, pos);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/**
+ * tlsm_dfa_state - find or add the state of the positions collected in b->tmp
+ *
+ * Return: the state index, -E2BIG if there are too many states, -ENOMEM
+ */
+static int tlsm_dfa_state(struct tlsm_dfa_builder *b)
+{
+    tlsm_glob_sort(b->tmp, b->ntmp, sizeof(u32), tlsm_dfa_cmp_u32);
+    u32 hash = tlsm_dfa_hash(b->tmp, b->ntmp);
+
+    u32 slot = hash % b->table_size;
+    while (b->table[slot])
+    {
+        u32 s = b->table[slot] - 1;
+        if (b->state_hash[s] == hash && b->state_len[s] == b->ntmp && memcmp(b->pool + b->state_off[s], b->tmp, b->ntmp * sizeof(u32)) == 0)
+            return s;
+        slot = (slot + 1) % b->table_size;
+    }
+
+    if (b->nstates >= b->max_states)
+        return -E2BIG;
+    if (!tlsm_dfa_grow(&b->pool, &b->pool_cap, b->pool_len + b->ntmp))
+        return -ENOMEM;
+
+    u32 s = b->nstates++;
+    memcpy(b->pool + b->pool_len, b->tmp, b->ntmp * sizeof(u32));
+    b->state_off[s] = b->pool_len;
+    b->state_len[s] = b->ntmp;
+    b->state_hash[s] = hash;
+    b->pool_len += b->ntmp;
+    b->table[slot] = s + 1;
+    return s;
+}
+
+/**
+ * tlsm_dfa_classes - split the bytes in classes no pattern element tells apart
+ */
+static void tlsm_dfa_classes(struct tlsm_dfa_builder *b)
+{
+    u16 map[256][2];
+
+    memset(b->classes, 0, sizeof(b->classes));
+    b->nclasses = 1;
+
+    // '/' is special for '*' and '?', NUL never appears in strings
+    for (int step = -1; step < (int)b->nglobs; step++)
+    {
+        const struct tlsm_glob *g = step >= 0 ? &b->globs[step] : NULL;
+        u32 off = 0;
+
+        while (step < 0 || off < g->len)
+        {
+            u32 next = 0;
+            if (g && tlsm_glob_el(g->pat, g->len, off, &next) != TLSM_EL_CHAR)
+            {
+                off = next;
+                continue;
+            }
+
+            u32 n = 0;
+            memset(map, 0xff, sizeof(map));
+            for (int c = 0; c < 256; c++)
+            {
+                bool in = g ? tlsm_glob_has(g->pat, g->len, off, c) : c == '/';
+                u8 old = b->classes[c];
+                if (map[old][in] == 0xffff)
+                    map[old][in] = n++;
+                b->classes[c] = map[old][in];
+            }
+            b->nclasses = n;
+
+            if (!g)
+                break;
+            off = next;
+        }
+    }
+
+    for (int c = 255; c >= 0; c--)
+        b->rep[b->classes[c]] = c;
+}
+
+static void tlsm_dfa_builder_free(struct tlsm_dfa_builder *b)
+{
+    tlsm_glob_free(b->base);
+    tlsm_glob_free(b->pos_glob);
+    tlsm_glob_free(b->implicit);
+    tlsm_glob_free(b->stamp);
+    tlsm_glob_free(b->tmp);
+    tlsm_glob_free(b->state_off);
+    tlsm_glob_free(b->state_len);
+    tlsm_glob_free(b->state_hash);
+    tlsm_glob_free(b->pool);
+    tlsm_glob_free(b->table);
+    tlsm_glob_free(b->next);
+    tlsm_glob_free(b->umove_off);
+    tlsm_glob_free(b->umove_len);
+    tlsm_glob_free(b->umove);
+}
+
+static int tlsm_dfa_builder_init(struct tlsm_dfa_builder *b, const struct tlsm_glob *globs, u32 nglobs, u32 max_states)
+{
+    b->globs = globs;
+    b->nglobs = nglobs;
+    b->max_states = max_states;
+    b->table_size = 2 * max_states + 1;
+
+    b->base = tlsm_glob_alloc((nglobs + 1) * sizeof(u32));
+    if (!b->base)
+        return -ENOMEM;
+    for (u32 i = 0; i < nglobs; i++)
+    {
+        b->base[i] = b->npos;
+        b->npos += globs[i].len + 1;
+    }
+
+    b->pos_glob = tlsm_glob_alloc((b->npos + 1) * sizeof(u32));
+    b->implicit = tlsm_glob_alloc(b->npos + 1);
+    b->stamp = tlsm_glob_alloc((b->npos + 1) * sizeof(u32));
+    b->tmp = tlsm_glob_alloc((b->npos + 1) * sizeof(u32));
+    b->state_off = tlsm_glob_alloc(max_states * sizeof(u32));
+    b->state_len = tlsm_glob_alloc(max_states * sizeof(u32));
+    b->state_hash = tlsm_glob_alloc(max_states * sizeof(u32));
+    b->table = tlsm_glob_alloc(b->table_size * sizeof(u32));
+    b->umove_off = tlsm_glob_alloc(256 * sizeof(u32));
+    b->umove_len = tlsm_glob_alloc(256 * sizeof(u32));
+    if (!b->pos_glob || !b->implicit || !b->stamp || !b->tmp || !b->state_off || !b->state_len || !b->state_hash || !b->table || !b->umove_off || !b->umove_len)
+        return -ENOMEM;
+    if (!tlsm_dfa_grow(&b->pool, &b->pool_cap, 1))
+        return -ENOMEM;
+
+    for (u32 i = 0; i < nglobs; i++)
+    {
+        for (u32 pos = b->base[i]; pos <= b->base[i] + globs[i].len; pos++)
+            b->pos_glob[pos] = i;
+    }
+
+    tlsm_dfa_classes(b);
+
+    b->next = tlsm_glob_alloc((size_t)max_states * b->nclasses * sizeof(u16));
+    if (!b->next)
+        return -ENOMEM;
+    return 0;
+}
+
+/**
+ * tlsm_dfa_implicit - find the positions in every state, and their moves on each class
+ */
+static int tlsm_dfa_implicit(struct tlsm_dfa_builder *b)
+{
+    u32 *starts = b->tmp;
+    u32 nstarts;
+    u32 umove_cap = 0;
+    u32 umove_len = 0;
+
+    if (!tlsm_dfa_grow(&b->umove, &umove_cap, 1))
+        return -ENOMEM;
+
+    b->gen++;
+    b->ntmp = 0;
+    for (u32 i = 0; i < b->nglobs; i++)
+    {
+        if (!(b->globs[i].flags & TLSM_GLOB_ANCHORED))
+            tlsm_dfa_add(b, b->base[i]);
+    }
+    nstarts = b->ntmp;
+    for (u32 i = 0; i < nstarts; i++)
+    {
+        // unanchored patterns that match the empty string are anchored by tlsm_glob_init()
+        if (starts[i] - b->base[b->pos_glob[starts[i]]] == b->globs[b->pos_glob[starts[i]]].len)
+            return -EINVAL;
+        b->implicit[starts[i]] = 1;
+    }
+
+    u32 *list = tlsm_glob_alloc((nstarts + 1) * sizeof(u32));
+    if (!list)
+        return -ENOMEM;
+    memcpy(list, starts, nstarts * sizeof(u32));
+
+    for (u32 k = 0; k < b->nclasses; k++)
+    {
+        b->gen++;
+        b->ntmp = 0;
+        tlsm_dfa_move(b, list, nstarts, b->rep[k]);
+        if (!tlsm_dfa_grow(&b->umove, &umove_cap, umove_len + b->ntmp))
+        {
+            tlsm_glob_free(list);
+            return -ENOMEM;
+        }
+        memcpy(b->umove + umove_len, b->tmp, b->ntmp * sizeof(u32));
+        b->umove_off[k] = umove_len;
+        b->umove_len[k] = b->ntmp;
+        umove_len += b->ntmp;
+    }
+
+    // moves of implicit positions can be implicit positions, other states only see the rest
+    tlsm_glob_free(list);
+    return 0;
+}
+
+/**
+ * tlsm_dfa_accepts - build the accepting sets of every state
+ *
+ * Return: the DFA, with its transitions copied from the builder
+ */
+static size_t tlsm_dfa_alloc_size(u32 nstates, u32 nclasses, u32 nwords)
+{
+    u32 max_sets = 2 * nstates + 1;
+    return sizeof(struct tlsm_dfa) + (size_t)nstates * nclasses * sizeof(u16) + 2 * nstates * sizeof(u32) + (size_t)max_sets * nwords * sizeof(unsigned long) + sizeof(unsigned long);
+}
+
+static struct tlsm_dfa *tlsm_dfa_finish(struct tlsm_dfa_builder *b, u32 nids, bool unanchored, int *err)
+{
+    u32 nwords = TLSM_BITS_TO_LONGS(nids ? nids : 1);
+    u32 max_sets = 2 * b->nstates + 1;
+    struct tlsm_dfa *dfa = tlsm_glob_alloc(tlsm_dfa_alloc_size(b->nstates, b->nclasses, nwords));
+    unsigned long *set = tlsm_glob_alloc(nwords * sizeof(unsigned long));
+
+    if (!dfa || !set)
+    {
+        tlsm_glob_free(dfa);
+        tlsm_glob_free(set);
+        *err = -ENOMEM;
+        return NULL;
+    }
+
+    dfa->nstates = b->nstates;
+    dfa->nclasses = b->nclasses;
+    dfa->nwords = nwords;
+    dfa->unanchored = unanchored;
+    memcpy(dfa->classes, b->classes, sizeof(dfa->classes));
+    dfa->sets = (unsigned long *)(((unsigned long)(dfa + 1) + sizeof(unsigned long) - 1) & ~(sizeof(unsigned long) - 1));
+    dfa->accept_prefix = (u32 *)(dfa->sets + (size_t)max_sets * nwords);
+    dfa->accept_end = dfa->accept_prefix + b->nstates;
+    dfa->next = (u16 *)(dfa->accept_end + b->nstates);
+    memcpy(dfa->next, b->next, (size_t)b->nstates * b->nclasses * sizeof(u16));
+
+    dfa->nsets = 1; // the empty set
+    for (u32 s = 0; s < b->nstates; s++)
+    {
+        for (int prefix = 0; prefix < 2; prefix++)
+        {
+            bool empty = true;
+            memset(set, 0, nwords * sizeof(unsigned long));
+            for (u32 i = 0; i < b->state_len[s]; i++)
+            {
+                u32 pos = b->pool[b->state_off[s] + i];
+                const struct tlsm_glob *g = &b->globs[b->pos_glob[pos]];
+                if (pos - b->base[b->pos_glob[pos]] == g->len && !!(g->flags & TLSM_GLOB_PREFIX) == prefix)
+                {
+                    tlsm_bit_set(set, g->id);
+                    empty = false;
+                }
+            }
+
+            u32 id = 0;
+            if (!empty)
+            {
+                for (id = 1; id < dfa->nsets; id++)
+                {
+                    if (memcmp(dfa->sets + (size_t)id * nwords, set, nwords * sizeof(unsigned long)) == 0)
+                        break;
+                }
+                if (id == dfa->nsets)
+                    memcpy(dfa->sets + (size_t)dfa->nsets++ * nwords, set, nwords * sizeof(unsigned long));
+            }
+            if (prefix)
+                dfa->accept_prefix[s] = id;
+            else
+                dfa->accept_end[s] = id;
+        }
+    }
+
+    tlsm_glob_free(set);
+    return dfa;
+}
+
+/**
+ * tlsm_dfa_build - compile patterns into one DFA
+ *
+ * @nids: ids of the patterns are below nids, several patterns may share an id
+ * @max_states: the build fails with -E2BIG beyond this number of states
+ * Return: the DFA, NULL on failure with *err set
+ */
+struct tlsm_dfa *tlsm_dfa_build(const struct tlsm_glob *globs, u32 nglobs, u32 nids, u32 max_states, int *err)
+{
+    struct tlsm_dfa_builder b = {0};
+    struct tlsm_dfa *dfa = NULL;
+    bool unanchored = false;
+    int ret;
+
+    if (max_states > 65535 || max_states < 2)
+        max_states = 65535;
+
+    ret = tlsm_dfa_builder_init(&b, globs, nglobs, max_states);
+    if (ret)
+        goto build_out;
+    ret = tlsm_dfa_implicit(&b);
+    if (ret)
+        goto build_out;
+    for (u32 i = 0; i < nglobs; i++)
+        unanchored |= !(globs[i].flags & TLSM_GLOB_ANCHORED);
+
+    // state 0 has no explicit position, it is dead unless some pattern is unanchored
+    b.gen++;
+    b.ntmp = 0;
+    ret = tlsm_dfa_state(&b);
+    if (ret < 0)
+        goto build_out;
+
+    // state 1 is the start state, even if it has the same positions as state 0
+    b.gen++;
+    b.ntmp = 0;
+    for (u32 i = 0; i < nglobs; i++)
+    {
+        if (globs[i].flags & TLSM_GLOB_ANCHORED)
+            tlsm_dfa_add(&b, b.base[i]);
+    }
+    tlsm_glob_sort(b.tmp, b.ntmp, sizeof(u32), tlsm_dfa_cmp_u32);
+    b.state_off[1] = b.pool_len;
+    b.state_len[1] = b.ntmp;
+    b.state_hash[1] = 0;
+    if (!tlsm_dfa_grow(&b.pool, &b.pool_cap, b.pool_len + b.ntmp))
+    {
+        ret = -ENOMEM;
+        goto build_out;
+    }
+    memcpy(b.pool + b.pool_len, b.tmp, b.ntmp * sizeof(u32));
+    b.pool_len += b.ntmp;
+    b.nstates = 2;
+
+    for (u32 s = 0; s < b.nstates; s++)
+    {
+        for (u32 k = 0; k < b.nclasses; k++)
+        {
+            b.gen++;
+            b.ntmp = 0;
+            tlsm_dfa_move(&b, b.pool + b.state_off[s], b.state_len[s], b.rep[k]);
+            for (u32 i = 0; i < b.umove_len[k]; i++)
+                tlsm_dfa_add(&b, b.umove[b.umove_off[k] + i]);
+
+            ret = tlsm_dfa_state(&b);
+            if (ret < 0)
+                goto build_out;
+            b.next[s * b.nclasses + k] = ret;
+        }
+    }
+
+    ret = 0;
+    dfa = tlsm_dfa_finish(&b, nids, unanchored, &ret);
+
+build_out:
+    tlsm_dfa_builder_free(&b);
+    if (ret)
+        *err = ret;
+    return ret ? NULL : dfa;
+}
+
+static inline void tlsm_dfa_or(const struct tlsm_dfa *dfa, unsigned long *matched, u32 set)
+{
+    const unsigned long *bits = dfa->sets + (size_t)set * dfa->nwords;
+    for (u32 i = 0; i < dfa->nwords; i++)
+        matched[i] |= bits[i];
+}
+
+/**
+ * tlsm_dfa_run - match every pattern of a DFA against a string in one pass
+ *
+ * @matched: set, with one bit per pattern id, the ids of matching patterns are added to it
+ */
+void tlsm_dfa_run(const struct tlsm_dfa *dfa, const char *str, unsigned long *matched)
+{
+    u32 state = TLSM_DFA_START;
+
+    if (dfa->accept_prefix[state])
+        tlsm_dfa_or(dfa, matched, dfa->accept_prefix[state]);
+
+    for (; *str; str++)
+    {
+        state = dfa->next[state * dfa->nclasses + dfa->classes[(unsigned char)*str]];
+        if (state == TLSM_DFA_DEAD && !dfa->unanchored)
+            return;
+        if (dfa->accept_prefix[state])
+            tlsm_dfa_or(dfa, matched, dfa->accept_prefix[state]);
+    }
+
+    if (dfa->accept_end[state])
+        tlsm_dfa_or(dfa, matched, dfa->accept_end[state]);
+}
+
+/**
+ * tlsm_dfa_size - bytes allocated for a DFA, 0 for NULL
+ */
+size_t tlsm_dfa_size(const struct tlsm_dfa *dfa)
+{
+    return dfa ? tlsm_dfa_alloc_size(dfa->nstates, dfa->nclasses, dfa->nwords) : 0;
+}
+
+void tlsm_dfa_free(struct tlsm_dfa *dfa)
+{
+    tlsm_glob_free(dfa);
+}
@@ -0,0 +1,67 @@
+#ifndef _TLSM_GLOB_H
+#define _TLSM_GLOB_H
+
+/* glob patterns and the DFA evaluating many of them in one pass.
+ * This file and glob.c do not depend on the rest of TLSM, they also build in userspace. */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+#endif
+
+/*
+ * Syntax:
+ *   ?       any character but '/'
+ *   *       any sequence of characters without '/'
+ *   **      any sequence of characters
+ *   [a-z_]  one character of the class, [!...] or [^...] for the characters not in it ('/' never)
+ *   \c      c itself
+ */
+
+#define TLSM_GLOB_MAX_LEN 255 // longer patterns are rejected
+
+#define TLSM_GLOB_ANCHORED 0x1 // the pattern must match from the start of the string
+#define TLSM_GLOB_PREFIX 0x2   // the pattern may be followed by anything (trailing "**")
+
+#define TLSM_DFA_DEAD 0  // state without any way to accept more patterns
+#define TLSM_DFA_START 1
+
+struct tlsm_glob
+{
+    const char *pat; // not NUL terminated
+    u32 len;
+    u8 flags;        // TLSM_GLOB_*
+    u32 id;          // reported when the pattern matches, below the nids given to tlsm_dfa_build()
+};
+
+struct tlsm_dfa
+{
+    u32 nstates;
+    u32 nclasses;
+    u32 nsets;  // distinct accepting sets, set 0 is the empty one
+    u32 nwords; // unsigned longs per set
+    bool unanchored; // some pattern can start anywhere, TLSM_DFA_DEAD is not final
+    u8 classes[256];
+    u16 *next;            // nstates * nclasses transitions
+    u32 *accept_prefix;   // per state, set of TLSM_GLOB_PREFIX patterns matched when entering it
+    u32 *accept_end;      // per state, set of patterns matched if the string ends there
+    unsigned long *sets;  // nsets * nwords
+};
+
+bool tlsm_glob_is_pattern(const char *str, u32 len);
+void tlsm_glob_init(struct tlsm_glob *g, const char *str, u32 len, u8 flags, u32 id);
+bool tlsm_glob_valid(const char *pat, u32 len);
+bool tlsm_glob_match(const struct tlsm_glob *g, const char *str);
+
+struct tlsm_dfa *tlsm_dfa_build(const struct tlsm_glob *globs, u32 nglobs, u32 nids, u32 max_states, int *err);
+void tlsm_dfa_run(const struct tlsm_dfa *dfa, const char *str, unsigned long *matched);
+size_t tlsm_dfa_size(const struct tlsm_dfa *dfa);
+void tlsm_dfa_free(struct tlsm_dfa *dfa);
+
+#endif // _TLSM_GLOB_H
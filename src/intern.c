@@ -0,0 +1,143 @@
+#include <linux/hashtable.h>
+#include <linux/spinlock.h>
+#include <linux/stringhash.h>
+#include <linux/slab.h>
+
+#include "intern.h"
+#include "mem.h"
+
+#define TLSM_STRTAB_BITS 10
+
+/* every distinct policy string is stored once, identical strings share the same tlsm_str */
+static DEFINE_HASHTABLE(tlsm_strtab, TLSM_STRTAB_BITS);
+static DEFINE_SPINLOCK(tlsm_strtab_lock);
+static u64 tlsm_str_serial = 0; // protected by tlsm_strtab_lock
+
+u32 tlsm_str_hash(const char *str, u32 len)
+{
+    return full_name_hash(NULL, str, len);
+}
+
+static struct tlsm_str *__tlsm_str_find(const char *str, u32 len, u32 hash)
+{
+    struct tlsm_str *s;
+    hash_for_each_possible(tlsm_strtab, s, node, hash)
+    {
+        if (tlsm_str_eq(s, str, len, hash))
+            return s;
+    }
+    return NULL;
+}
+
+/**
+ * tlsm_str_intern - get a reference on the shared copy of a string, creating it if needed
+ *
+ * Return: the interned string, NULL on allocation failure. Release it with tlsm_str_put()
+ */
+struct tlsm_str *tlsm_str_intern(const char *str, u32 len)
+{
+    struct tlsm_str *s = tlsm_str_lookup(str, len);
+    if (s)
+        return s;
+
+    u32 hash = tlsm_str_hash(str, len);
+
+    // allocate outside of the lock, the string may have been added meanwhile
+    struct tlsm_str *new_str = kmalloc(sizeof(*new_str) + len + 1, GFP_KERNEL);
+    if (!new_str)
+        return NULL;
+
+    refcount_set(&new_str->ref, 1);
+    atomic_set(&new_str->policy_refs, 0);
+    new_str->hash = hash;
+    new_str->len = len;
+    memcpy(new_str->str, str, len);
+    new_str->str[len] = '\0';
+
+    spin_lock(&tlsm_strtab_lock);
+    s = __tlsm_str_find(str, len, hash);
+    if (s)
+    {
+        refcount_inc(&s->ref);
+        spin_unlock(&tlsm_strtab_lock);
+        kfree(new_str);
+        return s;
+    }
+    new_str->serial = ++tlsm_str_serial;
+    hash_add(tlsm_strtab, &new_str->node, hash);
+    spin_unlock(&tlsm_strtab_lock);
+    tlsm_mem_account(TLSM_MEM_STRING, 1, sizeof(*new_str) + len + 1);
+
+    return new_str;
+}
+
+/**
+ * tlsm_str_lookup - get a reference on the shared copy of a string if it exists
+ *
+ * Return: the interned string or NULL. Release it with tlsm_str_put()
+ */
+struct tlsm_str *tlsm_str_lookup(const char *str, u32 len)
+{
+    u32 hash = tlsm_str_hash(str, len);
+
+    spin_lock(&tlsm_strtab_lock);
+    // the last reference is only dropped with the lock held, strings in the table are alive
+    struct tlsm_str *s = __tlsm_str_find(str, len, hash);
+    if (s)
+        refcount_inc(&s->ref);
+    spin_unlock(&tlsm_strtab_lock);
+
+    return s;
+}
+
+struct tlsm_str *tlsm_str_get(struct tlsm_str *s)
+{
+    if (s)
+        refcount_inc(&s->ref);
+    return s;
+}
+
+void tlsm_str_put(struct tlsm_str *s)
+{
+    if (!s)
+        return;
+
+    if (refcount_dec_and_lock(&s->ref, &tlsm_strtab_lock))
+    {
+        hash_del(&s->node);
+        spin_unlock(&tlsm_strtab_lock);
+        tlsm_mem_account(TLSM_MEM_STRING, -1, -(long)(sizeof(*s) + s->len + 1));
+        kfree_rcu(s, rcu);
+    }
+}
+
+static size_t tlsm_str_size(const struct tlsm_str *s)
+{
+    return sizeof(*s) + s->len + 1;
+}
+
+/**
+ * tlsm_str_policy_intern - tlsm_str_intern() for a policy
+ *
+ * Strings are counted in the policy memory (max_policy_memory_kb) while a policy references
+ * them; the executables of the tasks are not, whatever their number.
+ * Return: the interned string, NULL on allocation failure. Release it with tlsm_str_policy_put()
+ */
+struct tlsm_str *tlsm_str_policy_intern(const char *str, u32 len)
+{
+    struct tlsm_str *s = tlsm_str_intern(str, len);
+
+    if (s && atomic_inc_return(&s->policy_refs) == 1)
+        tlsm_mem_account(TLSM_MEM_POLICY_STRING, 1, tlsm_str_size(s));
+    return s;
+}
+
+void tlsm_str_policy_put(struct tlsm_str *s)
+{
+    if (!s)
+        return;
+
+    if (atomic_dec_and_test(&s->policy_refs))
+        tlsm_mem_account(TLSM_MEM_POLICY_STRING, -1, -(long)tlsm_str_size(s));
+    tlsm_str_put(s);
+}
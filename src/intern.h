@@ -0,0 +1,48 @@
+#ifndef _TLSM_INTERN_H
+#define _TLSM_INTERN_H
+
+#include <linux/atomic.h>
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/refcount.h>
+#include <linux/rcupdate.h>
+#include <linux/string.h>
+
+/* refcounted, shared strings used by policies (subjects and objects) */
+struct tlsm_str
+{
+    struct hlist_node node; // tlsm string table bucket
+    struct rcu_head rcu;    // strings can be read under rcu (see tlsm_task_exe)
+    refcount_t ref;
+    atomic_t policy_refs; // references held by policies, the string is policy memory while > 0
+    u64 serial; // never reused, identifies the string without holding a reference
+    u32 hash;
+    u32 len;
+    char str[];
+};
+
+u32 tlsm_str_hash(const char *str, u32 len);
+struct tlsm_str *tlsm_str_intern(const char *str, u32 len);
+struct tlsm_str *tlsm_str_lookup(const char *str, u32 len);
+struct tlsm_str *tlsm_str_get(struct tlsm_str *s);
+void tlsm_str_put(struct tlsm_str *s);
+struct tlsm_str *tlsm_str_policy_intern(const char *str, u32 len);
+void tlsm_str_policy_put(struct tlsm_str *s);
+
+/**
+ * tlsm_str_eq - compares an interned string with a plain one whose length and hash are known
+ */
+static inline bool tlsm_str_eq(const struct tlsm_str *s, const char *str, u32 len, u32 hash)
+{
+    return s->hash == hash && s->len == len && memcmp(s->str, str, len) == 0;
+}
+
+/**
+ * tlsm_str_prefix - checks if an interned string is a prefix of a plain one
+ */
+static inline bool tlsm_str_prefix(const struct tlsm_str *s, const char *str)
+{
+    return strncmp(str, s->str, s->len) == 0;
+}
+
+#endif // _TLSM_INTERN_H
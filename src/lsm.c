@@ -11,17 +11,72 @@
 #include <linux/un.h>
 #include <linux/limits.h>
 #include <linux/binfmts.h>
+#include <linux/mman.h>
+#include <linux/seq_file.h>
+#include <net/sock.h>
 
 #include "tlsm.h"
 #include "utils.h"
 #include "access.h"
+#include "net.h"
+#include "verdict.h"
+#include "mem.h"
+#include "pseudofs.h"
 
 int request_timeout = CONFIG_SECURITY_TLSM_REQTIMEOUT;
 module_param(request_timeout, int, S_IRUGO);
 MODULE_PARM_DESC(request_timeout, "TLSM interactive request timeout");
 
+bool default_allow = IS_ENABLED(CONFIG_SECURITY_TLSM_DEFAULT_ALLOW);
+module_param(default_allow, bool, S_IRUGO);
+MODULE_PARM_DESC(default_allow, "TLSM verdict of ask and analyze policies when no watchdog answers");
+
+unsigned int max_rules = CONFIG_SECURITY_TLSM_MAX_RULES;
+module_param(max_rules, uint, 0644);
+MODULE_PARM_DESC(max_rules, "TLSM policies of a list, global or of a cgroup, 0 for no limit");
+
+unsigned int max_policy_memory_kb = CONFIG_SECURITY_TLSM_MAX_POLICY_MEMORY;
+module_param(max_policy_memory_kb, uint, 0644);
+MODULE_PARM_DESC(max_policy_memory_kb, "TLSM memory for policies, strings, rulesets and DFAs in KiB, 0 for no limit");
+
+unsigned int max_cgroup_sets = CONFIG_SECURITY_TLSM_MAX_CGROUP_SETS;
+module_param(max_cgroup_sets, uint, 0644);
+MODULE_PARM_DESC(max_cgroup_sets, "TLSM cgroups with policies, 0 for no limit");
+
+unsigned int max_pending = CONFIG_SECURITY_TLSM_MAX_PENDING;
+module_param(max_pending, uint, 0644);
+MODULE_PARM_DESC(max_pending, "TLSM pending ask and analyze requests of all users, 0 for no limit");
+
+unsigned int max_pending_per_uid = CONFIG_SECURITY_TLSM_MAX_PENDING_UID;
+module_param(max_pending_per_uid, uint, 0644);
+MODULE_PARM_DESC(max_pending_per_uid, "TLSM pending ask and analyze requests of a user, 0 for no limit");
+
+unsigned int max_pending_per_subject = CONFIG_SECURITY_TLSM_MAX_PENDING_SUBJECT;
+module_param(max_pending_per_subject, uint, 0644);
+MODULE_PARM_DESC(max_pending_per_subject, "TLSM pending ask and analyze requests of a program of a user, 0 for no limit");
+
+int pending_overflow = CONFIG_SECURITY_TLSM_PENDING_OVERFLOW;
+module_param(pending_overflow, int, 0644);
+MODULE_PARM_DESC(pending_overflow, "TLSM requests past the limits: 0 default verdict, 1 fail with EAGAIN, 2 default verdict and identical requests share one answer");
+
+unsigned int capture_buffer_kb = CONFIG_SECURITY_TLSM_CAPTURE_BUFFER;
+module_param(capture_buffer_kb, uint, 0644);
+MODULE_PARM_DESC(capture_buffer_kb, "TLSM buffer of the next access capture in KiB, records are dropped when it is full");
+
+bool pseudofs_fastpath = IS_ENABLED(CONFIG_SECURITY_TLSM_PSEUDOFS_FASTPATH);
+module_param(pseudofs_fastpath, bool, 0644);
+MODULE_PARM_DESC(pseudofs_fastpath, "TLSM allows opens of anonymous files (pipes, sockets, anon inodes, memfd) without resolving their path when no open policy can match them");
+
+static const struct lsm_id tlsm_lsmid = {
+	.name = "tlsm",
+	.id = 114,
+};
+
 struct lsm_blob_sizes tlsm_blob_sizes __ro_after_init = {
 	.lbs_task = sizeof(struct tlsm_task_security),
+	.lbs_inode = sizeof(struct tlsm_inode_security),
+	.lbs_file = sizeof(struct tlsm_file_security),
+	.lbs_sock = sizeof(struct tlsm_sock_security),
 };
 
 inline struct tlsm_task_security *get_task_security(struct task_struct *ts)
@@ -30,51 +85,178 @@ inline struct tlsm_task_security *get_task_security(struct task_struct *ts)
 };
 
 struct plist *tlsm_policies;
+DECLARE_RWSEM(tlsm_policies_sem);
 struct list_head tlsm_watchdogs;
+DEFINE_SPINLOCK(tlsm_watchdogs_lock);
 
 /* TLSM Operation hooks */
 /* these hooks are called on operations */
 static int tlsm_hook_open(struct file *f)
 {
-	char *buf = kzalloc(sizeof(char) * PATH_MAX, GFP_KERNEL);
-	char *res = d_path(&f->f_path, buf, PATH_MAX);
+	u8 modes = 0;
+	u8 latent = 0;
 
-	struct access access_request;
-	access_request.op = TLSM_FILE_OPEN;
-	access_request.object = res;
+	// the file may be changed, cached verdicts for it are not trusted anymore
+	if (f->f_mode & FMODE_WRITE)
+		tlsm_verdict_invalidate(file_inode(f));
 
-	int code = autorize_access(access_request);
-	kfree(buf);
+	if (f->f_mode & FMODE_READ)
+	{
+		modes |= TLSM_MODE_READ;
+		latent |= TLSM_MODE_EXEC;
+	}
+	if (f->f_mode & FMODE_WRITE)
+	{
+		// O_APPEND can be set or cleared later by fcntl()
+		modes |= f->f_flags & O_APPEND ? TLSM_MODE_APPEND : TLSM_MODE_WRITE;
+		latent |= TLSM_MODE_WRITE | TLSM_MODE_APPEND;
+	}
+	if (!modes) // ioctl only opens
+		modes = TLSM_MODE_READ;
 
-	return code;
+	// the path is only resolved if the verdict is not cached for this inode
+	return autorize_file_modes(f, modes, latent & ~modes);
+}
+
+/**
+ * tlsm_file_modes - check a use of an open file against the verdicts of its open policies
+ *
+ * O(1) once the modes were checked, see autorize_file_modes().
+ */
+static int tlsm_file_modes(struct file *f, u8 modes)
+{
+	if (!modes || !tlsm_file_tracked(f))
+		return 0;
+	return autorize_file_modes(f, modes, 0);
+}
+
+static int tlsm_hook_file_permission(struct file *f, int mask)
+{
+	u8 modes = 0;
+
+	if (mask & MAY_READ)
+		modes |= TLSM_MODE_READ;
+	if (mask & MAY_WRITE)
+		modes |= f->f_flags & O_APPEND ? TLSM_MODE_APPEND : TLSM_MODE_WRITE;
+
+	return tlsm_file_modes(f, modes);
+}
+
+static int tlsm_hook_mmap_file(struct file *f, unsigned long reqprot, unsigned long prot, unsigned long flags)
+{
+	u8 modes = 0;
+
+	if (!f)
+		return 0;
+	if (prot & PROT_EXEC)
+		modes |= TLSM_MODE_EXEC;
+	// writes to private mappings do not reach the file
+	if ((prot & PROT_WRITE) && (flags & MAP_TYPE) == MAP_SHARED)
+		modes |= TLSM_MODE_WRITE;
+
+	return tlsm_file_modes(f, modes);
+}
+
+static int tlsm_hook_file_mprotect(struct vm_area_struct *vma, unsigned long reqprot, unsigned long prot)
+{
+	u8 modes = 0;
+
+	if (!vma->vm_file)
+		return 0;
+	if (prot & PROT_EXEC)
+		modes |= TLSM_MODE_EXEC;
+	if ((prot & PROT_WRITE) && (vma->vm_flags & VM_SHARED))
+		modes |= TLSM_MODE_WRITE;
+
+	return tlsm_file_modes(vma->vm_file, modes);
+}
+
+static u8 tlsm_sock_protocol(struct socket *sock)
+{
+	if (!sock->sk)
+		return 0;
+
+	switch (sock->sk->sk_protocol)
+	{
+	case IPPROTO_TCP:
+		return TLSM_PROTO_TCP;
+	case IPPROTO_UDP:
+		return TLSM_PROTO_UDP;
+	default:
+		return 0;
+	}
 }
 
 static int __tlsm_hook_socket(struct socket *sock, struct sockaddr *address, int addrlen, tlsm_ops_t sock_op)
 {
-	char ip[48];
-	struct access access_request;
-	access_request.op = sock_op;
+	char path[UNIX_PATH_MAX + 1];
+	struct tlsm_sock_dest dest = {};
+	struct access access_request = {
+		.op = sock_op,
+		.object = "",
+		.family = -1,
+	};
+
+	// the address comes from userspace, only trust its declared length
+	if (addrlen < (int)offsetofend(struct sockaddr, sa_family))
+		return 0;
+	access_request.family = address->sa_family;
 
 	switch (address->sa_family)
 	{
-	case AF_UNIX:
-		struct sockaddr_un *addr_un = (struct sockaddr_un *)address;
-		access_request.object = addr_un->sun_path;
-		break;
-
 	case AF_INET:
 		struct sockaddr_in *addr4 = (struct sockaddr_in *)address;
-		snprintf(ip, sizeof(ip), "%pI4", &addr4->sin_addr);
-		access_request.object = ip;
+		if (addrlen < sizeof(*addr4))
+			return 0;
+		access_request.port = ntohs(addr4->sin_port);
 		break;
 
 	case AF_INET6:
 		struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)address;
-		snprintf(ip, sizeof(ip), "%pI6", &addr6->sin6_addr);
-		access_request.object = ip;
+		if (addrlen < SIN6_LEN_RFC2133)
+			return 0;
+		access_request.port = ntohs(addr6->sin6_port);
+		break;
+
+	default:
+		break;
+	}
+
+	// families and ports no policy references are allowed before any address formatting
+	if (!tlsm_net_may_match(sock_op, access_request.family, access_request.port))
+		return 0;
+	access_request.protocol = tlsm_sock_protocol(sock);
+
+	switch (address->sa_family)
+	{
+	case AF_UNIX:
+		// sun_path is not always NUL terminated, and starts with one for abstract sockets
+		int len = min_t(int, addrlen - offsetof(struct sockaddr_un, sun_path), UNIX_PATH_MAX);
+		struct sockaddr_un *addr_un = (struct sockaddr_un *)address;
+		if (len < 0)
+			len = 0;
+		memcpy(path, addr_un->sun_path, len);
+		path[len] = '\0';
+		access_request.object = path;
+		break;
+
+	case AF_INET:
+	case AF_INET6:
+		dest.family = address->sa_family;
+		dest.port = access_request.port;
+		if (dest.family == AF_INET)
+			memcpy(dest.addr, &((struct sockaddr_in *)address)->sin_addr, sizeof(struct in_addr));
+		else
+			memcpy(dest.addr, &((struct sockaddr_in6 *)address)->sin6_addr, sizeof(struct in6_addr));
+		access_request.object = NULL;
+		access_request.dest = &dest;
+		// datagrams mostly go to the same destination, the socket keeps the last verdict
+		if (sock_op == TLSM_SOCKET_SEND)
+			access_request.sk = sock->sk;
 		break;
 
 	default:
+		// no address representation, only "any" and family= policies can match
 		break;
 	}
 
@@ -91,6 +273,14 @@ static int tlsm_hook_sconnect(struct socket *sock, struct sockaddr *address, int
 	return __tlsm_hook_socket(sock, address, addrlen, TLSM_SOCKET_CONNECT);
 }
 
+static int tlsm_hook_sendmsg(struct socket *sock, struct msghdr *msg, int size)
+{
+	// without an address, the datagram goes to the connected peer, which connect policies checked
+	if (!msg->msg_name)
+		return 0;
+	return __tlsm_hook_socket(sock, msg->msg_name, msg->msg_namelen, TLSM_SOCKET_SEND);
+}
+
 /**
  * Dangereux
  */
@@ -110,27 +300,56 @@ static int tlsm_hook_task_kill(struct task_struct *p, struct kernel_siginfo *inf
 		return 0;
 	}
 
-	struct access access_request;
-	access_request.op = TLSM_SIGNAL;
-	access_request.object = get_exe_path_for_task(p);
+	// fast reject before looking at the receiver at all
+	if (!tlsm_rules_for_op(TLSM_SIGNAL))
+		return 0;
 
-	return autorize_access(access_request);
+	// the receiver's identity was interned at its execve, no path resolution needed here
+	struct tlsm_str *target = tlsm_task_exe(p);
+	struct access access_request = {
+		.op = TLSM_SIGNAL,
+		.signal = sig,
+		.target = target,
+		.object = target ? target->str : "unknown",
+	};
+
+	int code = autorize_access(access_request);
+	tlsm_str_put(target);
+
+	return code;
 }
 
 static int tlsm_hook_bprm_check_security(struct linux_binprm *bprm)
 {
+	struct access access_request = {
+		.op = TLSM_EXECVE,
+		.path = &bprm->file->f_path,
+	};
 
-	char *exe_path = kzalloc(sizeof(char) * PATH_MAX, GFP_KERNEL);
-	char *res = d_path(&bprm->file->f_path, exe_path, PATH_MAX);
+	return autorize_access(access_request);
+}
 
-	struct access access_request;
-	access_request.op = TLSM_EXECVE;
-	access_request.object = res;
+/**
+ * tlsm_hook_bprm_committed_creds - cache the new executable path of the task
+ */
+static void tlsm_hook_bprm_committed_creds(const struct linux_binprm *bprm)
+{
+	struct tlsm_task_security *ts = get_task_security(current);
+	struct tlsm_str *exe = NULL;
+	struct tlsm_str *old;
 
-	int code = autorize_access(access_request);
-	kfree(exe_path);
+	char *buf = kzalloc(sizeof(char) * PATH_MAX, GFP_KERNEL);
+	if (buf)
+	{
+		char *res = d_path(&bprm->file->f_path, buf, PATH_MAX);
+		if (!IS_ERR(res))
+			exe = tlsm_str_intern(res, strlen(res));
+		kfree(buf);
+	}
 
-	return code;
+	// other tasks may read it concurrently (signals), the string is freed after a grace period
+	old = rcu_replace_pointer(ts->exe, exe, true);
+	tlsm_str_put(old);
 }
 
 /* TLSM security hooks */
@@ -141,41 +360,146 @@ static int tlsm_task_allocate(struct task_struct *task, u64 clone_flags)
 {
 	struct tlsm_task_security *ts = get_task_security(task);
 	ts->score = 100;
+	RCU_INIT_POINTER(ts->exe, tlsm_task_exe(current));
 	return 0;
 }
 
 static void tlsm_task_free(struct task_struct *task)
 {
+	struct tlsm_task_security *ts = get_task_security(task);
+	tlsm_str_put(rcu_dereference_protected(ts->exe, true));
+}
+
+static int tlsm_inode_alloc(struct inode *inode)
+{
+	tlsm_verdict_init(inode);
+	return 0;
+}
+
+static int tlsm_file_alloc(struct file *file)
+{
+	tlsm_file_verdict_init(file);
+	return 0;
+}
+
+static int tlsm_sk_alloc(struct sock *sk, int family, gfp_t priority)
+{
+	tlsm_sock_verdict_init(sk);
+	return 0;
+}
+
+/* TLSM task attributes */
+/* the score and statistics of a task, for monitoring */
+
+/**
+ * tlsm_proc_stats - /proc/<pid>/attr/tlsm/stats (proc_base.diff), the state of a task on one line
+ * e.g. "score=100 open=1/12 bind=0/0 connect=0/3 signal=0/0 execve=0/5 send=0/0", denied/total per operation
+ *
+ * Called by procfs directly: as a getprocattr hook, TLSM would answer attr/current of
+ * the LSMs that have a security context whenever it is first in the LSM order.
+ */
+int tlsm_proc_stats(struct seq_file *m, struct task_struct *task)
+{
+	struct tlsm_task_security *ts = get_task_security(task);
+
+	// counters of other tasks are read without locking, they may be a few accesses behind
+	seq_printf(m, "score=%u", READ_ONCE(ts->score));
+	for (int op = TLSM_FILE_OPEN; op < TLSM_OPS_LEN; op++)
+		seq_printf(m, " %s=%llu/%llu", tlsm_ops2str(op),
+			   READ_ONCE(ts->stats[op].deny), READ_ONCE(ts->stats[op].total));
+	seq_putc(m, '\n');
+	return 0;
+}
+
+/* TLSM verdict cache invalidation hooks */
+/* these hooks drop cached verdicts when the path of an inode changes */
+
+static int tlsm_hook_inode_link(struct dentry *old_dentry, struct inode *dir, struct dentry *new_dentry)
+{
+	// more than one path now, verdicts of the first one could be reused for the other
+	tlsm_verdict_invalidate(d_backing_inode(old_dentry));
+	return 0;
+}
+
+static int tlsm_hook_inode_unlink(struct inode *dir, struct dentry *dentry)
+{
+	tlsm_verdict_invalidate(d_backing_inode(dentry));
+	return 0;
+}
+
+static int tlsm_hook_inode_rename(struct inode *old_dir, struct dentry *old_dentry, struct inode *new_dir, struct dentry *new_dentry)
+{
+	// every path below a directory changes, the inodes below are not known
+	if (d_is_dir(old_dentry))
+	{
+		tlsm_verdict_flush();
+		return 0;
+	}
+
+	tlsm_verdict_invalidate(d_backing_inode(old_dentry));
+	if (d_really_is_positive(new_dentry)) // replaced or exchanged
+		tlsm_verdict_invalidate(d_backing_inode(new_dentry));
+	return 0;
+}
+
+static int tlsm_hook_sb_umount(struct vfsmount *mnt, int flags)
+{
+	tlsm_verdict_flush();
+	return 0;
+}
+
+static int tlsm_hook_move_mount(const struct path *from_path, const struct path *to_path)
+{
+	tlsm_verdict_flush();
+	return 0;
 }
 
 static struct security_hook_list hooks[] __ro_after_init = {
 	// syscall hooks
 	LSM_HOOK_INIT(file_open, tlsm_hook_open),
+	LSM_HOOK_INIT(file_permission, tlsm_hook_file_permission),
+	LSM_HOOK_INIT(mmap_file, tlsm_hook_mmap_file),
+	LSM_HOOK_INIT(file_mprotect, tlsm_hook_file_mprotect),
 	LSM_HOOK_INIT(socket_bind, tlsm_hook_sbind),
 	LSM_HOOK_INIT(socket_connect, tlsm_hook_sconnect),
+	LSM_HOOK_INIT(socket_sendmsg, tlsm_hook_sendmsg),
 	LSM_HOOK_INIT(task_kill, tlsm_hook_task_kill),
 	LSM_HOOK_INIT(bprm_check_security, tlsm_hook_bprm_check_security),
+	LSM_HOOK_INIT(bprm_committed_creds, tlsm_hook_bprm_committed_creds),
 
 	// tlsm memory management hooks
 	LSM_HOOK_INIT(task_alloc, tlsm_task_allocate),
 	LSM_HOOK_INIT(task_free, tlsm_task_free),
+	LSM_HOOK_INIT(inode_alloc_security, tlsm_inode_alloc),
+	LSM_HOOK_INIT(file_alloc_security, tlsm_file_alloc),
+	LSM_HOOK_INIT(sk_alloc_security, tlsm_sk_alloc),
 
-};
+	// verdict cache invalidation hooks
+	LSM_HOOK_INIT(inode_link, tlsm_hook_inode_link),
+	LSM_HOOK_INIT(inode_unlink, tlsm_hook_inode_unlink),
+	LSM_HOOK_INIT(inode_rename, tlsm_hook_inode_rename),
+	LSM_HOOK_INIT(sb_umount, tlsm_hook_sb_umount),
+	LSM_HOOK_INIT(move_mount, tlsm_hook_move_mount),
 
-static const struct lsm_id tlsm_lsmid = {
-	.name = "tlsm",
-	.id = 114,
 };
 
 static int __init tlsm_init(void)
 {
 	security_add_hooks(hooks, ARRAY_SIZE(hooks), &tlsm_lsmid);
-	printk(KERN_INFO "[TLSM] loaded with interactive timeout=%d", request_timeout);
+	printk(KERN_INFO "[TLSM] loaded with interactive timeout=%d, %s when unanswered", request_timeout, default_allow ? "allow" : "deny");
+	if (tlsm_mem_init() != 0)
+	{
+		printk(KERN_ERR "[TLSM] failed to init object caches !");
+	}
 	tlsm_policies = tlsm_plist_new();
 	if (!tlsm_policies)
 	{
 		printk(KERN_ERR "[TLSM] failed to init policies !");
 	}
+	down_write(&tlsm_policies_sem);
+	tlsm_net_filter_rebuild();
+	tlsm_pseudofs_filter_rebuild();
+	up_write(&tlsm_policies_sem);
 	INIT_LIST_HEAD(&tlsm_watchdogs);
 
 	return 0;
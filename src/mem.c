@@ -0,0 +1,164 @@
+#include <linux/atomic.h>
+#include <linux/mempool.h>
+#include <linux/slab.h>
+
+#include "mem.h"
+#include "tlsm.h"
+#include "fs.h"
+
+#define TLSM_REQUEST_POOL_MIN 16 // pending requests that can always be allocated
+
+static struct
+{
+    const char *name;
+    size_t size;
+    struct kmem_cache *cache;
+    atomic_long_t count; // objects in use
+    atomic_long_t bytes; // variable sized types only, count * size for the others
+    bool policy;         // part of the policy state, counted in max_policy_memory_kb
+    bool subset;         // objects of another type, left out of the total
+} tlsm_mem[TLSM_MEM_TYPES] = {
+    [TLSM_MEM_POLICY] = {"tlsm_policy", sizeof(struct policy), .policy = true},
+    [TLSM_MEM_POLICY_NODE] = {"tlsm_policy_node", sizeof(struct policy_node), .policy = true},
+    [TLSM_MEM_REQUEST] = {"tlsm_fs_request", sizeof(struct fs_request)},
+    [TLSM_MEM_ANSWER] = {"tlsm_fs_answer", sizeof(struct fs_answer)},
+    [TLSM_MEM_WATCHDOG] = {"tlsm_watchdog", sizeof(struct tlsm_watchdog)},
+    [TLSM_MEM_POLICY_LIST] = {"tlsm_policy_list", .policy = true},
+    [TLSM_MEM_CGROUP] = {"tlsm_cgroup_set", .policy = true},
+    [TLSM_MEM_STRING] = {"tlsm_string"},
+    [TLSM_MEM_POLICY_STRING] = {"tlsm_policy_string", .policy = true, .subset = true}, // of tlsm_string
+    [TLSM_MEM_RULESET] = {"tlsm_ruleset", .policy = true},
+    [TLSM_MEM_DFA] = {"tlsm_dfa", .policy = true},
+    [TLSM_MEM_CAPTURE] = {"tlsm_capture"},
+};
+
+static mempool_t *tlsm_request_pool;
+
+/**
+ * tlsm_mem_init - create the object caches
+ *
+ * Return: 0 on success, -ENOMEM otherwise (caches created so far are kept, allocations
+ *         from missing ones fail)
+ */
+int tlsm_mem_init(void)
+{
+    for (int i = 0; i < TLSM_MEM_CACHES; i++)
+    {
+        tlsm_mem[i].cache = kmem_cache_create(tlsm_mem[i].name, tlsm_mem[i].size, 0, SLAB_HWCACHE_ALIGN, NULL);
+        if (!tlsm_mem[i].cache)
+        {
+            printk(KERN_ERR "[TLSM][MEM][ERROR] cannot create cache %s", tlsm_mem[i].name);
+            return -ENOMEM;
+        }
+    }
+
+    tlsm_request_pool = mempool_create_slab_pool(TLSM_REQUEST_POOL_MIN, tlsm_mem[TLSM_MEM_REQUEST].cache);
+    if (!tlsm_request_pool)
+    {
+        printk(KERN_ERR "[TLSM][MEM][ERROR] cannot create request pool");
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/**
+ * tlsm_mem_alloc - allocate a zeroed object, of a type below TLSM_MEM_CACHES
+ *
+ * Return: the object, NULL on failure (never for TLSM_MEM_REQUEST)
+ */
+void *tlsm_mem_alloc(enum tlsm_mem_type type)
+{
+    void *obj;
+
+    if (type == TLSM_MEM_REQUEST)
+    {
+        if (!tlsm_request_pool)
+            return NULL;
+        obj = mempool_alloc(tlsm_request_pool, GFP_KERNEL);
+        memset(obj, 0, tlsm_mem[type].size);
+    }
+    else
+    {
+        if (!tlsm_mem[type].cache)
+            return NULL;
+        obj = kmem_cache_zalloc(tlsm_mem[type].cache, GFP_KERNEL);
+    }
+
+    if (obj)
+        atomic_long_inc(&tlsm_mem[type].count);
+    return obj;
+}
+
+void tlsm_mem_free(enum tlsm_mem_type type, void *obj)
+{
+    if (!obj)
+        return;
+
+    if (type == TLSM_MEM_REQUEST)
+        mempool_free(obj, tlsm_request_pool);
+    else
+        kmem_cache_free(tlsm_mem[type].cache, obj);
+    atomic_long_dec(&tlsm_mem[type].count);
+}
+
+/**
+ * tlsm_mem_account - account objects of a variable sized type, negative counts when freed
+ */
+void tlsm_mem_account(enum tlsm_mem_type type, long objects, long bytes)
+{
+    atomic_long_add(objects, &tlsm_mem[type].count);
+    atomic_long_add(bytes, &tlsm_mem[type].bytes);
+}
+
+static long tlsm_mem_bytes(enum tlsm_mem_type type)
+{
+    if (type < TLSM_MEM_CACHES)
+        return atomic_long_read(&tlsm_mem[type].count) * tlsm_mem[type].size;
+    return atomic_long_read(&tlsm_mem[type].bytes);
+}
+
+/**
+ * tlsm_mem_policy_over_limit - check the policy state against max_policy_memory_kb
+ *
+ * Interned strings count while policies reference them: the executables of the tasks, that any
+ * user can make many of, do not.
+ */
+bool tlsm_mem_policy_over_limit(void)
+{
+    unsigned int max_kb = READ_ONCE(max_policy_memory_kb);
+    long bytes = 0;
+
+    if (!max_kb)
+        return false;
+    for (int i = 0; i < TLSM_MEM_TYPES; i++)
+    {
+        if (tlsm_mem[i].policy)
+            bytes += tlsm_mem_bytes(i);
+    }
+    return bytes > (long)max_kb * 1024;
+}
+
+/**
+ * tlsm_mem_show - print the memory in use, one "name objects bytes" line per type, then totals
+ *
+ * Bytes of cache objects do not include the slab overhead. Subsets of another type are only
+ * added to the policy total, where the type they are part of is not.
+ */
+void tlsm_mem_show(struct seq_file *m)
+{
+    long policy = 0;
+    long total = 0;
+
+    for (int i = 0; i < TLSM_MEM_TYPES; i++)
+    {
+        long bytes = tlsm_mem_bytes(i);
+
+        seq_printf(m, "%s\t%ld\t%ld\n", tlsm_mem[i].name, atomic_long_read(&tlsm_mem[i].count), bytes);
+        if (tlsm_mem[i].policy)
+            policy += bytes;
+        if (!tlsm_mem[i].subset)
+            total += bytes;
+    }
+    seq_printf(m, "policy_total\t-\t%ld\n", policy);
+    seq_printf(m, "total\t-\t%ld\n", total);
+}
@@ -0,0 +1,34 @@
+#ifndef _TLSM_MEM_H
+#define _TLSM_MEM_H
+
+#include <linux/seq_file.h>
+
+/* objects allocated from dedicated caches, visible in /proc/slabinfo as tlsm_<name> */
+enum tlsm_mem_type
+{
+    TLSM_MEM_POLICY,
+    TLSM_MEM_POLICY_NODE,
+    TLSM_MEM_REQUEST, // backed by a mempool, allocations sleep instead of failing
+    TLSM_MEM_ANSWER,
+    TLSM_MEM_WATCHDOG,
+    TLSM_MEM_CACHES,
+
+    // variable sized objects, allocated by their subsystem and only accounted here
+    TLSM_MEM_POLICY_LIST = TLSM_MEM_CACHES,
+    TLSM_MEM_CGROUP,
+    TLSM_MEM_STRING,        // every interned string, executables of the tasks included
+    TLSM_MEM_POLICY_STRING, // the ones referenced by policies
+    TLSM_MEM_RULESET,
+    TLSM_MEM_DFA,
+    TLSM_MEM_CAPTURE,
+    TLSM_MEM_TYPES,
+};
+
+int tlsm_mem_init(void);
+void *tlsm_mem_alloc(enum tlsm_mem_type type);
+void tlsm_mem_free(enum tlsm_mem_type type, void *obj);
+void tlsm_mem_account(enum tlsm_mem_type type, long objects, long bytes);
+bool tlsm_mem_policy_over_limit(void);
+void tlsm_mem_show(struct seq_file *m);
+
+#endif // _TLSM_MEM_H
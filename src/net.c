@@ -0,0 +1,155 @@
+#include <linux/bitmap.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/socket.h>
+#include <linux/string.h>
+
+#include "net.h"
+#include "cgroups.h"
+#include "utils.h"
+
+/* Fast reject filter */
+/* families and ports referenced by the socket policies of every list. Adding a policy only sets
+ * bits, so a filter is updated in place; compacting a list after deletions (tlsm_ruleset_compact())
+ * rebuilds a new one and swaps it, bits of deleted policies are harmless until then. */
+
+#define TLSM_NET_PORTS 65536
+
+struct tlsm_net_op_filter
+{
+    u64 families;         // families referenced by a policy
+    u64 any_port;         // families with a policy that applies to every port
+    DECLARE_BITMAP(inet_ports, TLSM_NET_PORTS);
+    DECLARE_BITMAP(inet6_ports, TLSM_NET_PORTS);
+};
+
+struct tlsm_net_filter
+{
+    struct rcu_head rcu;
+    struct tlsm_net_op_filter ops[3]; // bind, connect, send
+};
+
+static struct tlsm_net_filter __rcu *tlsm_net_filter;
+
+static struct tlsm_net_op_filter *tlsm_net_op(struct tlsm_net_filter *f, tlsm_ops_t op)
+{
+    switch (op)
+    {
+    case TLSM_SOCKET_BIND:
+        return &f->ops[0];
+    case TLSM_SOCKET_CONNECT:
+        return &f->ops[1];
+    case TLSM_SOCKET_SEND:
+        return &f->ops[2];
+    default:
+        return NULL;
+    }
+}
+
+static void __tlsm_net_filter_add(struct tlsm_net_filter *f, struct policy *p)
+{
+    struct tlsm_net_op_filter *of = tlsm_net_op(f, p->op);
+    if (!of)
+        return;
+
+    of->families |= p->opts.families;
+    if (!p->opts.nports)
+    {
+        of->any_port |= p->opts.families;
+        return;
+    }
+
+    for (int i = 0; i < p->opts.nports; i++)
+    {
+        unsigned int len = p->opts.ports[i].hi - p->opts.ports[i].lo + 1;
+        if (p->opts.families & BIT_ULL(AF_INET))
+            bitmap_set(of->inet_ports, p->opts.ports[i].lo, len);
+        if (p->opts.families & BIT_ULL(AF_INET6))
+            bitmap_set(of->inet6_ports, p->opts.ports[i].lo, len);
+    }
+    // port ranges only make sense for inet families, others always go through the policies
+    of->any_port |= p->opts.families & ~(BIT_ULL(AF_INET) | BIT_ULL(AF_INET6));
+}
+
+void tlsm_net_filter_add(struct policy *p)
+{
+    struct tlsm_net_filter *f = rcu_dereference_protected(tlsm_net_filter, lockdep_is_held(&tlsm_policies_sem));
+    if (f)
+        __tlsm_net_filter_add(f, p);
+}
+
+static struct tlsm_net_filter *tlsm_net_filter_building;
+
+static void tlsm_net_filter_add_plist(struct plist *l)
+{
+    for (struct policy_node *n = l->head; n; n = n->next)
+        __tlsm_net_filter_add(tlsm_net_filter_building, n->policy);
+}
+
+/**
+ * tlsm_net_filter_rebuild - recompute the filter from every policy list, once policies were removed
+ *
+ * On allocation failure the filter is dropped, and every socket operation goes through the policies.
+ */
+void tlsm_net_filter_rebuild(void)
+{
+    struct tlsm_net_filter *old = rcu_dereference_protected(tlsm_net_filter, lockdep_is_held(&tlsm_policies_sem));
+
+    tlsm_net_filter_building = kvzalloc(sizeof(*tlsm_net_filter_building), GFP_KERNEL);
+    if (tlsm_net_filter_building)
+    {
+        tlsm_net_filter_add_plist(tlsm_policies);
+        tlsm_cgroup_foreach(tlsm_net_filter_add_plist);
+    }
+
+    rcu_assign_pointer(tlsm_net_filter, tlsm_net_filter_building);
+    tlsm_net_filter_building = NULL;
+    if (old)
+        kvfree_rcu(old, rcu);
+}
+
+/**
+ * tlsm_net_may_match - check if a socket operation can match any policy
+ *
+ * Return: false if no socket policy references this family and port, the operation can be
+ *         allowed without looking at the address
+ */
+bool tlsm_net_may_match(tlsm_ops_t op, int family, u16 port)
+{
+    bool res = true;
+
+    if (!tlsm_rules_for_op(op))
+        return false;
+    // analyze policies match every operation
+    if (atomic_read(&tlsm_op_rules[TLSM_OP_UNDEFINED]) || family < 0 || family >= AF_MAX)
+        return true;
+
+    rcu_read_lock();
+    struct tlsm_net_filter *f = rcu_dereference(tlsm_net_filter);
+    struct tlsm_net_op_filter *of = f ? tlsm_net_op(f, op) : NULL;
+    if (of)
+    {
+        if (!(of->families & BIT_ULL(family)))
+            res = false;
+        else if (of->any_port & BIT_ULL(family))
+            res = true;
+        else if (family == AF_INET)
+            res = test_bit(port, of->inet_ports);
+        else if (family == AF_INET6)
+            res = test_bit(port, of->inet6_ports);
+    }
+    rcu_read_unlock();
+
+    return res;
+}
+
+/**
+ * tlsm_net_format - print an address the way socket policy objects are written
+ */
+void tlsm_net_format(const struct tlsm_sock_dest *dest, char *buf, size_t len)
+{
+    if (dest->family == AF_INET)
+        snprintf(buf, len, "%pI4", dest->addr);
+    else
+        snprintf(buf, len, "%pI6", dest->addr);
+}
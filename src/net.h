@@ -0,0 +1,27 @@
+#ifndef _TLSM_NET_H
+#define _TLSM_NET_H
+
+#include <linux/types.h>
+
+#include "common.h"
+#include "tlsm.h"
+#include "ruleset.h"
+
+#define TLSM_NET_ADDR_LEN 48 // an inet6 address, as printed by %pI6
+
+/* inet or inet6 address of a socket operation, formatted only if its verdict is not cached */
+struct tlsm_sock_dest
+{
+    int family;
+    u16 port;
+    u8 addr[16]; // in_addr or in6_addr
+};
+
+/* the following require tlsm_policies_sem, held for writing */
+void tlsm_net_filter_add(struct policy *p);
+void tlsm_net_filter_rebuild(void);
+
+bool tlsm_net_may_match(tlsm_ops_t op, int family, u16 port);
+void tlsm_net_format(const struct tlsm_sock_dest *dest, char *buf, size_t len);
+
+#endif // _TLSM_NET_H
@@ -0,0 +1,106 @@
+#include <linux/mount.h>
+#include <linux/string.h>
+
+#include "pseudofs.h"
+#include "cgroups.h"
+#include "glob.h"
+
+/**
+ * tlsm_pseudofs_class - class of the filesystem a mount is of
+ *
+ * Return: TLSM_FS_*, 0 for the filesystems that are always checked
+ */
+static u8 tlsm_pseudofs_class(const struct vfsmount *mnt)
+{
+    // not reachable by a path, d_path() gives "pipe:[42]", "anon_inode:[eventfd]", "/memfd:x (deleted)"...
+    if (mnt->mnt_flags & MNT_INTERNAL)
+        return TLSM_FS_INTERNAL;
+    return 0;
+}
+
+/**
+ * tlsm_pseudofs_policy_classes - classes of the files (TLSM_FS_*) a policy can match
+ *
+ * Only the object is looked at, never the mounts: absolute paths name files of the mount tree,
+ * unless they are a single name like the ones internal files get ("/memfd:x (deleted)",
+ * "/SYSV00000000 (deleted)") or their first component is one ("/memfd:x/y (deleted)").
+ * Plain objects match any part of a path; one like "/etc/shadow" is not expected to target a
+ * memfd a program named "x/etc/shadow". Glob objects are anchored, their directory before the
+ * first special character is looked at.
+ * Return: TLSM_FS_* mask, 0 for policies of other operations
+ */
+u8 tlsm_pseudofs_policy_classes(const struct policy *p)
+{
+    // analyze policies match every operation
+    if (p->category == TLSM_ANALYZE)
+        return TLSM_FS_ALL;
+    if (p->op != TLSM_FILE_OPEN)
+        return 0;
+
+    const char *str = p->object->str;
+    u32 len = p->object->len;
+    if (!len)
+        return TLSM_FS_ALL;
+
+    if (tlsm_glob_is_pattern(str, len))
+    {
+        u32 literal = 0;
+        while (literal < len && !tlsm_glob_is_pattern(str + literal, 1))
+            literal++;
+        // the last component before the pattern is only part of a name
+        while (literal && str[literal - 1] != '/')
+            literal--;
+        len = literal;
+    }
+
+    if (!len || str[0] != '/')
+        return TLSM_FS_ALL;
+
+    const char *sep = memchr(str + 1, '/', len - 1);
+    if (!sep || sep == str + 1 || memchr(str + 1, ':', sep - str - 1))
+        return TLSM_FS_ALL;
+    return 0;
+}
+
+/* Fast path filter */
+/* pseudo filesystem classes of the open policies of every list. Adding a policy only sets bits;
+ * compacting a list after deletions (tlsm_ruleset_compact()) recomputes the mask. */
+
+static u8 tlsm_pseudofs_mask;
+static u8 tlsm_pseudofs_building;
+
+void tlsm_pseudofs_filter_add(const struct policy *p)
+{
+    WRITE_ONCE(tlsm_pseudofs_mask, tlsm_pseudofs_mask | p->fs_classes);
+}
+
+static void tlsm_pseudofs_filter_add_plist(struct plist *l)
+{
+    for (struct policy_node *n = l->head; n; n = n->next)
+        tlsm_pseudofs_building |= n->policy->fs_classes;
+}
+
+/**
+ * tlsm_pseudofs_filter_rebuild - recompute the filter from every policy list, once policies were removed
+ */
+void tlsm_pseudofs_filter_rebuild(void)
+{
+    tlsm_pseudofs_building = 0;
+    if (tlsm_policies)
+        tlsm_pseudofs_filter_add_plist(tlsm_policies);
+    tlsm_cgroup_foreach(tlsm_pseudofs_filter_add_plist);
+    WRITE_ONCE(tlsm_pseudofs_mask, tlsm_pseudofs_building);
+}
+
+/**
+ * tlsm_pseudofs_may_match - check if an open file can match any open policy
+ *
+ * Return: false if the file is of a pseudo filesystem, or anonymous, and no policy names it:
+ *         the open can be allowed without resolving its path
+ */
+bool tlsm_pseudofs_may_match(const struct file *f)
+{
+    u8 class = tlsm_pseudofs_class(f->f_path.mnt);
+
+    return !class || !READ_ONCE(pseudofs_fastpath) || (READ_ONCE(tlsm_pseudofs_mask) & class);
+}
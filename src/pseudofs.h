@@ -0,0 +1,24 @@
+#ifndef _TLSM_PSEUDOFS_H
+#define _TLSM_PSEUDOFS_H
+
+#include <linux/fs.h>
+
+#include "tlsm.h"
+
+/* classes of the files whose opens skip the policies, without resolving their path, when no
+ * open policy can match them. Files of mounted filesystems, pseudo ones included, always go
+ * through the policies: which path reaches them depends on the mounts and mount namespace of
+ * the task opening them, not on the ones seen when the policy was loaded. */
+
+#define TLSM_FS_INTERNAL 0x1 // kernel internal mounts: pipes, sockets, anon inodes, memfd, nsfs, pidfs
+#define TLSM_FS_ALL TLSM_FS_INTERNAL
+
+u8 tlsm_pseudofs_policy_classes(const struct policy *p);
+
+/* the following require tlsm_policies_sem, held for writing */
+void tlsm_pseudofs_filter_add(const struct policy *p);
+void tlsm_pseudofs_filter_rebuild(void);
+
+bool tlsm_pseudofs_may_match(const struct file *f);
+
+#endif // _TLSM_PSEUDOFS_H
@@ -0,0 +1,891 @@
+#ifdef __KERNEL__
+#include <linux/bitmap.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/limits.h>
+#include <linux/socket.h>
+#include <linux/string.h>
+#else
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#endif
+
+#include "rule.h"
+
+#ifndef __KERNEL__
+#define U32_MAX UINT32_MAX
+#define BIT_ULL(n) (1ULL << (n))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
+#define BITS_TO_LONGS(n) (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+/* the kernel helpers this file uses, with their semantics for base 10 */
+
+static int tlsm_rule_strtoull(const char *s, unsigned long long max, unsigned long long *n)
+{
+    char *end;
+
+    if (*s < '0' || *s > '9')
+        return -EINVAL;
+    errno = 0;
+    *n = strtoull(s, &end, 10);
+    if (*end == '\n')
+        end++;
+    if (*end)
+        return -EINVAL;
+    return errno || *n > max ? -ERANGE : 0;
+}
+
+static int kstrtouint(const char *s, unsigned int base, unsigned int *res)
+{
+    unsigned long long n;
+    int err = tlsm_rule_strtoull(s + (*s == '+'), UINT_MAX, &n);
+
+    if (!err)
+        *res = n;
+    return err;
+}
+
+static int kstrtou16(const char *s, unsigned int base, u16 *res)
+{
+    unsigned long long n;
+    int err = tlsm_rule_strtoull(s + (*s == '+'), UINT16_MAX, &n);
+
+    if (!err)
+        *res = n;
+    return err;
+}
+
+static int kstrtoint(const char *s, unsigned int base, int *res)
+{
+    unsigned long long n;
+    bool neg = *s == '-';
+    int err = tlsm_rule_strtoull(neg ? s + 1 : s + (*s == '+'), neg ? -(long long)INT_MIN : INT_MAX, &n);
+
+    if (!err)
+        *res = neg ? (int)-(long long)n : (int)n;
+    return err;
+}
+
+static inline bool test_bit(unsigned int n, const unsigned long *map)
+{
+    return map[n / BITS_PER_LONG] & (1UL << (n % BITS_PER_LONG));
+}
+
+static unsigned long find_next_bit(const unsigned long *map, unsigned long size, unsigned long off)
+{
+    while (off < size)
+    {
+        unsigned long word = map[off / BITS_PER_LONG] >> (off % BITS_PER_LONG);
+
+        if (word)
+            return off + __builtin_ctzl(word) < size ? off + __builtin_ctzl(word) : size;
+        off = (off / BITS_PER_LONG + 1) * BITS_PER_LONG;
+    }
+    return size;
+}
+
+#define for_each_set_bit(bit, map, size) \
+    for ((bit) = find_next_bit((map), (size), 0); (bit) < (size); (bit) = find_next_bit((map), (size), (bit) + 1))
+#endif
+
+/* Parsing */
+
+/**
+ * str_split - split a string in place, on runs of a delimiter
+ *
+ * The delimiters and the trailing '\n' are overwritten by NULs, the words point into the
+ * string, which must outlive them. Nothing is allocated.
+ * Return: 0 on success, -E2BIG if the string has more than TLSM_MAX_WORDS words
+ */
+int str_split(char *string, const char delimiter, struct tlsm_words *w)
+{
+    char *c = string;
+
+    w->count = 0;
+    while (*c)
+    {
+        while (*c == delimiter)
+            *c++ = '\0';
+        if (!*c || (*c == '\n' && !c[1]))
+            break;
+
+        if (w->count == TLSM_MAX_WORDS)
+            return -E2BIG;
+        char *word = c;
+        while (*c && *c != delimiter && !(*c == '\n' && !c[1]))
+            c++;
+        w->word[w->count] = word;
+        w->len[w->count] = c - word;
+        w->count++;
+    }
+    *c = '\0'; // trailing '\n'
+    return 0;
+}
+
+static const struct
+{
+    int sig;
+    const char *name;
+} signal_names[] = {
+    {1, "HUP"}, {2, "INT"}, {3, "QUIT"}, {4, "ILL"}, {5, "TRAP"}, {6, "ABRT"}, {7, "BUS"},
+    {8, "FPE"}, {9, "KILL"}, {10, "USR1"}, {11, "SEGV"}, {12, "USR2"}, {13, "PIPE"},
+    {14, "ALRM"}, {15, "TERM"}, {16, "STKFLT"}, {17, "CHLD"}, {18, "CONT"}, {19, "STOP"},
+    {20, "TSTP"}, {21, "TTIN"}, {22, "TTOU"}, {23, "URG"}, {24, "XCPU"}, {25, "XFSZ"},
+    {26, "VTALRM"}, {27, "PROF"}, {28, "WINCH"}, {29, "IO"}, {30, "PWR"}, {31, "SYS"},
+};
+
+static const struct
+{
+    int family;
+    const char *name;
+} family_names[] = {
+    {AF_UNIX, "unix"},
+    {AF_INET, "inet"},
+    {AF_INET6, "inet6"},
+    {AF_NETLINK, "netlink"},
+    {AF_PACKET, "packet"},
+};
+
+/**
+ * parse_sigmask - parse a comma separated list of signals (TERM, SIGTERM or 15)
+ *
+ * Return: 0 on success, -EINVAL on unknown signal
+ */
+static int parse_sigmask(char *list, u64 *mask)
+{
+    char *sig;
+    *mask = 0;
+
+    while ((sig = strsep(&list, ",")) != NULL)
+    {
+        int n = 0;
+
+        if (strncmp(sig, "SIG", 3) == 0)
+            sig += 3;
+
+        if (kstrtoint(sig, 10, &n) != 0)
+        {
+            for (int i = 0; i < ARRAY_SIZE(signal_names); i++)
+            {
+                if (strcmp(sig, signal_names[i].name) == 0)
+                {
+                    n = signal_names[i].sig;
+                    break;
+                }
+            }
+        }
+
+        if (n < 1 || n > 64)
+        {
+            printk(KERN_ERR "[TLSM][ERROR] unknown signal %s", sig);
+            return -EINVAL;
+        }
+        *mask |= BIT_ULL(n - 1);
+    }
+    return 0;
+}
+
+/**
+ * parse_modes - parse a comma separated list of file access modes (read, write, append, exec)
+ *
+ * Return: 0 on success, -EINVAL on unknown mode
+ */
+static int parse_modes(char *list, u8 *modes)
+{
+    char *mode;
+    *modes = 0;
+
+    while ((mode = strsep(&list, ",")) != NULL)
+    {
+        int i;
+        for (i = 0; i < ARRAY_SIZE(mode2str); i++)
+        {
+            if (strcmp(mode, mode2str[i].str) == 0)
+                break;
+        }
+        if (i == ARRAY_SIZE(mode2str))
+        {
+            printk(KERN_ERR "[TLSM][ERROR] unknown file access mode %s", mode);
+            return -EINVAL;
+        }
+        *modes |= mode2str[i].val;
+    }
+    return 0;
+}
+
+/**
+ * parse_families - parse a comma separated list of address families (inet, unix or numbers)
+ *
+ * Return: 0 on success, -EINVAL on unknown family
+ */
+static int parse_families(char *list, u64 *families)
+{
+    char *family;
+    *families = 0;
+
+    while ((family = strsep(&list, ",")) != NULL)
+    {
+        int n = -1;
+
+        if (kstrtoint(family, 10, &n) != 0)
+        {
+            for (int i = 0; i < ARRAY_SIZE(family_names); i++)
+            {
+                if (strcmp(family, family_names[i].name) == 0)
+                {
+                    n = family_names[i].family;
+                    break;
+                }
+            }
+        }
+
+        if (n < 0 || n >= AF_MAX)
+        {
+            printk(KERN_ERR "[TLSM][ERROR] unknown address family %s", family);
+            return -EINVAL;
+        }
+        *families |= BIT_ULL(n);
+    }
+    return 0;
+}
+
+/**
+ * parse_protocols - parse a comma separated list of transport protocols (tcp, udp)
+ *
+ * Return: 0 on success, -EINVAL on unknown protocol
+ */
+static int parse_protocols(char *list, u8 *protocols)
+{
+    char *proto;
+    *protocols = 0;
+
+    while ((proto = strsep(&list, ",")) != NULL)
+    {
+        if (strcmp(proto, "tcp") == 0)
+            *protocols |= TLSM_PROTO_TCP;
+        else if (strcmp(proto, "udp") == 0)
+            *protocols |= TLSM_PROTO_UDP;
+        else
+        {
+            printk(KERN_ERR "[TLSM][ERROR] unknown protocol %s", proto);
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+/**
+ * parse_ports - parse a comma separated list of ports and port ranges (80,443,8000-8999)
+ *
+ * Return: 0 on success with ranges[0..*nports) filled, negative error code otherwise
+ */
+static int parse_ports(char *list, struct tlsm_port_range *ranges, u16 *nports)
+{
+    char *range;
+    int i = 0;
+    while ((range = strsep(&list, ",")) != NULL)
+    {
+        if (i == TLSM_POLICY_MAX_PORTS)
+        {
+            printk(KERN_ERR "[TLSM][ERROR] more than %d port ranges", TLSM_POLICY_MAX_PORTS);
+            return -E2BIG;
+        }
+        char *hi = range;
+        char *lo = strsep(&hi, "-");
+
+        if (kstrtou16(lo, 10, &ranges[i].lo) != 0)
+            goto parse_ports_fail;
+        ranges[i].hi = ranges[i].lo;
+        if (hi && kstrtou16(hi, 10, &ranges[i].hi) != 0)
+            goto parse_ports_fail;
+        if (ranges[i].hi < ranges[i].lo)
+            goto parse_ports_fail;
+        i++;
+    }
+
+    *nports = i;
+    return 0;
+
+parse_ports_fail:
+    printk(KERN_ERR "[TLSM][ERROR] invalid port range %s", range);
+    return -EINVAL;
+}
+
+/**
+ * parse_timeout - parse a request timeout, in seconds or with a "ms" or "s" suffix
+ *
+ * Return: 0 on success, -EINVAL if the value is not a positive duration
+ */
+static int parse_timeout(char *value, u32 *timeout_ms)
+{
+    size_t len = strlen(value);
+    unsigned int scale = 1000;
+    unsigned int n;
+
+    if (len > 2 && strcmp(value + len - 2, "ms") == 0)
+    {
+        value[len - 2] = '\0';
+        scale = 1;
+    }
+    else if (len > 1 && value[len - 1] == 's')
+    {
+        value[len - 1] = '\0';
+    }
+
+    if (kstrtouint(value, 10, &n) != 0 || n == 0 || n > U32_MAX / scale)
+        return -EINVAL;
+    *timeout_ms = n * scale;
+    return 0;
+}
+
+/**
+ * parse_threshold - parse a score threshold, optionally followed by ":" and a score update
+ *
+ * Return: 0 on success, -EINVAL on malformed values
+ */
+static int parse_threshold(char *value, unsigned int *threshold, int *delta)
+{
+    char *update = value;
+    char *score = strsep(&update, ":");
+
+    *delta = 0;
+    if (kstrtouint(score, 10, threshold) != 0)
+        return -EINVAL;
+    if (update && kstrtoint(update, 10, delta) != 0)
+        return -EINVAL;
+    return 0;
+}
+
+/**
+ * parse_rule_option - parse one of the optional "key=value" words following a policy
+ *
+ * Return: 0 on success, -EINVAL if the option is unknown or invalid for this policy
+ */
+static int parse_rule_option(struct tlsm_rule_text *t, char *word, u32 len)
+{
+    struct tlsm_rule_options *o = &t->opts;
+    char *value = word;
+    char *key = strsep(&value, "=");
+
+    if (!value)
+        goto parse_option_fail;
+
+    if (t->op == TLSM_FILE_OPEN && strcmp(key, "mode") == 0)
+    {
+        if (parse_modes(value, &o->modes) != 0)
+            goto parse_option_fail;
+    }
+    else if (t->op == TLSM_SIGNAL && strcmp(key, "sig") == 0)
+    {
+        if (parse_sigmask(value, &o->sigmask) != 0)
+            goto parse_option_fail;
+    }
+    else if (t->op == TLSM_SIGNAL && strcmp(key, "target") == 0)
+    {
+        t->target = value;
+        t->target_len = len - (value - word);
+    }
+    else if (tlsm_op_is_socket(t->op) && strcmp(key, "family") == 0)
+    {
+        if (parse_families(value, &o->families) != 0)
+            goto parse_option_fail;
+    }
+    else if (tlsm_op_is_socket(t->op) && strcmp(key, "proto") == 0)
+    {
+        if (parse_protocols(value, &o->protocols) != 0)
+            goto parse_option_fail;
+    }
+    else if (tlsm_op_is_socket(t->op) && strcmp(key, "port") == 0)
+    {
+        int err = parse_ports(value, o->ports, &o->nports);
+        if (err)
+            return err;
+    }
+    else if ((t->category == TLSM_ASK || t->category == TLSM_ANALYZE) && strcmp(key, "timeout") == 0)
+    {
+        if (parse_timeout(value, &o->timeout_ms) != 0)
+            goto parse_option_fail;
+    }
+    else if ((t->category == TLSM_ASK || t->category == TLSM_ANALYZE) && strcmp(key, "default") == 0)
+    {
+        if (strcmp(value, "allow") == 0)
+            o->fallback = TLSM_FALLBACK_ALLOW;
+        else if (strcmp(value, "deny") == 0)
+            o->fallback = TLSM_FALLBACK_DENY;
+        else
+            goto parse_option_fail;
+    }
+    else if (t->category == TLSM_ANALYZE && strcmp(key, "allow_above") == 0)
+    {
+        if (parse_threshold(value, &o->allow_above, &o->allow_delta) != 0)
+            goto parse_option_fail;
+    }
+    else if (t->category == TLSM_ANALYZE && strcmp(key, "deny_below") == 0)
+    {
+        if (parse_threshold(value, &o->deny_below, &o->deny_delta) != 0)
+            goto parse_option_fail;
+    }
+    else
+    {
+        goto parse_option_fail;
+    }
+    return 0;
+
+parse_option_fail:
+    printk(KERN_ERR "[TLSM][ERROR] invalid policy option %s", key);
+    return -EINVAL;
+}
+
+/**
+ * tlsm_pattern_check - reject a glob pattern that is malformed or would need too many DFA states
+ *
+ * Return: 0 if the string is not a pattern or a valid one, -EINVAL otherwise
+ */
+int tlsm_pattern_check(const char *s, u32 len, u32 max_states)
+{
+    struct tlsm_glob g;
+    int err = 0;
+
+    if (!tlsm_glob_is_pattern(s, len))
+        return 0;
+
+    if (!tlsm_glob_valid(s, len))
+    {
+        printk(KERN_ERR "[TLSM][ERROR] invalid pattern %s", s);
+        return -EINVAL;
+    }
+
+    tlsm_glob_init(&g, s, len, TLSM_GLOB_ANCHORED, 0);
+    struct tlsm_dfa *dfa = tlsm_dfa_build(&g, 1, 1, max_states, &err);
+    if (!dfa)
+    {
+        printk(KERN_ERR "[TLSM][ERROR] pattern %s cannot be compiled (%d), it needs more than %u states", s, err, max_states);
+        return err == -E2BIG ? -EINVAL : err;
+    }
+    tlsm_dfa_free(dfa);
+    return 0;
+}
+
+/**
+ * tlsm_rule_parse - parse a policy, "<subject> <category> [<op> [<object>]] [key=value...]"
+ *
+ * The rule is split in place, the strings of the result point into it. Patterns are checked
+ * against max_states, the DFA limit of the rulesets the policy goes to.
+ * Return: 0 on success, negative error code if TLSM rejects the policy
+ */
+int tlsm_rule_parse(char *rule, u32 max_states, struct tlsm_rule_text *t)
+{
+    struct tlsm_words w;
+    int first_option;
+
+    memset(t, 0, sizeof(*t));
+    if (str_split(rule, ' ', &w) != 0 || w.count < 2)
+        return -EINVAL;
+
+    t->category = str2tlsm_cat(w.word[1]);
+    if (t->category == TLSM_UNDEFINED)
+    {
+        return -EINVAL;
+    }
+    else if (t->category == TLSM_ANALYZE)
+    {
+        t->op = TLSM_OP_UNDEFINED;
+        t->opts.allow_above = UINT_MAX; // every score goes to tlsmd unless thresholds are given
+        t->opts.deny_below = 0;
+        first_option = 2;
+    }
+    else
+    {
+        if (w.count < 3)
+            return -EINVAL;
+
+        t->op = str2tlsm_ops(w.word[2]);
+        if (t->op == TLSM_OP_UNDEFINED)
+        {
+            printk(KERN_ERR "[TLSM][ERROR] cannot parse operation %s", w.word[2]);
+            return -EINVAL;
+        }
+
+        int argc = tlsm_op2argc(t->op);
+        if (w.count < 3 + argc)
+        {
+            printk(KERN_ERR "[TLSM][ERROR] not enough paramters for policy (got %d out of %d required)", w.count, 3+argc);
+            return -EINVAL;
+        }
+
+        if (argc == 1)
+        {
+            t->object = w.word[3];
+            t->object_len = w.len[3];
+            if (tlsm_pattern_check(t->object, t->object_len, max_states) != 0)
+                return -EINVAL;
+        }
+        t->opts.modes = TLSM_MODE_ALL; // every file access mode unless mode= is given
+        t->opts.sigmask = ~0ULL; // every signal unless sig= is given
+        t->opts.families = ~0ULL; // every family unless family= is given
+        t->opts.protocols = TLSM_PROTO_ANY;
+        first_option = 3 + argc;
+    }
+
+    t->subject = w.word[0];
+    t->subject_len = w.len[0];
+    if (tlsm_pattern_check(t->subject, t->subject_len, max_states) != 0)
+        return -EINVAL;
+
+    for (int i = first_option; i < w.count; i++)
+    {
+        int err = parse_rule_option(t, w.word[i], w.len[i]);
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+/* Patterns */
+/* a rule is turned into the same glob, whether it is compiled in a DFA or matched alone */
+
+/**
+ * tlsm_rule_any_object - checks if a rule matches every object of its operation
+ *
+ * "any" and its prefixes only mean every object for operations whose objects are prefixes,
+ * open objects are substrings: "open any" still matches the paths containing "any".
+ */
+static inline bool tlsm_rule_any_object(const struct tlsm_rule *r)
+{
+    if (r->category == TLSM_ANALYZE || !r->object_len)
+        return true;
+    return r->op != TLSM_FILE_OPEN && (r->flags & TLSM_RULE_ANY_OBJECT);
+}
+
+static void tlsm_rule_subject_glob(const struct tlsm_ruleset *rs, const struct tlsm_rule *r, struct tlsm_glob *g)
+{
+    u8 flags = TLSM_GLOB_ANCHORED;
+
+    // plain subjects are prefixes of the executable path, exact paths for analyze rules
+    if (!(r->flags & TLSM_RULE_SUBJECT_GLOB) && r->category != TLSM_ANALYZE)
+        flags |= TLSM_GLOB_PREFIX;
+    tlsm_glob_init(g, tlsm_rule_str(rs, r->subject_off), r->subject_len, flags, r->subject_idx);
+}
+
+static void tlsm_rule_object_glob(const struct tlsm_ruleset *rs, const struct tlsm_rule *r, struct tlsm_glob *g, u32 id)
+{
+    u8 flags = TLSM_GLOB_ANCHORED | TLSM_GLOB_PREFIX;
+
+    // analyze rules, rules without object and "any" match every object
+    if (tlsm_rule_any_object(r))
+    {
+        tlsm_glob_init(g, "", 0, flags, id);
+        return;
+    }
+
+    // plain objects are substrings of paths for open, prefixes otherwise
+    if (r->flags & TLSM_RULE_OBJECT_GLOB)
+        flags = TLSM_GLOB_ANCHORED;
+    else if (r->op == TLSM_FILE_OPEN)
+        flags = TLSM_GLOB_PREFIX;
+    tlsm_glob_init(g, tlsm_rule_str(rs, r->object_off), r->object_len, flags, id);
+}
+
+/* Compiling */
+
+/**
+ * tlsm_ruleset_bytes - bytes needed after the ruleset header for rules, ports and strings
+ *
+ * strings counts each string with its NUL, the subjects of consecutive rules may share one.
+ */
+size_t tlsm_ruleset_bytes(u32 count, u32 nports, size_t strings)
+{
+    return count * sizeof(struct tlsm_rule) + nports * sizeof(struct tlsm_port_range) + strings;
+}
+
+/**
+ * tlsm_ruleset_init - empty a ruleset, with room for count rules and nports port ranges
+ *
+ * Its size and DFAs are left alone, the DFAs must be freed or rebuilt after the rules are added.
+ */
+void tlsm_ruleset_init(struct tlsm_ruleset *rs, u32 count, u32 nports)
+{
+    rs->count = 0;
+    rs->dead = 0;
+    rs->nsubjects = 0;
+    rs->ports = (struct tlsm_port_range *)(rs->rules + count);
+    rs->strings = (char *)(rs->ports + nports);
+    rs->ports_used = 0;
+    rs->strings_used = 0;
+}
+
+static u32 tlsm_ruleset_add_str(struct tlsm_ruleset *rs, const char *s, u32 len)
+{
+    u32 off = rs->strings_used;
+
+    memcpy(rs->strings + off, s, len);
+    rs->strings[off + len] = '\0';
+    rs->strings_used += len + 1;
+    return off;
+}
+
+/**
+ * tlsm_ruleset_add - append the rule of a policy to a ruleset laid out by tlsm_ruleset_init()
+ *
+ * subject_id identifies the subject for exact matches, 0 to compare the strings instead.
+ */
+void tlsm_ruleset_add(struct tlsm_ruleset *rs, u64 id, u64 subject_id, const struct tlsm_rule_text *t)
+{
+    struct tlsm_rule *r = &rs->rules[rs->count];
+    const struct tlsm_rule *prev = rs->count ? r - 1 : NULL;
+    const struct tlsm_rule_options *o = &t->opts;
+
+    memset(r, 0, sizeof(*r));
+    r->id = id;
+    r->op = t->op;
+    r->category = t->category;
+    r->timeout_ms = o->timeout_ms;
+    r->fallback = o->fallback;
+
+    // policies of a program are usually next to each other, they share one copy of its path
+    if (prev && prev->subject_len == t->subject_len &&
+        memcmp(tlsm_rule_str(rs, prev->subject_off), t->subject, t->subject_len) == 0)
+        r->subject_off = prev->subject_off;
+    else
+        r->subject_off = tlsm_ruleset_add_str(rs, t->subject, t->subject_len);
+    // analyze rules match the exact path, others a prefix: not the same subject pattern
+    if (!prev || r->subject_off != prev->subject_off || (t->category == TLSM_ANALYZE) != (prev->category == TLSM_ANALYZE))
+        rs->nsubjects++;
+    r->subject_id = subject_id;
+    r->subject_idx = rs->nsubjects - 1;
+    r->subject_len = t->subject_len;
+    if (tlsm_glob_is_pattern(t->subject, t->subject_len))
+        r->flags |= TLSM_RULE_SUBJECT_GLOB;
+
+    if (t->object)
+    {
+        r->object_off = tlsm_ruleset_add_str(rs, t->object, t->object_len);
+        r->object_len = t->object_len;
+        if (t->op != TLSM_FILE_OPEN && strncmp(t->object, "any", t->object_len) == 0)
+            r->flags |= TLSM_RULE_ANY_OBJECT;
+        else if (tlsm_glob_is_pattern(t->object, t->object_len))
+            r->flags |= TLSM_RULE_OBJECT_GLOB;
+    }
+
+    if (t->category == TLSM_ANALYZE)
+    {
+        r->allow_above = o->allow_above;
+        r->deny_below = o->deny_below;
+        r->allow_delta = o->allow_delta;
+        r->deny_delta = o->deny_delta;
+    }
+    else if (t->op == TLSM_FILE_OPEN)
+    {
+        r->modes = o->modes;
+    }
+    else if (t->op == TLSM_SIGNAL)
+    {
+        r->sigmask = o->sigmask;
+        if (t->target)
+        {
+            r->target_off = tlsm_ruleset_add_str(rs, t->target, t->target_len);
+            r->target_len = t->target_len;
+        }
+    }
+    else if (tlsm_op_is_socket(t->op))
+    {
+        r->families = o->families;
+        r->protocols = o->protocols;
+        r->ports_off = rs->ports_used;
+        r->nports = o->nports;
+        memcpy(&rs->ports[rs->ports_used], o->ports, o->nports * sizeof(*o->ports));
+        rs->ports_used += o->nports;
+    }
+    rs->count++;
+}
+
+/**
+ * tlsm_ruleset_dfas - compile the subjects, and the objects of each operation, of a ruleset
+ *
+ * globs has room for one pattern per rule. A DFA that cannot be built is left NULL, as are
+ * the following ones: rules are then matched one by one (see tlsm_ruleset_match_slow()). Each
+ * pattern alone fits in a DFA, tlsm_pattern_check() made sure of it, but all of them together
+ * may not. scratch_words is set to the bitmap words tlsm_ruleset_match_dfa() needs.
+ * Return: 0 on success, the error of the DFA that could not be built otherwise
+ */
+int tlsm_ruleset_dfas(struct tlsm_ruleset *rs, struct tlsm_glob *globs, u32 max_states)
+{
+    int err = 0;
+    u32 n = 0;
+
+    for (u32 i = 0; i < rs->count; i++)
+    {
+        // rules of one subject are next to each other, and share its index
+        if (i && rs->rules[i].subject_idx == rs->rules[i - 1].subject_idx)
+            continue;
+        tlsm_rule_subject_glob(rs, &rs->rules[i], &globs[n++]);
+    }
+    rs->subjects = tlsm_dfa_build(globs, n, rs->nsubjects, max_states, &err);
+    if (!rs->subjects)
+        return err;
+    rs->scratch_words = rs->subjects->nwords + BITS_TO_LONGS(rs->count);
+
+    for (int op = 0; op < TLSM_OPS_LEN; op++)
+    {
+        if (op == TLSM_OP_UNDEFINED)
+            continue;
+
+        n = 0;
+        for (u32 i = 0; i < rs->count; i++)
+        {
+            if (rs->rules[i].category == TLSM_ANALYZE || rs->rules[i].op == op)
+                tlsm_rule_object_glob(rs, &rs->rules[i], &globs[n++], i);
+        }
+        rs->objects[op] = tlsm_dfa_build(globs, n, rs->count, max_states, &err);
+        if (!rs->objects[op])
+            return err;
+    }
+    return 0;
+}
+
+/* Matching */
+
+/**
+ * tlsm_rule_prefix - checks if a string of a ruleset is a prefix of a plain one
+ */
+static inline bool tlsm_rule_prefix(const struct tlsm_ruleset *rs, u32 off, u32 len, const char *str)
+{
+    return strncmp(str, tlsm_rule_str(rs, off), len) == 0;
+}
+
+/**
+ * tlsm_rule_net_match - check the family, protocol and port options of a socket rule
+ */
+static bool tlsm_rule_net_match(const struct tlsm_ruleset *rs, const struct tlsm_rule *r, const struct tlsm_rule_request *q)
+{
+    if (q->family < 0 || q->family >= AF_MAX || !(r->families & BIT_ULL(q->family)))
+        return false;
+
+    if (r->protocols != TLSM_PROTO_ANY && !(r->protocols & q->protocol))
+        return false;
+
+    // ports are only known for inet families
+    if (!r->nports || (q->family != AF_INET && q->family != AF_INET6))
+        return true;
+
+    const struct tlsm_port_range *ports = &rs->ports[r->ports_off];
+    for (int i = 0; i < r->nports; i++)
+    {
+        if (q->port >= ports[i].lo && q->port <= ports[i].hi)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * tlsm_rule_match_options - checks what a rule matches besides its subject and object
+ */
+static bool tlsm_rule_match_options(const struct tlsm_ruleset *rs, const struct tlsm_rule *r, const struct tlsm_rule_request *q)
+{
+    switch (r->op)
+    {
+    case TLSM_FILE_OPEN:
+        return r->modes & q->mode;
+    case TLSM_SIGNAL:
+        if (q->signal < 1 || q->signal > 64 || !(r->sigmask & BIT_ULL(q->signal - 1)))
+            return false;
+        if (!r->target_len)
+            return true;
+        return q->target && tlsm_rule_prefix(rs, r->target_off, r->target_len, q->target);
+    case TLSM_SOCKET_BIND:
+    case TLSM_SOCKET_CONNECT:
+    case TLSM_SOCKET_SEND:
+        return tlsm_rule_net_match(rs, r, q);
+    default:
+        return true;
+    }
+}
+
+/**
+ * tlsm_rule_match_names - checks the subject and object of a rule, without DFA
+ */
+static bool tlsm_rule_match_names(const struct tlsm_ruleset *rs, const struct tlsm_rule *r, const struct tlsm_rule_request *q)
+{
+    const char *object = q->object ? q->object : "";
+    struct tlsm_glob g;
+
+    if (r->flags & TLSM_RULE_SUBJECT_GLOB)
+    {
+        tlsm_rule_subject_glob(rs, r, &g);
+        if (!tlsm_glob_match(&g, q->subject))
+            return false;
+    }
+    else if (r->category == TLSM_ANALYZE)
+    {
+        // interned strings are equal if their serials are
+        if (r->subject_id && q->subject_id)
+            return r->subject_id == q->subject_id;
+        return strcmp(tlsm_rule_str(rs, r->subject_off), q->subject) == 0;
+    }
+    else if (!tlsm_rule_prefix(rs, r->subject_off, r->subject_len, q->subject))
+    {
+        return false;
+    }
+
+    if (tlsm_rule_any_object(r))
+        return true;
+    if (r->flags & TLSM_RULE_OBJECT_GLOB)
+    {
+        tlsm_rule_object_glob(rs, r, &g, 0);
+        return tlsm_glob_match(&g, object);
+    }
+    if (r->op == TLSM_FILE_OPEN)
+        return strstr(object, tlsm_rule_str(rs, r->object_off)) != NULL;
+    return tlsm_rule_prefix(rs, r->object_off, r->object_len, object);
+}
+
+/**
+ * tlsm_ruleset_match_slow - find the first rule that applies to a request, one rule at a time
+ */
+const struct tlsm_rule *tlsm_ruleset_match_slow(const struct tlsm_ruleset *rs, const struct tlsm_rule_request *q)
+{
+    for (const struct tlsm_rule *r = rs->rules; r < rs->rules + rs->count; r++)
+    {
+        if ((r->category != TLSM_ANALYZE && r->op != q->op) || (r->flags & TLSM_RULE_DEAD))
+            continue;
+        // options first, they are cheaper than any string comparison
+        if (r->category != TLSM_ANALYZE && !tlsm_rule_match_options(rs, r, q))
+            continue;
+        if (tlsm_rule_match_names(rs, r, q))
+            return r;
+    }
+    return NULL;
+}
+
+/**
+ * tlsm_ruleset_match_dfa - find the first rule that applies to a request, with the DFAs
+ *
+ * The subject and object DFAs give, in one pass each, the rules whose names match. Only those
+ * are looked at, in order. The DFAs of the operation must have been built; scratch holds
+ * scratch_words words, the subjects then the rules matched by the object are left in it.
+ * Return: the matching rule, NULL if no rule applies
+ */
+const struct tlsm_rule *tlsm_ruleset_match_dfa(const struct tlsm_ruleset *rs, const struct tlsm_rule_request *q, unsigned long *scratch)
+{
+    unsigned long *rules = scratch + rs->subjects->nwords;
+    unsigned int i;
+
+    memset(scratch, 0, rs->scratch_words * sizeof(unsigned long));
+    tlsm_dfa_run(rs->subjects, q->subject, scratch);
+    tlsm_dfa_run(rs->objects[q->op], q->object ? q->object : "", rules);
+
+    for_each_set_bit(i, rules, rs->count)
+    {
+        const struct tlsm_rule *r = &rs->rules[i];
+        if (!test_bit(r->subject_idx, scratch) || (r->flags & TLSM_RULE_DEAD))
+            continue;
+        if (r->category != TLSM_ANALYZE && !tlsm_rule_match_options(rs, r, q))
+            continue;
+        return r;
+    }
+    return NULL;
+}
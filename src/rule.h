@@ -0,0 +1,196 @@
+#ifndef _TLSM_RULE_H
+#define _TLSM_RULE_H
+
+/* policy rules: how they are parsed, the record they are compiled to and how it is matched.
+ * This file and rule.c only depend on common.h and glob.h, they also build in userspace
+ * (tools/replay matches captures with them). */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+typedef uint64_t u64;
+typedef int32_t s32;
+#define __percpu
+#endif
+
+#include "common.h"
+#include "glob.h"
+
+#define TLSM_MAX_WORDS 16 // words of a policy or a command, longer lines are rejected
+
+#define TLSM_POLICY_MAX_PORTS 8 // port ranges of a socket policy
+
+#define TLSM_FALLBACK_DEFAULT 0 // default_allow module parameter
+#define TLSM_FALLBACK_ALLOW 1
+#define TLSM_FALLBACK_DENY 2
+
+#define TLSM_PROTO_TCP 0x1
+#define TLSM_PROTO_UDP 0x2
+#define TLSM_PROTO_ANY 0xff
+
+#define TLSM_RULE_ANY_OBJECT 0x1   // object is a prefix of "any", matches every object (not for open)
+#define TLSM_RULE_SUBJECT_GLOB 0x2 // subject is a glob pattern (glob.h) instead of a prefix
+#define TLSM_RULE_OBJECT_GLOB 0x4  // object is a glob pattern instead of a substring or prefix
+#define TLSM_RULE_DEAD 0x8         // policy deleted since the ruleset was compiled, never matches
+
+/* words of a line split in place by str_split() */
+struct tlsm_words
+{
+    int count;
+    char *word[TLSM_MAX_WORDS];
+    u32 len[TLSM_MAX_WORDS];
+};
+
+struct tlsm_port_range
+{
+    u16 lo;
+    u16 hi; // inclusive
+};
+
+/* the "key=value" words following a policy */
+struct tlsm_rule_options
+{
+    // TLSM_FILE_OPEN options
+    u8 modes; // TLSM_MODE_* the policy applies to
+
+    // TLSM_SIGNAL options
+    u64 sigmask; // bit (n - 1) set for each signal n the policy applies to
+
+    // TLSM_SOCKET_BIND, TLSM_SOCKET_CONNECT and TLSM_SOCKET_SEND options
+    u64 families;                  // bit n set for each address family n the policy applies to
+    u8 protocols;                  // TLSM_PROTO_* mask
+    u16 nports;                    // 0 for any port
+    struct tlsm_port_range ports[TLSM_POLICY_MAX_PORTS]; // inet and inet6 only
+
+    // TLSM_ASK and TLSM_ANALYZE options
+    u32 timeout_ms; // how long to wait for tlsmd, 0 for request_timeout
+    u8 fallback;    // TLSM_FALLBACK_*, verdict if tlsmd does not answer
+
+    // TLSM_ANALYZE options, scores out of [deny_below, allow_above] are decided without tlsmd
+    unsigned int allow_above; // UINT_MAX if not given
+    unsigned int deny_below;  // 0 if not given
+    int allow_delta;          // score updates of these in-kernel verdicts
+    int deny_delta;
+};
+
+/* a policy as parsed by tlsm_rule_parse(), its strings point into the parsed line */
+struct tlsm_rule_text
+{
+    tlsm_category_t category;
+    tlsm_ops_t op;
+    const char *subject;
+    u32 subject_len;
+    const char *object; // NULL for operations without argument
+    u32 object_len;
+    const char *target; // TLSM_SIGNAL, prefix of the receiver's executable, NULL for any
+    u32 target_len;
+    struct tlsm_rule_options opts;
+};
+
+/* fixed size record of a policy, as scanned by the hooks */
+struct tlsm_rule
+{
+    u64 id;
+    u64 subject_id; // serial of the interned subject, for exact matches (0: compare the strings)
+    union
+    {
+        u64 sigmask;  // TLSM_SIGNAL
+        u64 families; // TLSM_SOCKET_BIND, TLSM_SOCKET_CONNECT, TLSM_SOCKET_SEND
+        struct        // TLSM_ANALYZE
+        {
+            u32 allow_above;
+            u32 deny_below;
+        };
+    };
+    u32 subject_off; // offsets in the string area
+    u32 subject_len;
+    u32 object_off;
+    u32 object_len;
+    union
+    {
+        struct // TLSM_SIGNAL
+        {
+            u32 target_off;
+            u32 target_len; // 0 for any receiver
+        };
+        struct // TLSM_ANALYZE
+        {
+            s32 allow_delta;
+            s32 deny_delta;
+        };
+    };
+    u32 ports_off;  // index in the port range area
+    u32 subject_idx; // index of the subject in the subject DFA
+    u32 timeout_ms;  // TLSM_ASK and TLSM_ANALYZE
+    u16 nports;
+    u8 op;
+    u8 category;
+    u8 protocols;
+    u8 flags;
+    u8 fallback; // TLSM_FALLBACK_*
+    u8 modes;    // TLSM_FILE_OPEN, TLSM_MODE_*
+};
+
+/* policies compiled into one allocation: rules, then port ranges, then strings */
+struct tlsm_ruleset
+{
+    size_t size; // bytes usable after the header
+    unsigned int count;
+    unsigned int dead; // TLSM_RULE_DEAD rules, dropped at the next compilation
+    struct tlsm_port_range *ports;
+    char *strings;
+    u32 ports_used; // filled by tlsm_ruleset_add()
+    u32 strings_used;
+
+    // every subject, and every object for each operation, in one pass (NULL: rule by rule)
+    u32 nsubjects;
+    struct tlsm_dfa *subjects;
+    struct tlsm_dfa *objects[TLSM_OPS_LEN];
+    unsigned long __percpu *scratch; // the subjects, then the rules, a match found on this CPU
+    u32 scratch_words;
+
+    struct tlsm_rule rules[];
+};
+
+/* what a ruleset is matched against, the parts of an access request rules can look at */
+struct tlsm_rule_request
+{
+    tlsm_ops_t op;
+    const char *subject; // executable path
+    u64 subject_id;      // serial of the interned subject, 0 to compare the strings
+    const char *object;  // NULL for operations without argument
+
+    // TLSM_FILE_OPEN
+    u8 mode; // TLSM_MODE_* to check
+
+    // TLSM_SIGNAL
+    int signal;
+    const char *target; // receiver's executable, NULL if unknown
+
+    // TLSM_SOCKET_BIND, TLSM_SOCKET_CONNECT and TLSM_SOCKET_SEND
+    int family; // -1 if the address is too short to hold one
+    u8 protocol; // TLSM_PROTO_* of the socket, 0 for others
+    u16 port;    // inet and inet6 only
+};
+
+int str_split(char *string, const char delimiter, struct tlsm_words *w);
+int tlsm_pattern_check(const char *s, u32 len, u32 max_states);
+int tlsm_rule_parse(char *rule, u32 max_states, struct tlsm_rule_text *t);
+
+size_t tlsm_ruleset_bytes(u32 count, u32 nports, size_t strings);
+void tlsm_ruleset_init(struct tlsm_ruleset *rs, u32 count, u32 nports);
+void tlsm_ruleset_add(struct tlsm_ruleset *rs, u64 id, u64 subject_id, const struct tlsm_rule_text *t);
+int tlsm_ruleset_dfas(struct tlsm_ruleset *rs, struct tlsm_glob *globs, u32 max_states);
+
+const struct tlsm_rule *tlsm_ruleset_match_slow(const struct tlsm_ruleset *rs, const struct tlsm_rule_request *q);
+const struct tlsm_rule *tlsm_ruleset_match_dfa(const struct tlsm_ruleset *rs, const struct tlsm_rule_request *q, unsigned long *scratch);
+
+static inline const char *tlsm_rule_str(const struct tlsm_ruleset *rs, u32 off)
+{
+    return rs->strings + off;
+}
+
+#endif // _TLSM_RULE_H
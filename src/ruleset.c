@@ -0,0 +1,241 @@
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "ruleset.h"
+#include "access.h"
+#include "mem.h"
+
+/**
+ * tlsm_ruleset_size - bytes needed after the ruleset header to compile a policy list
+ */
+static size_t tlsm_ruleset_size(struct plist *l, u32 *nports)
+{
+    size_t strings = 0;
+    struct tlsm_str *subject = NULL;
+
+    *nports = 0;
+    for (struct policy_node *n = l->head; n; n = n->next)
+    {
+        struct policy *p = n->policy;
+
+        // policies of a program are usually next to each other, they share one copy
+        if (p->subject != subject)
+            strings += p->subject->len + 1;
+        subject = p->subject;
+        if (p->object)
+            strings += p->object->len + 1;
+        if (p->target)
+            strings += p->target->len + 1;
+        *nports += p->opts.nports;
+    }
+    return tlsm_ruleset_bytes(l->count, *nports, strings);
+}
+
+static void tlsm_ruleset_account_dfa(const struct tlsm_dfa *dfa, int sign)
+{
+    if (dfa)
+        tlsm_mem_account(TLSM_MEM_DFA, sign, sign * (long)tlsm_dfa_size(dfa));
+}
+
+static void tlsm_ruleset_free_dfas(struct tlsm_ruleset *rs)
+{
+    if (rs->scratch)
+    {
+        tlsm_mem_account(TLSM_MEM_DFA, -1, -(long)(rs->scratch_words * sizeof(unsigned long) * num_possible_cpus()));
+        free_percpu(rs->scratch);
+        rs->scratch = NULL;
+    }
+    tlsm_ruleset_account_dfa(rs->subjects, -1);
+    tlsm_dfa_free(rs->subjects);
+    rs->subjects = NULL;
+    for (int op = 0; op < TLSM_OPS_LEN; op++)
+    {
+        tlsm_ruleset_account_dfa(rs->objects[op], -1);
+        tlsm_dfa_free(rs->objects[op]);
+        rs->objects[op] = NULL;
+    }
+}
+
+/**
+ * tlsm_ruleset_build_dfas - compile the names of a ruleset in DFAs (tlsm_ruleset_dfas())
+ *
+ * The bitmaps the DFAs fill are allocated here too, one set per CPU, matching never allocates.
+ * The DFAs are left NULL if they cannot be built, rules are then matched one by one.
+ */
+static void tlsm_ruleset_build_dfas(struct tlsm_ruleset *rs)
+{
+    struct tlsm_glob *globs;
+    int err;
+
+    tlsm_ruleset_free_dfas(rs);
+    if (!rs->count)
+        return;
+
+    globs = kvmalloc_array(rs->count, sizeof(*globs), GFP_KERNEL);
+    if (!globs)
+        return;
+
+    err = tlsm_ruleset_dfas(rs, globs, CONFIG_SECURITY_TLSM_DFA_MAX_STATES);
+    tlsm_ruleset_account_dfa(rs->subjects, 1);
+    for (int op = 0; op < TLSM_OPS_LEN; op++)
+        tlsm_ruleset_account_dfa(rs->objects[op], 1);
+
+    if (rs->subjects)
+    {
+        rs->scratch = __alloc_percpu(rs->scratch_words * sizeof(unsigned long), sizeof(unsigned long));
+        if (rs->scratch)
+        {
+            tlsm_mem_account(TLSM_MEM_DFA, 1, rs->scratch_words * sizeof(unsigned long) * num_possible_cpus());
+        }
+        else
+        {
+            err = -ENOMEM;
+            tlsm_ruleset_free_dfas(rs);
+        }
+    }
+
+    if (err)
+        printk(KERN_WARNING "[TLSM][WARNING] cannot compile the policies in DFAs (%d), matching them one by one", err);
+    kvfree(globs);
+}
+
+/**
+ * tlsm_ruleset_compile - rebuild the compiled form of a policy list after it changed
+ *
+ * Must be called with tlsm_policies_sem held for writing. A ruleset that is large enough is
+ * rewritten in place, its rules cannot fail to compile when policies were only removed. Its
+ * DFAs are built again, they are left NULL if that fails.
+ *
+ * Return: 0 on success, -ENOMEM if the ruleset had to grow and could not (it is left unchanged)
+ */
+int tlsm_ruleset_compile(struct plist *l)
+{
+    u32 nports;
+    size_t size = tlsm_ruleset_size(l, &nports);
+    struct tlsm_ruleset *rs = l->compiled;
+
+    if (!rs || rs->size < size)
+    {
+        rs = kvmalloc(struct_size(rs, rules, 0) + size, GFP_KERNEL);
+        if (!rs)
+            return -ENOMEM;
+        rs->size = size;
+        tlsm_mem_account(TLSM_MEM_RULESET, 1, struct_size(rs, rules, 0) + size);
+        rs->subjects = NULL;
+        memset(rs->objects, 0, sizeof(rs->objects));
+        rs->scratch = NULL;
+        tlsm_ruleset_free(l->compiled);
+        l->compiled = rs;
+    }
+
+    tlsm_ruleset_init(rs, l->count, nports);
+    for (struct policy_node *n = l->head; n; n = n->next)
+    {
+        struct policy *p = n->policy;
+        struct tlsm_rule_text t = {
+            .category = p->category,
+            .op = p->op,
+            .subject = p->subject->str,
+            .subject_len = p->subject->len,
+            .object = p->object ? p->object->str : NULL,
+            .object_len = p->object ? p->object->len : 0,
+            .target = p->target ? p->target->str : NULL,
+            .target_len = p->target ? p->target->len : 0,
+            .opts = p->opts,
+        };
+
+        tlsm_ruleset_add(rs, p->id, p->subject->serial, &t);
+    }
+
+    tlsm_ruleset_build_dfas(rs);
+    return 0;
+}
+
+/**
+ * tlsm_ruleset_kill - stop matching the rule of a deleted policy, without compiling the ruleset
+ *
+ * Must be called with tlsm_policies_sem held for writing. Rules are in the order of the list,
+ * whose ids only grow: the rule is found by bisection. Policies added since the ruleset was
+ * compiled have no rule, nothing is done for them.
+ */
+void tlsm_ruleset_kill(struct tlsm_ruleset *rs, u64 id)
+{
+    unsigned int lo = 0;
+    unsigned int hi = rs->count;
+
+    while (lo < hi)
+    {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if (rs->rules[mid].id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < rs->count && rs->rules[lo].id == id && !(rs->rules[lo].flags & TLSM_RULE_DEAD))
+    {
+        rs->rules[lo].flags |= TLSM_RULE_DEAD;
+        rs->dead++;
+    }
+}
+
+/**
+ * tlsm_ruleset_compact - compile a policy list again once most of its rules are dead
+ *
+ * Deleting a policy only kills its rule (tlsm_ruleset_kill()); the ruleset and its DFAs are
+ * rebuilt once more than half of the rules are dead, so that deletes cost a bisection each and
+ * a compilation every count / 2 of them. Adding policies compiles the list anyway.
+ * Must be called with tlsm_policies_sem held for writing.
+ * Return: true if the list was compiled again, the filters built from the policies should then
+ *         be too
+ */
+bool tlsm_ruleset_compact(struct plist *l)
+{
+    struct tlsm_ruleset *rs = l->compiled;
+
+    if (rs && rs->dead * 2 <= rs->count)
+        return false;
+    // never larger than the current ruleset, only an empty list without one can allocate
+    return tlsm_ruleset_compile(l) == 0;
+}
+
+void tlsm_ruleset_free(struct tlsm_ruleset *rs)
+{
+    if (!rs)
+        return;
+    tlsm_ruleset_free_dfas(rs);
+    tlsm_mem_account(TLSM_MEM_RULESET, -1, -(long)(struct_size(rs, rules, 0) + rs->size));
+    kvfree(rs);
+}
+
+/**
+ * tlsm_ruleset_match - find the first rule of a ruleset that applies to an access request
+ *
+ * With the DFAs of the operation, preemption is disabled while the bitmaps of the CPU are in
+ * use (tlsm_ruleset_match_dfa()). Without them, rules are matched one by one.
+ * Return: the matching rule, NULL if no rule applies
+ */
+const struct tlsm_rule *tlsm_ruleset_match(const struct tlsm_ruleset *rs, struct access *access_request, struct tlsm_str *exe)
+{
+    const struct tlsm_rule *res;
+    struct tlsm_rule_request q = {
+        .op = access_request->op,
+        .subject = exe->str,
+        .subject_id = exe->serial,
+        .object = access_request->object,
+        .mode = access_request->mode,
+        .signal = access_request->signal,
+        .target = access_request->target ? access_request->target->str : NULL,
+        .family = access_request->family,
+        .protocol = access_request->protocol,
+        .port = access_request->port,
+    };
+
+    if (!rs->subjects || !rs->objects[q.op])
+        return tlsm_ruleset_match_slow(rs, &q);
+
+    res = tlsm_ruleset_match_dfa(rs, &q, get_cpu_ptr(rs->scratch));
+    put_cpu_ptr(rs->scratch);
+    return res;
+}
@@ -0,0 +1,20 @@
+#ifndef _TLSM_RULESET_H
+#define _TLSM_RULESET_H
+
+#include <linux/types.h>
+
+#include "common.h"
+#include "tlsm.h"
+#include "rule.h"
+
+/* the compiled form of a policy list, the records and matching are in rule.h */
+
+struct access;
+
+int tlsm_ruleset_compile(struct plist *l);
+void tlsm_ruleset_kill(struct tlsm_ruleset *rs, u64 id);
+bool tlsm_ruleset_compact(struct plist *l);
+const struct tlsm_rule *tlsm_ruleset_match(const struct tlsm_ruleset *rs, struct access *access_request, struct tlsm_str *exe);
+void tlsm_ruleset_free(struct tlsm_ruleset *rs);
+
+#endif // _TLSM_RULESET_H
@@ -3,29 +3,58 @@
 
 #include <linux/errno.h>
 #include <linux/mm.h>
+#include <linux/rwsem.h>
+#include <linux/spinlock.h>
+#include <linux/hashtable.h>
 
 #include "common.h"
+#include "intern.h"
+#include "rule.h"
 
 struct policy
 {
+    u64 id; // stable identifier, assigned when the policy is added to a list
     tlsm_category_t category;
     tlsm_ops_t op;
-    char *subject;
-    char *object;
+    struct tlsm_str *subject; // interned, shared by every policy of the same program
+    struct tlsm_str *object;  // interned, NULL for operations without argument
 
-    unsigned long long hit_count;
+    struct tlsm_rule_options opts; // the "key=value" words following it (rule.h), but target=
+    struct tlsm_str *target;       // TLSM_SIGNAL, interned prefix of the receiver's executable, NULL for any
+    u8 fs_classes; // TLSM_FS_* (pseudofs.h) of the files the policy can match, also for analyze
+
+    atomic64_t hit_count;
 };
 
+#define TLSM_PLIST_ID_BITS 10
+#define TLSM_PLIST_SUBJECT_BITS 8
+
+struct tlsm_ruleset;
+
 struct plist
 {
     struct policy_node *head;
     struct policy_node *tail;
+    unsigned long long generation; // bumped on every change, lets readers detect stale cursors
+    unsigned long count;
+
+    // indexes over the same nodes, so deleting does not need to walk the list
+    DECLARE_HASHTABLE(by_id, TLSM_PLIST_ID_BITS);
+    DECLARE_HASHTABLE(by_subject, TLSM_PLIST_SUBJECT_BITS);
+    struct list_head by_op[TLSM_OPS_LEN];
+
+    struct tlsm_ruleset *compiled; // what the hooks scan, NULL when empty (see ruleset.h)
 };
 
 struct policy_node
 {
     struct policy_node *next;
+    struct policy_node *prev;
     struct policy *policy;
+
+    struct hlist_node id_node;
+    struct hlist_node subject_node;
+    struct list_head op_node;
 };
 
 struct tlsm_request
@@ -35,10 +64,20 @@ struct tlsm_request
     char *subject;
 };
 
+#define TLSM_WATCHDOG_MAX_RANGES 8 // uid ranges a watchdog can serve
+
+struct tlsm_uid_range
+{
+    u32 lo;
+    u32 hi; // inclusive
+};
+
 struct tlsm_watchdog
 {
-    int uid; // watchdog's owern user id
     int pid; // pid of wathdog process
+    bool system; // serves every user without a watchdog of its own
+    u16 nranges;
+    struct tlsm_uid_range uids[TLSM_WATCHDOG_MAX_RANGES]; // users it serves, if not system
     struct list_head node;
 };
 
@@ -60,10 +99,24 @@ struct tlsm_task_security
     unsigned int score;
 
     struct op_stat stats[TLSM_OPS_LEN];
+
+    struct tlsm_str __rcu *exe; // executable path, interned at execve and inherited on fork
 };
 
 extern struct plist *tlsm_policies; // linked list of active policies
+extern struct rw_semaphore tlsm_policies_sem; // protects tlsm_policies against concurrent changes
 extern struct list_head tlsm_watchdogs;
+extern spinlock_t tlsm_watchdogs_lock; // protects tlsm_watchdogs, hooks prune dead watchdogs
 extern int request_timeout; // timeout for interactive mode
+extern bool default_allow;  // verdict when no watchdog answers, unless the policy gives one
+extern unsigned int max_rules;            // policies of a list (global or cgroup), 0 for no limit
+extern unsigned int max_policy_memory_kb; // policy state, see tlsm_mem_policy_over_limit()
+extern unsigned int max_cgroup_sets;      // cgroups with policies, 0 for no limit
+extern unsigned int max_pending;             // pending ask/analyze requests, 0 for no limit
+extern unsigned int max_pending_per_uid;     // of a user, 0 for no limit
+extern unsigned int max_pending_per_subject; // of a program of a user, 0 for no limit
+extern int pending_overflow; // TLSM_OVERFLOW_* (fs.h), what happens to requests past these limits
+extern unsigned int capture_buffer_kb; // taken when a capture starts (capture.h)
+extern bool pseudofs_fastpath; // opens of anonymous files (kernel internal mounts) skip the policies when none can match
 
 #endif /* _TLSM_H */
\ No newline at end of file
@@ -0,0 +1,495 @@
+#include <kunit/test.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/socket.h>
+#include <linux/string.h>
+
+#include "tlsm.h"
+#include "utils.h"
+#include "access.h"
+#include "fs.h"
+#include "glob.h"
+#include "mem.h"
+#include "net.h"
+#include "pseudofs.h"
+#include "ruleset.h"
+#include "tlsm_kunit_cases.h"
+
+/* KUnit tests of the TLSM core, run with:
+ *   ./tools/testing/kunit/kunit.py run --kunitconfig=security/tlsm
+ * The tlsm_bench case prints the cost of a match for rulesets of 10 to 100k rules. */
+
+/**
+ * tlsm_test_parse - parse_policy() on a copy of a constant rule
+ */
+static struct policy *tlsm_test_parse(struct kunit *test, const char *rule)
+{
+    char *buf = kunit_kstrdup(test, rule, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, buf);
+    return parse_policy(buf);
+}
+
+static void tlsm_test_list_free(struct plist *l)
+{
+    down_write(&tlsm_policies_sem);
+    tlsm_plist_free(l);
+    up_write(&tlsm_policies_sem);
+}
+
+KUNIT_DEFINE_ACTION_WRAPPER(tlsm_test_list_release, tlsm_test_list_free, struct plist *);
+
+/**
+ * tlsm_test_list - build and compile a policy list, the rules must be valid
+ * The list is freed when the test ends. Nothing is asserted while tlsm_policies_sem is held: a
+ * failed assert would leave it locked for the next cases.
+ */
+static struct plist *tlsm_test_list(struct kunit *test, const char *const *rules, int n)
+{
+    struct plist *l = tlsm_plist_new();
+    KUNIT_ASSERT_NOT_NULL(test, l);
+    KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, tlsm_test_list_release, l), 0);
+
+    struct policy **policies = kunit_kcalloc(test, n, sizeof(*policies), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, policies);
+    int parsed = 0;
+    while (parsed < n && (policies[parsed] = tlsm_test_parse(test, rules[parsed])))
+        parsed++;
+
+    int added = 0, err = 0;
+    if (parsed == n)
+    {
+        down_write(&tlsm_policies_sem);
+        while (added < n && !(err = tlsm_plist_add(l, policies[added])))
+            added++;
+        if (!err)
+            err = tlsm_ruleset_compile(l);
+        up_write(&tlsm_policies_sem);
+    }
+
+    // the policies not in the list are still ours
+    for (int i = added; i < parsed; i++)
+        tlsm_policy_free(policies[i]);
+    KUNIT_ASSERT_EQ_MSG(test, parsed, n, "rule %s", parsed < n ? rules[parsed] : "");
+    KUNIT_ASSERT_EQ(test, err, 0);
+    return l;
+}
+
+/**
+ * tlsm_test_match - index of the rule matching an access in the list, -1 if none
+ * Both the DFA and the rule by rule paths are run, they must agree.
+ */
+static int tlsm_test_match(struct kunit *test, struct plist *l, const char *exe_path, struct access *a)
+{
+    struct tlsm_str *exe = tlsm_str_intern(exe_path, strlen(exe_path));
+    KUNIT_ASSERT_NOT_NULL(test, exe);
+    KUNIT_ASSERT_NOT_NULL(test, l->compiled);
+
+    down_write(&tlsm_policies_sem);
+    struct tlsm_ruleset *rs = l->compiled;
+    const struct tlsm_rule *r = tlsm_ruleset_match(rs, a, exe);
+
+    struct tlsm_dfa *subjects = rs->subjects;
+    rs->subjects = NULL; // forces the rule by rule path
+    const struct tlsm_rule *slow = tlsm_ruleset_match(rs, a, exe);
+    rs->subjects = subjects;
+    up_write(&tlsm_policies_sem);
+
+    tlsm_str_put(exe);
+    KUNIT_EXPECT_PTR_EQ_MSG(test, r, slow, "%s %s %s", exe_path, tlsm_ops2str(a->op), a->object);
+    return r ? r - rs->rules : -1;
+}
+
+static void tlsm_test_str_split(struct kunit *test)
+{
+    char words[] = "a  bc d\n";
+    char blank[] = "   ";
+    char empty[] = "";
+    char newline[] = "a\nb c\n";
+    char many[2 * TLSM_MAX_WORDS + 2];
+    struct tlsm_words w;
+
+    KUNIT_ASSERT_EQ(test, str_split(words, ' ', &w), 0);
+    KUNIT_ASSERT_EQ(test, w.count, 3);
+    KUNIT_EXPECT_STREQ(test, w.word[0], "a");
+    KUNIT_EXPECT_STREQ(test, w.word[1], "bc");
+    KUNIT_EXPECT_STREQ(test, w.word[2], "d");
+    KUNIT_EXPECT_EQ(test, w.len[1], 2);
+    KUNIT_EXPECT_PTR_EQ(test, w.word[1], words + 3); // in place
+
+    KUNIT_EXPECT_EQ(test, str_split(blank, ' ', &w), 0);
+    KUNIT_EXPECT_EQ(test, w.count, 0);
+    KUNIT_EXPECT_EQ(test, str_split(empty, ' ', &w), 0);
+    KUNIT_EXPECT_EQ(test, w.count, 0);
+
+    // only the trailing newline is dropped
+    KUNIT_ASSERT_EQ(test, str_split(newline, ' ', &w), 0);
+    KUNIT_ASSERT_EQ(test, w.count, 2);
+    KUNIT_EXPECT_STREQ(test, w.word[0], "a\nb");
+    KUNIT_EXPECT_STREQ(test, w.word[1], "c");
+    KUNIT_EXPECT_EQ(test, w.len[1], 1);
+
+    memset(many, ' ', sizeof(many) - 1);
+    many[sizeof(many) - 1] = '\0';
+    for (int i = 0; i <= TLSM_MAX_WORDS; i++)
+        many[2 * i] = 'x';
+    KUNIT_EXPECT_EQ(test, str_split(many, ' ', &w), -E2BIG);
+}
+
+static void tlsm_test_parse_policy(struct kunit *test)
+{
+    struct policy *p = tlsm_test_parse(test, "/usr/bin/cat allow open /etc/passwd\n");
+    KUNIT_ASSERT_NOT_NULL(test, p);
+    KUNIT_EXPECT_EQ(test, p->category, TLSM_ALLOW);
+    KUNIT_EXPECT_EQ(test, p->op, TLSM_FILE_OPEN);
+    KUNIT_EXPECT_STREQ(test, p->subject->str, "/usr/bin/cat");
+    KUNIT_EXPECT_STREQ(test, p->object->str, "/etc/passwd");
+    KUNIT_EXPECT_EQ(test, p->opts.sigmask, ~0ULL);
+    KUNIT_EXPECT_EQ(test, p->opts.modes, TLSM_MODE_ALL);
+    tlsm_policy_free(p);
+
+    p = tlsm_test_parse(test, "/usr/bin/cat deny open /etc/passwd mode=write,exec");
+    KUNIT_ASSERT_NOT_NULL(test, p);
+    KUNIT_EXPECT_EQ(test, p->opts.modes, TLSM_MODE_WRITE | TLSM_MODE_APPEND | TLSM_MODE_EXEC);
+    tlsm_policy_free(p);
+
+    p = tlsm_test_parse(test, "/usr/bin/kill deny signal sig=TERM,SIGHUP,9 target=/usr/bin/worker");
+    KUNIT_ASSERT_NOT_NULL(test, p);
+    KUNIT_EXPECT_EQ(test, p->opts.sigmask, BIT_ULL(14) | BIT_ULL(0) | BIT_ULL(8));
+    KUNIT_EXPECT_STREQ(test, p->target->str, "/usr/bin/worker");
+    KUNIT_EXPECT_NULL(test, p->object);
+    tlsm_policy_free(p);
+
+    p = tlsm_test_parse(test, "/usr/bin/nc deny connect any family=inet,inet6 proto=tcp port=22,1000-2000");
+    KUNIT_ASSERT_NOT_NULL(test, p);
+    KUNIT_EXPECT_EQ(test, p->opts.families, BIT_ULL(AF_INET) | BIT_ULL(AF_INET6));
+    KUNIT_EXPECT_EQ(test, p->opts.protocols, TLSM_PROTO_TCP);
+    KUNIT_ASSERT_EQ(test, p->opts.nports, 2);
+    KUNIT_EXPECT_EQ(test, p->opts.ports[1].lo, 1000);
+    KUNIT_EXPECT_EQ(test, p->opts.ports[1].hi, 2000);
+    tlsm_policy_free(p);
+
+    p = tlsm_test_parse(test, "/usr/bin/curl ask connect any timeout=500ms default=allow");
+    KUNIT_ASSERT_NOT_NULL(test, p);
+    KUNIT_EXPECT_EQ(test, p->opts.timeout_ms, 500);
+    KUNIT_EXPECT_EQ(test, p->opts.fallback, TLSM_FALLBACK_ALLOW);
+    tlsm_policy_free(p);
+
+    p = tlsm_test_parse(test, "/usr/bin/python analyze allow_above=80:-5 deny_below=20");
+    KUNIT_ASSERT_NOT_NULL(test, p);
+    KUNIT_EXPECT_EQ(test, p->op, TLSM_OP_UNDEFINED);
+    KUNIT_EXPECT_EQ(test, p->opts.allow_above, 80);
+    KUNIT_EXPECT_EQ(test, p->opts.allow_delta, -5);
+    KUNIT_EXPECT_EQ(test, p->opts.deny_below, 20);
+    tlsm_policy_free(p);
+
+    p = tlsm_test_parse(test, "/usr/bin/python analyze");
+    KUNIT_ASSERT_NOT_NULL(test, p);
+    KUNIT_EXPECT_EQ(test, p->opts.allow_above, UINT_MAX);
+    KUNIT_EXPECT_EQ(test, p->opts.deny_below, 0);
+    tlsm_policy_free(p);
+}
+
+static void tlsm_test_parse_policy_invalid(struct kunit *test)
+{
+    static const char *const invalid[] = {
+        "",
+        "/usr/bin/cat",
+        "/usr/bin/cat allow",
+        "/usr/bin/cat allow frobnicate /etc",
+        "/usr/bin/cat allow open",
+        "/usr/bin/cat allow open /etc bogus=1",
+        "/usr/bin/cat allow open /etc sig=TERM",
+        "/usr/bin/cat allow open /etc/[z-a]",
+        "/usr/bin/cat allow open /etc mode=rw",
+        "/usr/bin/cat allow execve /usr/bin/sh mode=read",
+        "/usr/bin/kill deny signal sig=NOTASIGNAL",
+        "/usr/bin/nc deny bind any port=2000-1000",
+        "/usr/bin/nc deny bind any proto=sctp",
+        "/usr/bin/nc deny bind any port=1,2,3,4,5,6,7,8,9",
+        "/usr/bin/cat allow open /etc timeout=1s",
+        "/usr/bin/cat ask open /etc timeout=0",
+        "/usr/bin/cat ask open /etc default=maybe",
+        "/usr/bin/cat ask open /etc allow_above=10",
+        "/usr/bin/python analyze deny_below=x",
+    };
+
+    for (int i = 0; i < ARRAY_SIZE(invalid); i++)
+        KUNIT_EXPECT_NULL_MSG(test, tlsm_test_parse(test, invalid[i]), "rule \"%s\"", invalid[i]);
+}
+
+static void tlsm_test_parse_answer(struct kunit *test)
+{
+    char allow[] = "allow -5";
+    char deny[] = "deny 3\n";
+    char short_answer[] = "allow";
+    char bad_delta[] = "allow x";
+    char empty[] = "";
+
+    struct fs_answer *a = parse_answer(allow);
+    KUNIT_ASSERT_NOT_NULL(test, a);
+    KUNIT_EXPECT_EQ(test, a->allow, TLSM_REQ_ALLOW);
+    KUNIT_EXPECT_EQ(test, a->score_delta, -5);
+    tlsm_mem_free(TLSM_MEM_ANSWER, a);
+
+    a = parse_answer(deny);
+    KUNIT_ASSERT_NOT_NULL(test, a);
+    KUNIT_EXPECT_EQ(test, a->allow, TLSM_REQ_DENY);
+    KUNIT_EXPECT_EQ(test, a->score_delta, 3);
+    tlsm_mem_free(TLSM_MEM_ANSWER, a);
+
+    KUNIT_EXPECT_NULL(test, parse_answer(short_answer));
+    KUNIT_EXPECT_NULL(test, parse_answer(bad_delta));
+    KUNIT_EXPECT_NULL(test, parse_answer(empty));
+}
+
+static void tlsm_test_score_update(struct kunit *test)
+{
+    unsigned int score = 100;
+
+    score_update(&score, -5);
+    KUNIT_EXPECT_EQ(test, score, 95);
+    score_update(&score, 10);
+    KUNIT_EXPECT_EQ(test, score, 105);
+    score_update(&score, -200); // clamped
+    KUNIT_EXPECT_EQ(test, score, 0);
+    score = UINT_MAX - 1;
+    score_update(&score, 5); // would overflow, unchanged
+    KUNIT_EXPECT_EQ(test, score, UINT_MAX - 1);
+}
+
+static void tlsm_test_plist(struct kunit *test)
+{
+    static const char *const rules[] = {
+        "/usr/bin/cat allow open /etc",
+        "/usr/bin/cat deny execve /usr/bin/sh",
+        "/usr/bin/nc deny connect any",
+        "/usr/bin/nc deny bind any",
+    };
+    struct plist *l = tlsm_test_list(test, rules, ARRAY_SIZE(rules));
+    KUNIT_EXPECT_EQ(test, l->count, 4);
+    KUNIT_EXPECT_EQ(test, l->compiled->count, 4);
+
+    u64 first = l->head->policy->id;
+    KUNIT_EXPECT_PTR_EQ(test, tlsm_plist_find(l, first), l->head);
+    KUNIT_EXPECT_EQ(test, l->tail->policy->id, first + 3);
+
+    down_write(&tlsm_policies_sem);
+    KUNIT_EXPECT_EQ(test, tlsm_plist_del(l, first), 0);
+    KUNIT_EXPECT_EQ(test, tlsm_plist_del(l, first), -1);
+    KUNIT_EXPECT_NULL(test, tlsm_plist_find(l, first));
+    KUNIT_EXPECT_EQ(test, tlsm_plist_del_op(l, TLSM_SOCKET_BIND), 1);
+    KUNIT_EXPECT_EQ(test, tlsm_plist_del_subject(l, "/usr/bin/nc"), 1);
+    KUNIT_EXPECT_EQ(test, tlsm_plist_del_subject(l, "/usr/bin/none"), 0);
+    KUNIT_EXPECT_EQ(test, l->count, 1);
+    KUNIT_EXPECT_PTR_EQ(test, l->head, l->tail);
+    KUNIT_EXPECT_EQ(test, l->head->policy->op, TLSM_EXECVE);
+    // deleting only kills the rules, until most of them are dead
+    KUNIT_EXPECT_EQ(test, l->compiled->count, 4);
+    KUNIT_EXPECT_EQ(test, l->compiled->dead, 3);
+    up_write(&tlsm_policies_sem);
+
+    struct access a = { .op = TLSM_FILE_OPEN, .mode = TLSM_MODE_READ, .object = "/etc/passwd" };
+    KUNIT_EXPECT_EQ(test, tlsm_test_match(test, l, "/usr/bin/cat", &a), -1);
+    struct access exec = { .op = TLSM_EXECVE, .object = "/usr/bin/sh" };
+    KUNIT_EXPECT_EQ(test, tlsm_test_match(test, l, "/usr/bin/cat", &exec), 1);
+
+    down_write(&tlsm_policies_sem);
+    KUNIT_EXPECT_TRUE(test, tlsm_ruleset_compact(l));
+    KUNIT_EXPECT_EQ(test, l->compiled->count, 1);
+    KUNIT_EXPECT_EQ(test, l->compiled->dead, 0);
+    KUNIT_EXPECT_FALSE(test, tlsm_ruleset_compact(l));
+    up_write(&tlsm_policies_sem);
+}
+
+static void tlsm_match_set_desc(const struct tlsm_match_set *set, char *desc)
+{
+    snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%s", set->name);
+}
+
+KUNIT_ARRAY_PARAM(tlsm_match_sets, tlsm_match_sets, tlsm_match_set_desc);
+
+/**
+ * tlsm_test_match_cases - the rule each request of a set matches (tlsm_kunit_cases.h)
+ * tools/replay/replay-test runs the same cases against tlsm-replay.
+ */
+static void tlsm_test_match_cases(struct kunit *test)
+{
+    const struct tlsm_match_set *set = test->param_value;
+    struct plist *l = tlsm_test_list(test, set->rules, set->nrules);
+
+    for (int i = 0; i < set->ncases; i++)
+    {
+        const struct tlsm_match_case *c = &set->cases[i];
+        struct access a = { .op = c->op, .object = (char *)c->object, .mode = c->mode, .signal = c->signal,
+                            .family = c->family, .protocol = c->protocol, .port = c->port };
+
+        if (c->op == TLSM_SIGNAL)
+        {
+            a.target = tlsm_str_intern(c->object, strlen(c->object));
+            KUNIT_ASSERT_NOT_NULL(test, a.target);
+        }
+        KUNIT_EXPECT_EQ_MSG(test, tlsm_test_match(test, l, c->subject, &a), c->rule,
+                            "%s %s %s", c->subject, tlsm_ops2str(c->op), c->object);
+        tlsm_str_put(a.target);
+    }
+}
+
+static void tlsm_test_glob(struct kunit *test)
+{
+    static const struct
+    {
+        const char *pat;
+        const char *str;
+        u8 flags;
+        bool match;
+    } cases[] = {
+        {"/usr/bin/*", "/usr/bin/ls", TLSM_GLOB_ANCHORED, true},
+        {"/usr/bin/*", "/usr/bin/x/ls", TLSM_GLOB_ANCHORED, false},
+        {"/usr/**/ls", "/usr/local/bin/ls", TLSM_GLOB_ANCHORED, true},
+        {"/tmp/?", "/tmp/a", TLSM_GLOB_ANCHORED, true},
+        {"/tmp/?", "/tmp/ab", TLSM_GLOB_ANCHORED, false},
+        {"/tmp/?", "/tmp/ab", TLSM_GLOB_ANCHORED | TLSM_GLOB_PREFIX, true},
+        {"[a-c]x", "/dev/bx", 0, true}, // unanchored: a suffix of the string
+        {"[!a-c]x", "/dev/bx", 0, false},
+        {"[a-c]x", "/dev/bxy", 0, false},
+        {"\\*", "a*b", TLSM_GLOB_PREFIX, true}, // unanchored prefix: anywhere in the string
+        {"\\*", "ab", TLSM_GLOB_PREFIX, false},
+        {"/etc[", "/etc[", TLSM_GLOB_ANCHORED, true}, // unclosed class, a plain '['
+    };
+
+    for (int i = 0; i < ARRAY_SIZE(cases); i++)
+    {
+        struct tlsm_glob g;
+        KUNIT_ASSERT_TRUE(test, tlsm_glob_valid(cases[i].pat, strlen(cases[i].pat)));
+        tlsm_glob_init(&g, cases[i].pat, strlen(cases[i].pat), cases[i].flags, 0);
+        KUNIT_EXPECT_EQ_MSG(test, tlsm_glob_match(&g, cases[i].str), cases[i].match,
+                            "%s on %s", cases[i].pat, cases[i].str);
+    }
+    KUNIT_EXPECT_FALSE(test, tlsm_glob_valid("[z-a]", 5));
+
+    char *long_pat = kunit_kzalloc(test, TLSM_GLOB_MAX_LEN + 2, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, long_pat);
+    memset(long_pat, 'a', TLSM_GLOB_MAX_LEN + 1);
+    KUNIT_EXPECT_FALSE(test, tlsm_glob_valid(long_pat, TLSM_GLOB_MAX_LEN + 1));
+}
+
+static void tlsm_test_pseudofs_classes(struct kunit *test)
+{
+    static const struct
+    {
+        const char *rule;
+        u8 classes;
+    } cases[] = {
+        {"/usr/bin/cat deny open any", TLSM_FS_ALL},     // not a wildcard for open, but part of any name
+        {"/usr/bin/cat deny open passwd", TLSM_FS_ALL},  // part of any name, "pipe:[42]" too
+        {"/usr/bin/cat deny open **/passwd", TLSM_FS_ALL}, // no literal directory
+        {"/usr/bin/cat deny open /*", TLSM_FS_ALL},
+        {"/usr/bin/cat deny open /", TLSM_FS_ALL},
+        {"/usr/bin/cat deny open /memfd:secret", TLSM_FS_ALL},
+        {"/usr/bin/cat deny open /memfd:x/y", TLSM_FS_ALL},
+        {"/usr/bin/cat deny open /etc/passwd", 0},
+        {"/usr/bin/cat deny open /usr/lib/*.so", 0},
+        {"/usr/bin/python analyze", TLSM_FS_ALL},
+        {"/usr/bin/nc deny connect any", 0},
+        {"/usr/bin/kill deny signal sig=TERM", 0},
+    };
+
+    for (int i = 0; i < ARRAY_SIZE(cases); i++)
+    {
+        struct policy *p = tlsm_test_parse(test, cases[i].rule);
+        KUNIT_ASSERT_NOT_NULL_MSG(test, p, "%s", cases[i].rule);
+        KUNIT_EXPECT_EQ_MSG(test, p->fs_classes, cases[i].classes, "%s", cases[i].rule);
+        tlsm_policy_free(p);
+    }
+}
+
+static const unsigned int tlsm_bench_sizes[] = {10, 100, 1000, 10000, 100000};
+
+static void tlsm_bench_desc(const unsigned int *size, char *desc)
+{
+    snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%u rules", *size);
+}
+
+KUNIT_ARRAY_PARAM(tlsm_bench, tlsm_bench_sizes, tlsm_bench_desc);
+
+/**
+ * tlsm_bench_ns - average cost of a match, in ns
+ */
+static u64 tlsm_bench_ns(struct plist *l, struct tlsm_str *exe, struct access *a, unsigned int iters)
+{
+    down_read(&tlsm_policies_sem);
+    u64 start = ktime_get_ns();
+    for (unsigned int i = 0; i < iters; i++)
+        tlsm_ruleset_match(l->compiled, a, exe);
+    u64 elapsed = ktime_get_ns() - start;
+    up_read(&tlsm_policies_sem);
+    return elapsed / iters;
+}
+
+static void tlsm_bench(struct kunit *test)
+{
+    const unsigned int n = *(const unsigned int *)test->param_value;
+    struct plist *l = tlsm_plist_new();
+    char rule[64];
+    KUNIT_ASSERT_NOT_NULL(test, l);
+
+    // one program per rule, the usual shape of a large policy file
+    down_write(&tlsm_policies_sem);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        snprintf(rule, sizeof(rule), "/bench/bin/p%u allow open /bench/data/%u", i, i);
+        struct policy *p = parse_policy(rule);
+        if (!p || tlsm_plist_add(l, p) != 0)
+        {
+            tlsm_policy_free(p);
+            up_write(&tlsm_policies_sem);
+            tlsm_test_list_free(l);
+            KUNIT_FAIL(test, "cannot add rule %u", i);
+            return;
+        }
+    }
+    u64 start = ktime_get_ns();
+    KUNIT_EXPECT_EQ(test, tlsm_ruleset_compile(l), 0);
+    u64 compile_ns = ktime_get_ns() - start;
+    up_write(&tlsm_policies_sem);
+
+    unsigned int iters = clamp(1000000 / n, 100U, 100000U);
+    snprintf(rule, sizeof(rule), "/bench/bin/p%u", n - 1);
+    struct tlsm_str *last = tlsm_str_intern(rule, strlen(rule));
+    struct tlsm_str *other = tlsm_str_intern("/usr/bin/none", 13);
+    snprintf(rule, sizeof(rule), "/bench/data/%u", n - 1);
+    struct access a = { .op = TLSM_FILE_OPEN, .mode = TLSM_MODE_READ, .object = rule };
+
+    if (last && other)
+    {
+        u64 miss = tlsm_bench_ns(l, other, &a, iters);
+        u64 hit = tlsm_bench_ns(l, last, &a, iters);
+        kunit_info(test, "%u rules (%s): compiled in %llu us, %llu ns per miss, %llu ns per match of the last rule",
+                   n, l->compiled->subjects ? "dfa" : "rule by rule", compile_ns / 1000, miss, hit);
+    }
+
+    tlsm_str_put(last);
+    tlsm_str_put(other);
+    tlsm_test_list_free(l);
+}
+
+static struct kunit_case tlsm_test_cases[] = {
+    KUNIT_CASE(tlsm_test_str_split),
+    KUNIT_CASE(tlsm_test_parse_policy),
+    KUNIT_CASE(tlsm_test_parse_policy_invalid),
+    KUNIT_CASE(tlsm_test_parse_answer),
+    KUNIT_CASE(tlsm_test_score_update),
+    KUNIT_CASE(tlsm_test_plist),
+    KUNIT_CASE_PARAM(tlsm_test_match_cases, tlsm_match_sets_gen_params),
+    KUNIT_CASE(tlsm_test_glob),
+    KUNIT_CASE(tlsm_test_pseudofs_classes),
+    KUNIT_CASE_PARAM_ATTR(tlsm_bench, tlsm_bench_gen_params, {.speed = KUNIT_SPEED_SLOW}),
+    {}
+};
+
+static struct kunit_suite tlsm_test_suite = {
+    .name = "tlsm",
+    .test_cases = tlsm_test_cases,
+};
+
+kunit_test_suite(tlsm_test_suite);
@@ -0,0 +1,112 @@
+#ifndef _TLSM_KUNIT_CASES_H
+#define _TLSM_KUNIT_CASES_H
+
+/* rulesets and the rule each request must match, checked in the kernel by the KUnit suite and
+ * against tools/replay by replay-test. Like rule.h, this file also builds in userspace. */
+
+#ifdef __KERNEL__
+#include <linux/socket.h>
+#else
+#include <sys/socket.h>
+#endif
+
+#include "rule.h"
+
+struct tlsm_match_case
+{
+    const char *subject; // executable
+    tlsm_ops_t op;
+    const char *object;  // for TLSM_SIGNAL, the receiver's executable
+    u8 mode;             // TLSM_FILE_OPEN
+    int signal;          // TLSM_SIGNAL, the object is then its target
+    int family;          // sockets
+    u8 protocol;
+    u16 port;
+    int rule; // index of the first rule applying to the request, -1 for none
+};
+
+struct tlsm_match_set
+{
+    const char *name;
+    const char *const *rules;
+    int nrules;
+    const struct tlsm_match_case *cases;
+    int ncases;
+};
+
+#define TLSM_MATCH_SET(set) \
+    {#set, tlsm_##set##_rules, sizeof(tlsm_##set##_rules) / sizeof(tlsm_##set##_rules[0]), \
+     tlsm_##set##_cases, sizeof(tlsm_##set##_cases) / sizeof(tlsm_##set##_cases[0])}
+
+static const char *const tlsm_match_rules_rules[] = {
+    "/usr/bin/cat deny open /etc/shadow",                        // 0
+    "/usr/bin/cat allow open /etc/",                             // 1
+    "/usr/bin/*sh deny open /home/*/.ssh/**",                    // 2
+    "/usr/bin/kill deny signal sig=TERM target=/usr/bin/worker", // 3
+    "/usr/bin/nc deny connect 10.0.0. proto=tcp port=22",        // 4
+    "/usr/bin/nc allow connect any",                             // 5
+    "/usr/bin/python3 analyze",                                  // 6
+    "/usr/bin/dig deny send any proto=udp port=53",              // 7
+};
+
+static const struct tlsm_match_case tlsm_match_rules_cases[] = {
+    {"/usr/bin/cat", TLSM_FILE_OPEN, "/etc/shadow", .mode = TLSM_MODE_READ, .rule = 0}, // first match wins
+    {"/usr/bin/cat", TLSM_FILE_OPEN, "/etc/passwd", .mode = TLSM_MODE_READ, .rule = 1},
+    {"/usr/bin/cat", TLSM_FILE_OPEN, "/tmp/etc/passwd", .mode = TLSM_MODE_READ, .rule = 1}, // open objects match anywhere in the path
+    {"/usr/bin/bash", TLSM_FILE_OPEN, "/home/user/.ssh/id_ed25519", .mode = TLSM_MODE_READ, .rule = 2},
+    {"/usr/bin/sh", TLSM_FILE_OPEN, "/home/user/.ssh/id_ed25519", .mode = TLSM_MODE_READ, .rule = 2},
+    {"/usr/bin/local/sh", TLSM_FILE_OPEN, "/home/user/.ssh/id_ed25519", .mode = TLSM_MODE_READ, .rule = -1}, // '*' stops at '/'
+    {"/usr/bin/bash", TLSM_FILE_OPEN, "/home/user/x/.ssh/id_ed25519", .mode = TLSM_MODE_READ, .rule = -1},
+    {"/usr/bin/kill", TLSM_SIGNAL, "/usr/bin/worker", .signal = 15, .rule = 3},
+    {"/usr/bin/kill", TLSM_SIGNAL, "/usr/bin/worker", .signal = 9, .rule = -1},
+    {"/usr/bin/nc", TLSM_SOCKET_CONNECT, "10.0.0.1", .family = AF_INET, .protocol = TLSM_PROTO_TCP, .port = 22, .rule = 4},
+    {"/usr/bin/nc", TLSM_SOCKET_CONNECT, "10.0.0.1", .family = AF_INET, .protocol = TLSM_PROTO_TCP, .port = 80, .rule = 5},
+    // send rules only take sendmsg() destinations, not connect()
+    {"/usr/bin/dig", TLSM_SOCKET_SEND, "9.9.9.9", .family = AF_INET, .protocol = TLSM_PROTO_UDP, .port = 53, .rule = 7},
+    {"/usr/bin/dig", TLSM_SOCKET_CONNECT, "9.9.9.9", .family = AF_INET, .protocol = TLSM_PROTO_UDP, .port = 53, .rule = -1},
+    // analyze rules take every operation of their exact subject
+    {"/usr/bin/python3", TLSM_SOCKET_CONNECT, "10.0.0.1", .family = AF_INET, .protocol = TLSM_PROTO_TCP, .port = 80, .rule = 6},
+    {"/usr/bin/python3.14", TLSM_SOCKET_CONNECT, "10.0.0.1", .family = AF_INET, .protocol = TLSM_PROTO_TCP, .port = 80, .rule = -1},
+};
+
+static const char *const tlsm_match_any_rules[] = {
+    "/usr/bin/cat deny open a",    // 0
+    "/usr/bin/less deny open an",  // 1
+    "/usr/bin/more deny open any", // 2
+    "/usr/bin/nc deny connect an", // 3
+};
+
+static const struct tlsm_match_case tlsm_match_any_cases[] = {
+    // open objects are substrings, prefixes of "any" are not wildcards for them
+    {"/usr/bin/cat", TLSM_FILE_OPEN, "/etc/hosts", .mode = TLSM_MODE_READ, .rule = -1},
+    {"/usr/bin/less", TLSM_FILE_OPEN, "/etc/passwd", .mode = TLSM_MODE_READ, .rule = -1},
+    {"/usr/bin/more", TLSM_FILE_OPEN, "/etc/passwd", .mode = TLSM_MODE_READ, .rule = -1},
+    {"/usr/bin/less", TLSM_FILE_OPEN, "/home/anyone/notes", .mode = TLSM_MODE_READ, .rule = 1},
+    {"/usr/bin/more", TLSM_FILE_OPEN, "/home/anyone/notes", .mode = TLSM_MODE_READ, .rule = 2},
+    // other operations keep "any" and its prefixes as every object
+    {"/usr/bin/nc", TLSM_SOCKET_CONNECT, "10.0.0.1", .family = AF_INET, .protocol = TLSM_PROTO_TCP, .port = 22, .rule = 3},
+};
+
+static const char *const tlsm_match_modes_rules[] = {
+    "/usr/bin/logger allow open /var/log/ mode=append", // 0
+    "/usr/bin/logger deny open /var/log/ mode=write",   // 1
+    "/usr/bin/logger deny open /var/log/ mode=exec",    // 2
+    "/usr/bin/logger allow open /var/log/",             // 3
+};
+
+static const struct tlsm_match_case tlsm_match_modes_cases[] = {
+    {"/usr/bin/logger", TLSM_FILE_OPEN, "/var/log/messages", .mode = TLSM_MODE_APPEND, .rule = 0},
+    {"/usr/bin/logger", TLSM_FILE_OPEN, "/var/log/messages", .mode = TLSM_MODE_WRITE, .rule = 1},
+    {"/usr/bin/logger", TLSM_FILE_OPEN, "/var/log/messages", .mode = TLSM_MODE_EXEC, .rule = 2},
+    {"/usr/bin/logger", TLSM_FILE_OPEN, "/var/log/messages", .mode = TLSM_MODE_READ, .rule = 3},
+    // several modes at once: the first policy for any of them
+    {"/usr/bin/logger", TLSM_FILE_OPEN, "/var/log/messages", .mode = TLSM_MODE_READ | TLSM_MODE_EXEC, .rule = 2},
+};
+
+static const struct tlsm_match_set tlsm_match_sets[] = {
+    TLSM_MATCH_SET(match_rules),
+    TLSM_MATCH_SET(match_any),
+    TLSM_MATCH_SET(match_modes),
+};
+
+#endif // _TLSM_KUNIT_CASES_H
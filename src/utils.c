@@ -3,262 +3,139 @@
 #include <linux/signal_types.h>
 #include <linux/file.h>
 #include <linux/limits.h>
+#include <linux/hashtable.h>
+#include <linux/capability.h>
+#include <linux/cred.h>
 
 #include "utils.h"
 #include "common.h"
 #include "tlsm.h"
 #include "fs.h"
+#include "cgroups.h"
+#include "net.h"
+#include "mem.h"
+#include "ruleset.h"
+#include "pseudofs.h"
 
 /**
- * strip - get a substring from string string[start, end]
- *
- * Return: the substring
- */
-static char *str_strip(char *string, int start, int end)
-{ 
-    if (!string || start < 0 || start > end)
-        return NULL;
-
-    size_t string_size = strlen(string);
-    if (start > string_size)
-        return NULL;
-
-    if (end > string_size)
-        end = string_size;
-
-    size_t len = (end - start);
-    char *res = (char *)kzalloc(len + 1, GFP_KERNEL);
-
-    if (!res)
-        return NULL;
-
-    memcpy(res, string + start, len);
-    res[len] = '\0';
-
-    return res;
-}
-
-/**
- * str_split - split a strint according to a token
+ * parse_policy - Parse a tlsm policy
  *
- * Return: a list of string
+ * Return: the parsed policy in newly *allocated memory*
+ *         NULL on failure
  */
-char **str_split(char *string, const char delimiter, int *out_count)
+struct policy *parse_policy(char *rule)
 {
-    if (!string || !out_count)
-        return NULL;
-
-    // Remove trailing '\n'
-    int len = strlen(string);
-    if (*(string + len - 1) == '\n')
-        *(string + len - 1) = '\0';
-
-    char **res = 0;
-    size_t i = 0;
-    int count = 0;
-    ssize_t last_delim = -1;
-    char *tmp = string;
-
-    while (*tmp)
-    {
-        if (*tmp == delimiter)
-        {
-            if (last_delim != i - 1)
-            {
-                count++;
-            }
-            last_delim = i;
-        }
-        tmp++;
-        i++;
-    }
-
-    if (last_delim != i - 1)
-    {
-        count++;
-    }
-
-    *out_count = count;
+    struct tlsm_rule_text t;
 
-    if (count == 0)
+    if (tlsm_rule_parse(rule, CONFIG_SECURITY_TLSM_DFA_MAX_STATES, &t) != 0)
         return NULL;
 
-    res = kcalloc(count, sizeof(char *), GFP_KERNEL);
-
-    if (!res)
+    // a single object, only the interned strings are shared with other policies
+    struct policy *new_policy = tlsm_mem_alloc(TLSM_MEM_POLICY);
+    if (!new_policy)
         return NULL;
 
-    char **res_cpy = res;
-    char *word = NULL;
-    i = 0;
-    tmp = string;
-    last_delim = -1;
-    while (*tmp)
+    new_policy->category = t.category;
+    new_policy->op = t.op;
+    new_policy->opts = t.opts;
+    new_policy->subject = tlsm_str_policy_intern(t.subject, t.subject_len);
+    if (!new_policy->subject)
+        goto parse_policy_fail;
+    if (t.object)
     {
-        if (*tmp == delimiter)
-        {
-            if (last_delim != i - 1)
-            {
-                word = str_strip(string, last_delim + 1, i);
-                if (!word)
-                    goto strip_fail;
-                *res_cpy++ = word;
-            }
-            last_delim = i;
-        }
-        tmp++;
-        i++;
+        new_policy->object = tlsm_str_policy_intern(t.object, t.object_len);
+        if (!new_policy->object)
+            goto parse_policy_fail;
     }
-    if (last_delim != i - 1)
+    if (t.target)
     {
-        word = str_strip(string, last_delim + 1, i);
-        if (!word)
-            goto strip_fail;
-        *res_cpy = word;
+        new_policy->target = tlsm_str_policy_intern(t.target, t.target_len);
+        if (!new_policy->target)
+            goto parse_policy_fail;
     }
+    new_policy->fs_classes = tlsm_pseudofs_policy_classes(new_policy);
+    return new_policy;
 
-    return res;
-
-strip_fail:
-    while (res_cpy > res)
-    {
-        kfree(*--res_cpy);
-    }
-    kfree(res);
+parse_policy_fail:
+    tlsm_policy_free(new_policy);
     return NULL;
 }
 
 /**
- * free_karray_from - free an array from the element start, (if start=0 also free the array pointer)
+ * parse_uids - parse a comma separated list of uids and uid ranges (1000,2000-2999)
+ *
+ * Return: 0 on success with w->uids[0..w->nranges) filled, negative error code otherwise
  */
-void free_karray_from(char **array, int start, int len)
+static int parse_uids(char *list, struct tlsm_watchdog *w)
 {
-    if (array)
+    char *range;
+    int i = 0;
+    while ((range = strsep(&list, ",")) != NULL)
     {
-        int i;
-        for (i = 0; i < len; i++)
+        if (i == TLSM_WATCHDOG_MAX_RANGES)
         {
-            if (i >= start)
-            {
-                if (*(array + i))
-                {
-                    kfree(*(array + i));
-                }
-            }
+            printk(KERN_ERR "[TLSM][ERROR] more than %d uid ranges", TLSM_WATCHDOG_MAX_RANGES);
+            return -E2BIG;
         }
+        char *hi = range;
+        char *lo = strsep(&hi, "-");
+
+        if (kstrtou32(lo, 10, &w->uids[i].lo) != 0)
+            goto parse_uids_fail;
+        w->uids[i].hi = w->uids[i].lo;
+        if (hi && kstrtou32(hi, 10, &w->uids[i].hi) != 0)
+            goto parse_uids_fail;
+        if (w->uids[i].hi < w->uids[i].lo)
+            goto parse_uids_fail;
+        i++;
     }
-    if (start == 0)
-    {
-        kfree(array);
-    }
+
+    w->nranges = i;
+    return 0;
+
+parse_uids_fail:
+    printk(KERN_ERR "[TLSM][ERROR] invalid uid range %s", range);
+    return -EINVAL;
 }
 
 /**
- * parse_policy - Parse a tlsm policy
- *
- * Return: the parsed policy in newly *allocated memory*
- *         NULL on failure
+ * tlsm_watchdog_serves - check if a watchdog answers the requests of a user
  */
-struct policy *parse_policy(char *rule)
+static bool tlsm_watchdog_serves(const struct tlsm_watchdog *w, int uid)
 {
-    int word_count;
-    char **words = str_split(rule, ' ', &word_count);
-
-    if (!words)
-        return NULL;
-
-    struct policy *new_policy;
-    new_policy = kzalloc(sizeof(*new_policy), GFP_KERNEL);
-    new_policy->hit_count = 0;
-    new_policy->object = NULL;
-
-    if (!new_policy || word_count < 2)
-        goto parse_policy_fail;
-
-    tlsm_category_t category = str2tlsm_cat(words[1]);
-
-    if (category == TLSM_UNDEFINED)
-    {
-        goto parse_policy_fail;
-    }
-    else if (category == TLSM_ANALYZE)
+    if (w->system)
+        return true;
+    for (int i = 0; i < w->nranges; i++)
     {
-        new_policy->subject = words[0];
-        new_policy->category = category;
-        new_policy->op = TLSM_OP_UNDEFINED;
-        free_karray_from(words, 2, word_count);
+        if ((u32)uid >= w->uids[i].lo && (u32)uid <= w->uids[i].hi)
+            return true;
     }
-    else
-    {
-        if (word_count < 3)
-            goto parse_policy_fail;
-
-        tlsm_ops_t op = str2tlsm_ops(words[2]);
-        if (op == TLSM_OP_UNDEFINED)
-        {
-            printk(KERN_ERR "[TLSM][ERROR] cannot parse operation %s", words[2]);
-            goto parse_policy_fail;
-        }
-
-        int argc = tlsm_op2argc(op);
-        if (word_count < 3 + argc)
-        {
-            printk(KERN_ERR "[TLSM][ERROR] not enough paramters for policy (got %d out of %d required)", word_count, 3+argc);
-             goto parse_policy_fail;
-        }
-
-        switch (argc)
-        {
-        case 1:
-            new_policy->object = words[3];
-            break;
-        default:
-            break;
-        }
-        new_policy->subject = words[0];
-        new_policy->category = category;
-        new_policy->op = op;
-        kfree(words[2]);
-        free_karray_from(words, 3 + argc, word_count);
-    }
-
-    kfree(words[1]);
-    kfree(words);
-
-    return new_policy;
-
-parse_policy_fail:
-    if (new_policy)
-        kfree(new_policy);
-    free_karray_from(words, 0, word_count);
-    return NULL;
+    return false;
 }
 
 /**
- * parse_watchdog - Parse a tlsm watchdog
+ * parse_watchdog - Parse a tlsm watchdog, "<pid> <uids>"
  *
+ * <uids> is a list of uids and uid ranges (1000,2000-2999), or "*" for a system-wide watchdog
+ * answering for every user without a watchdog of its own. Serving other users than the writer
+ * needs CAP_SYS_ADMIN.
  * Return: the parsed watchdog in newly *allocated memory*
  *         NULL on failure
  */
 struct tlsm_watchdog *parse_watchdog(char *str)
 {
-    int word_count;
-    char **words = str_split(str, ' ', &word_count);
+    struct tlsm_words w;
 
-    if (!words)
+    if (str_split(str, ' ', &w) != 0 || w.count < 2)
         return NULL;
 
-    if (word_count < 2)
-    {
-        free_karray_from(words, 0, word_count);
-        return NULL;
-    }
-
     struct tlsm_watchdog *new_watchdog;
-    new_watchdog = kzalloc(sizeof(*new_watchdog), GFP_KERNEL);
+    new_watchdog = tlsm_mem_alloc(TLSM_MEM_WATCHDOG);
+    if (!new_watchdog)
+        return NULL;
 
     int pid;
-    int err_code1 = kstrtoint(words[0], 10, &pid);
+    int err_code1 = kstrtoint(w.word[0], 10, &pid);
     if (err_code1 == 0)
     {
         new_watchdog->pid = pid;
@@ -270,9 +147,9 @@ struct tlsm_watchdog *parse_watchdog(char *str)
     }
 
     struct task_struct *t = pid_task(find_vpid(pid), PIDTYPE_PID);
-    char *exe_path = get_exe_path_for_task(t);
+    char *exe_path = t ? get_exe_path_for_task(t) : NULL;
 
-    if (strcmp(exe_path, CONFIG_SECURITY_TLSM_WATCHDOG) != 0)
+    if (!exe_path || strcmp(exe_path, CONFIG_SECURITY_TLSM_WATCHDOG) != 0)
     {
         printk(KERN_DEBUG "[TLSM][ERROR] trying to add an unknown watchdog : %s", exe_path);
         kfree(exe_path);
@@ -280,79 +157,129 @@ struct tlsm_watchdog *parse_watchdog(char *str)
     }
     kfree(exe_path);
 
-    int uid;
-    int err_code2 = kstrtoint(words[1], 10, &uid);
-    if (err_code2 == 0)
+    if (strcmp(w.word[1], "*") == 0)
     {
-        new_watchdog->uid = uid;
+        new_watchdog->system = true;
     }
     else
     {
-        printk(KERN_ERR "[TLSM][ERROR] can't parse watchdog UID, error : %d", err_code2);
+        int err_code2 = parse_uids(w.word[1], new_watchdog);
+        if (err_code2 != 0)
+        {
+            printk(KERN_ERR "[TLSM][ERROR] can't parse watchdog UIDs, error : %d", err_code2);
+            goto parse_watchdog_fail;
+        }
+    }
+
+    // a user can only have its own requests answered by its watchdog
+    int uid = __kuid_val(current_uid());
+    bool own = !new_watchdog->system && new_watchdog->nranges == 1 &&
+               new_watchdog->uids[0].lo == uid && new_watchdog->uids[0].hi == uid;
+    if (!own && !capable(CAP_SYS_ADMIN))
+    {
+        printk(KERN_ERR "[TLSM][ERROR] uid %d cannot add a watchdog for other users", uid);
         goto parse_watchdog_fail;
     }
 
-    free_karray_from(words, 0, word_count);
     return new_watchdog;
 
 parse_watchdog_fail:
-    kfree(new_watchdog);
-    free_karray_from(words, 0, word_count);
+    tlsm_mem_free(TLSM_MEM_WATCHDOG, new_watchdog);
     return NULL;
 }
+/**
+ * tlsm_watchdog_task - find the watchdog of a user, forgetting the dead ones on the way
+ *
+ * A watchdog registered for the user's uid comes before a system-wide one.
+ * Must be called with tlsm_watchdogs_lock and the RCU read lock held.
+ * Return: the watchdog's task, NULL if the user has no live watchdog
+ */
+static struct task_struct *tlsm_watchdog_task(int uid)
+{
+    struct tlsm_watchdog *elem;
+    struct tlsm_watchdog *tmp;
+    struct task_struct *system = NULL;
+
+    list_for_each_entry_safe(elem, tmp, &tlsm_watchdogs, node)
+    {
+        if (!tlsm_watchdog_serves(elem, uid))
+            continue;
+
+        struct task_struct *t = pid_task(find_vpid(elem->pid), PIDTYPE_PID);
+        if (t && !elem->system)
+            return t;
+        if (t)
+        {
+            if (!system)
+                system = t;
+            continue;
+        }
+
+        // pid doesn't exist anymore, an old watchdog died and there may be a new one further
+        printk(KERN_DEBUG "[TLSM][WATCHDOG] removing dead watchdog of uid %d (pid=%d)", uid, elem->pid);
+        list_del(&elem->node);
+        tlsm_mem_free(TLSM_MEM_WATCHDOG, elem);
+    }
+    return system;
+}
+
+/**
+ * tlsm_watchdog_alive - check if a user has a watchdog to answer its requests
+ */
+bool tlsm_watchdog_alive(int uid)
+{
+    spin_lock(&tlsm_watchdogs_lock);
+    rcu_read_lock();
+    bool alive = tlsm_watchdog_task(uid) != NULL;
+    rcu_read_unlock();
+    spin_unlock(&tlsm_watchdogs_lock);
+    return alive;
+}
+
 /**
  * signal_watchdog - tries to signals userland watchdog that a new request is available
  * Remove old watchdog if process doens't exist
+ *
+ * Each request gets its own signal, a watchdog serving several users misses none of them. When
+ * its queue of signals is full (RLIMIT_SIGPENDING), the request is left for its periodic scan.
+ * Return: 0 if the watchdog was signaled or will find the request, -ESRCH if there is none
  */
-void signal_watchdog(int uid, int request_number)
+int signal_watchdog(int uid, int request_number)
 {
     // signal data
     struct kernel_siginfo info;
-    struct task_struct *t;
     memset(&info, 0, sizeof(struct kernel_siginfo));
-    info.si_signo = SIGUSR1;
+    info.si_signo = TLSM_WATCHDOG_SIGNAL;
     info.si_code = SI_QUEUE;
     info.si_int = request_number;
+    info.si_errno = uid; // a watchdog serving several users finds the request in user_<uid>/
 
-    // find watchdog to signal
-    struct tlsm_watchdog *elem;
-    struct tlsm_watchdog *found = NULL;
-    list_for_each_entry(elem, &tlsm_watchdogs, node)
-    {
-        if (elem->uid == uid)
-        {
-            found = elem;
-            break;
-        }
-    }
-
-    if (found)
+    int ret = 0;
+    spin_lock(&tlsm_watchdogs_lock);
+    rcu_read_lock();
+    struct task_struct *t = tlsm_watchdog_task(uid);
+    if (t)
     {
-        printk(KERN_DEBUG "[TLSM][WATCHDOG] found watchdog with mathcing uid %d (pid=%d)", uid, elem->pid);
-        rcu_read_lock();
-        t = pid_task(find_vpid(elem->pid), PIDTYPE_PID);
-        if (t != NULL)
+        printk(KERN_DEBUG "[TLSM][WATCHDOG] found watchdog with mathcing uid %d (pid=%d)", uid, task_pid_nr(t));
+        ret = send_sig_info(TLSM_WATCHDOG_SIGNAL, &info, t);
+        if (ret == -EAGAIN)
         {
-            rcu_read_unlock();
-            if (send_sig_info(SIGUSR1, &info, t) < 0)
-                printk(KERN_ERR "[TLSM][WATCHDOG] failed to send signal");
+            printk(KERN_DEBUG "[TLSM][WATCHDOG] signal queue of pid %d is full, left for its scan", task_pid_nr(t));
+            ret = 0;
         }
-        else
+        else if (ret < 0)
         {
-            // TODO: improve by making the removal inside the search function
-            // see https://docs.kernel.org/core-api/list.html#traversing-whilst-removing-nodes
-
-            // pid doesn't exist anymore
-            list_del(&elem->node);
-            signal_watchdog(uid, request_number); // call on the remeinder of the watchdog list
-                                                  // in case an old wathchdog died and there is a
-                                                  // new one
+            printk(KERN_ERR "[TLSM][WATCHDOG] failed to send signal");
         }
     }
     else
     {
         printk(KERN_DEBUG "[TLSM][WATCHDOG] no registered watchdog found");
+        ret = -ESRCH;
     }
+    rcu_read_unlock();
+    spin_unlock(&tlsm_watchdogs_lock);
+    return ret;
 }
 
 /**
@@ -360,19 +287,21 @@ void signal_watchdog(int uid, int request_number)
  */
 struct fs_answer *parse_answer(char *str)
 {
-    int word_count;
-    char **words = str_split(str, ' ', &word_count);
+    struct tlsm_words w;
+
+    struct fs_answer *res = NULL;
+    if (str_split(str, ' ', &w) != 0 || w.count < 2)
+        goto parse_answer_fail;
 
-    struct fs_answer *res;
-    res = kzalloc(sizeof(*res), GFP_KERNEL);
+    res = tlsm_mem_alloc(TLSM_MEM_ANSWER);
     if (unlikely(!res))
         goto parse_answer_fail;
 
-    int errcode = kstrtoint(words[1], 10, &res->score_delta);
+    int errcode = kstrtoint(w.word[1], 10, &res->score_delta);
     if (errcode)
         goto parse_answer_fail;
 
-    if (strcmp("allow", words[0]) == 0)
+    if (strcmp("allow", w.word[0]) == 0)
     {
         res->allow = TLSM_REQ_ALLOW;
     }
@@ -381,15 +310,11 @@ struct fs_answer *parse_answer(char *str)
         res->allow = TLSM_REQ_DENY;
     }
 
-    free_karray_from(words, 0, word_count);
-
     return res;
 
 parse_answer_fail:
     printk(KERN_DEBUG "[TLSM][ERROR] Parse answer fail.");
-    if (res)
-        kfree(res);
-    free_karray_from(words, 0, word_count);
+    tlsm_mem_free(TLSM_MEM_ANSWER, res);
     return NULL;
 }
 
@@ -400,11 +325,16 @@ void tlsm_policy_free(struct policy *policy)
 {
     if (!policy)
         return;
-    kfree(policy->object);
-    kfree(policy->subject);
-    kfree(policy);
+    tlsm_str_policy_put(policy->object);
+    tlsm_str_policy_put(policy->subject);
+    tlsm_str_policy_put(policy->target);
+    tlsm_mem_free(TLSM_MEM_POLICY, policy);
 }
 
+static u64 tlsm_next_policy_id = 1; // protected by tlsm_policies_sem, ids are never reused
+
+atomic_t tlsm_op_rules[TLSM_OPS_LEN]; // policies per operation over every list, for fast rejects
+
 /**
  * tlsm_new_plist - Creates a new policy list.
  *
@@ -416,23 +346,31 @@ struct plist *tlsm_plist_new(void)
     t = kzalloc(sizeof(*t), GFP_KERNEL);
     if (!t)
         return NULL;
+    tlsm_mem_account(TLSM_MEM_POLICY_LIST, 1, sizeof(*t));
     t->head = NULL;
     t->tail = NULL;
+    t->generation = 0;
+    t->count = 0;
+    hash_init(t->by_id);
+    hash_init(t->by_subject);
+    for (int i = 0; i < TLSM_OPS_LEN; i++)
+        INIT_LIST_HEAD(&t->by_op[i]);
     return t;
 }
 
 /**
- * tlsm_plist_add - Appends a new policy to a policy list.
+ * tlsm_plist_add - Appends a new policy to a policy list and gives it a new id.
  */
 int tlsm_plist_add(struct plist *plist, struct policy *policy)
 {
     // allocate new node
     struct policy_node *node;
-    node = kzalloc(sizeof(*node), GFP_KERNEL);
+    node = tlsm_mem_alloc(TLSM_MEM_POLICY_NODE);
     if (!node)
         return -ENOMEM;
 
     node->next = NULL;
+    node->prev = plist->tail;
 
     node->policy = policy;
     if (!(plist->head))
@@ -446,52 +384,123 @@ int tlsm_plist_add(struct plist *plist, struct policy *policy)
         plist->tail = node;
     }
 
+    policy->id = tlsm_next_policy_id++;
+    hash_add(plist->by_id, &node->id_node, policy->id);
+    hash_add(plist->by_subject, &node->subject_node, policy->subject->hash);
+    list_add_tail(&node->op_node, &plist->by_op[policy->op]);
+    atomic_inc(&tlsm_op_rules[policy->op]);
+
+    plist->count++;
+    plist->generation++;
+
     return 0;
 }
 
+/**
+ * tlsm_plist_find - looks up a policy by id
+ *
+ * Return: the node holding the policy, NULL if there is none
+ */
+struct policy_node *tlsm_plist_find(struct plist *plist, u64 id)
+{
+    struct policy_node *node;
+    hash_for_each_possible(plist->by_id, node, id_node, id)
+    {
+        if (node->policy->id == id)
+            return node;
+    }
+    return NULL;
+}
+
+/**
+ * tlsm_plist_unlink - removes a node from the list and its indexes, then frees it
+ */
+static void tlsm_plist_unlink(struct plist *plist, struct policy_node *node)
+{
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        plist->head = node->next;
+
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        plist->tail = node->prev;
+
+    hash_del(&node->id_node);
+    hash_del(&node->subject_node);
+    list_del(&node->op_node);
+    atomic_dec(&tlsm_op_rules[node->policy->op]);
+    if (plist->compiled)
+        tlsm_ruleset_kill(plist->compiled, node->policy->id);
+
+    tlsm_policy_free(node->policy);
+    tlsm_mem_free(TLSM_MEM_POLICY_NODE, node);
+
+    plist->count--;
+    plist->generation++;
+}
+
 /**
  * tlsm_plist_del - removes a policy from the policy list
+ *
+ * Return: 0 on success, -1 if no policy has this id
  */
-int tlsm_plist_del(struct plist *plist, int index)
+int tlsm_plist_del(struct plist *plist, u64 id)
 {
+    struct policy_node *node = tlsm_plist_find(plist, id);
+    if (!node)
+        return -1;
 
-    int curr_i = 0;
-    struct policy_node *curr = plist->head;
-    struct policy_node *prev = NULL;
+    tlsm_plist_unlink(plist, node);
+    return 0;
+}
 
-    // iterate until the target node to remove
-    while (curr && curr_i < index)
-    {
-        curr_i++;
-        prev = curr;
-        curr = curr->next;
-    }
+/**
+ * tlsm_plist_del_subject - removes every policy of a subject
+ *
+ * Return: the number of removed policies
+ */
+int tlsm_plist_del_subject(struct plist *plist, const char *subject)
+{
+    struct policy_node *node;
+    struct hlist_node *tmp;
+    int removed = 0;
 
-    if (curr_i == index)
+    // policies of this subject all point to its interned copy, if it is not interned there is none
+    struct tlsm_str *s = tlsm_str_lookup(subject, strlen(subject));
+    if (!s)
+        return 0;
+
+    hash_for_each_possible_safe(plist->by_subject, node, tmp, subject_node, s->hash)
     {
-        if (curr) // if the node actually exists
+        if (node->policy->subject == s)
         {
-            if (prev)
-            { // if curr is not the head
-                prev->next = curr->next;
-                if (curr->next == NULL) // if curr was the last node
-                    plist->tail = prev;
-            }
-            else
-            { // curr is the head / first node of the list
-                plist->head = curr->next;
-                if (plist->tail == curr)      // if curr was the only node
-                    plist->tail = curr->next; // should be null
-            }
-
-            tlsm_policy_free(curr->policy);
-            kfree(curr);
-            return 0;
+            tlsm_plist_unlink(plist, node);
+            removed++;
         }
-        // curr = tail->next, nothing to do
     }
-    // else : failed to find target node
-    return -1;
+    tlsm_str_put(s);
+    return removed;
+}
+
+/**
+ * tlsm_plist_del_op - removes every policy for an operation
+ *
+ * Return: the number of removed policies
+ */
+int tlsm_plist_del_op(struct plist *plist, tlsm_ops_t op)
+{
+    struct policy_node *node;
+    struct policy_node *tmp;
+    int removed = 0;
+
+    list_for_each_entry_safe(node, tmp, &plist->by_op[op], op_node)
+    {
+        tlsm_plist_unlink(plist, node);
+        removed++;
+    }
+    return removed;
 }
 
 /**
@@ -508,14 +517,36 @@ void tlsm_plist_free(struct plist *plist)
     while (curr)
     {
         temp = curr->next;
+        atomic_dec(&tlsm_op_rules[curr->policy->op]);
         tlsm_policy_free(curr->policy);
-        kfree(curr);
+        tlsm_mem_free(TLSM_MEM_POLICY_NODE, curr);
         curr = temp;
     }
 
+    tlsm_ruleset_free(plist->compiled);
+    tlsm_mem_account(TLSM_MEM_POLICY_LIST, -1, -(long)sizeof(*plist));
     kfree(plist);
 }
 
+/**
+ * tlsm_policy_hit - accounts a hit on an active policy, if it still exists
+ * cgid is the cgroup of the task the policy was applied to, its set is searched first.
+ */
+void tlsm_policy_hit(u64 cgid, u64 id)
+{
+    struct policy_node *node = NULL;
+
+    down_read(&tlsm_policies_sem);
+    struct tlsm_cgroup_policies *set = tlsm_cgroup_find(cgid);
+    if (set)
+        node = tlsm_plist_find(set->policies, id);
+    if (!node)
+        node = tlsm_plist_find(tlsm_policies, id);
+    if (node)
+        atomic64_inc(&node->policy->hit_count);
+    up_read(&tlsm_policies_sem);
+}
+
 /**
  * plist_debug - print list to dmesg
  */
@@ -524,7 +555,7 @@ void plist_debug(struct plist *l)
     struct policy_node *tmp = l->head;
     while (tmp)
     {
-        printk(KERN_DEBUG "[TLSM][LIST_DEBUG] type=%d, subject=%s, object=%s", tmp->policy->op, tmp->policy->subject, tmp->policy->object);
+        printk(KERN_DEBUG "[TLSM][LIST_DEBUG] type=%d, subject=%s, object=%s", tmp->policy->op, tmp->policy->subject->str, tmp->policy->object ? tmp->policy->object->str : NULL);
         tmp = tmp->next;
     }
 }
@@ -560,6 +591,26 @@ char *get_exe_path_for_task(struct task_struct *t)
     return res;
 }
 
+/**
+ * tlsm_task_exe - get the executable path of a task as interned at its last execve, without
+ * resolving it. Safe on any task.
+ *
+ * Return: a reference on the path (release it with tlsm_str_put), NULL if unknown
+ */
+struct tlsm_str *tlsm_task_exe(struct task_struct *t)
+{
+    struct tlsm_task_security *ts = get_task_security(t);
+    struct tlsm_str *exe;
+
+    rcu_read_lock();
+    exe = rcu_dereference(ts->exe);
+    if (exe && !refcount_inc_not_zero(&exe->ref))
+        exe = NULL;
+    rcu_read_unlock();
+
+    return exe;
+}
+
 /**
  * score_update - updates a task's score. Prevent overflow/underflow
  * input:
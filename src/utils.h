@@ -1,25 +1,48 @@
 #ifndef _TLSM_UTILS_H
 #define _TLSM_UTILS_H
 
-char **str_split(char *string, const char delimiter, int *out_count);
+#include <linux/types.h>
+#include <linux/atomic.h>
+
+#include "common.h"
+#include "rule.h"
+
+// realtime, so notifications queue instead of merging; C libraries keep the first ones for themselves
+#define TLSM_WATCHDOG_SIGNAL (SIGRTMIN + 4)
+
 struct policy *parse_policy(char *rule);
-void free_karray_from(char **array, int start, int len);
 
 struct fs_answer *parse_answer(char *str);
 
 struct plist *tlsm_plist_new(void);
 int tlsm_plist_add(struct plist *plist, struct policy *policy);
-int tlsm_plist_del(struct plist *plist, int index);
+struct policy_node *tlsm_plist_find(struct plist *plist, u64 id);
+int tlsm_plist_del(struct plist *plist, u64 id);
+int tlsm_plist_del_subject(struct plist *plist, const char *subject);
+int tlsm_plist_del_op(struct plist *plist, tlsm_ops_t op);
 void tlsm_plist_free(struct plist *plist);
+void tlsm_policy_hit(u64 cgid, u64 id);
 
 struct policy *tlsm_policy_dup(struct policy *policy);
 void tlsm_policy_free(struct policy *policy);
 
 struct tlsm_watchdog *parse_watchdog(char *str);
-void signal_watchdog(int uid, int request_number);
+bool tlsm_watchdog_alive(int uid);
+int signal_watchdog(int uid, int request_number);
 
 void plist_debug(struct plist *l);
 char *get_exe_path_for_task(struct task_struct *t);
+struct tlsm_str *tlsm_task_exe(struct task_struct *t);
+
+extern atomic_t tlsm_op_rules[TLSM_OPS_LEN];
+
+/**
+ * tlsm_rules_for_op - number of policies, in every list, that can apply to an operation
+ */
+static inline int tlsm_rules_for_op(tlsm_ops_t op)
+{
+    return atomic_read(&tlsm_op_rules[op]) + atomic_read(&tlsm_op_rules[TLSM_OP_UNDEFINED]);
+}
 
 void score_update(unsigned int *score, int delta);
 
@@ -0,0 +1,269 @@
+#include <linux/atomic.h>
+#include <linux/fs.h>
+#include <linux/fs_struct.h>
+#include <linux/sched.h>
+#include <net/sock.h>
+
+#include "verdict.h"
+#include "tlsm.h"
+
+/* Verdict cache */
+/* the last verdicts for an inode are kept in its security blob. An entry is only valid for the
+ * policies it was computed with: any policy change, directory rename or unmount bumps the epoch
+ * and makes every entry stale at once. Changes to the inode itself only drop its own entries. */
+
+static atomic64_t tlsm_policies_epoch = ATOMIC64_INIT(1);
+
+static inline struct tlsm_inode_security *get_inode_security(struct inode *inode)
+{
+    return inode->i_security + tlsm_blob_sizes.lbs_inode;
+}
+
+void tlsm_verdict_init(struct inode *inode)
+{
+    struct tlsm_inode_security *is = get_inode_security(inode);
+
+    memset(is, 0, sizeof(*is));
+    spin_lock_init(&is->lock);
+}
+
+/**
+ * tlsm_verdict_key_init - build the cache key of an access to a path
+ *
+ * Return: false if the verdict for this path cannot be cached, as it may be reached through
+ *         several names (hard links)
+ */
+bool tlsm_verdict_key_init(struct tlsm_verdict_key *key, const struct path *path, tlsm_ops_t op, u8 mode, struct tlsm_str *exe, u64 cgid)
+{
+    struct inode *inode = d_backing_inode(path->dentry);
+    struct path root;
+
+    if (!inode || !inode->i_security || inode->i_nlink > 1)
+        return false;
+
+    get_fs_root(current->fs, &root);
+    key->root_mnt = root.mnt;
+    key->root_dentry = root.dentry;
+    path_put(&root);
+
+    key->epoch = atomic64_read(&tlsm_policies_epoch);
+    key->subject = exe->serial;
+    key->cgid = cgid;
+    key->op = op;
+    key->mode = mode;
+    key->mnt = path->mnt;
+    key->inode = inode;
+    key->seq = READ_ONCE(get_inode_security(inode)->seq);
+    return true;
+}
+
+static bool tlsm_verdict_key_eq(struct tlsm_verdict_key *a, struct tlsm_verdict_key *b)
+{
+    return a->epoch == b->epoch && a->subject == b->subject && a->cgid == b->cgid && a->op == b->op && a->mode == b->mode && a->mnt == b->mnt && a->root_mnt == b->root_mnt && a->root_dentry == b->root_dentry;
+}
+
+/**
+ * tlsm_verdict_lookup - find a cached verdict
+ *
+ * Return: true on hit, with the verdict, the matching policy id (0 if none matched) and the
+ *         modes it is for
+ */
+bool tlsm_verdict_lookup(struct tlsm_verdict_key *key, int *verdict, u64 *policy_id, u8 *modes)
+{
+    struct tlsm_inode_security *is = get_inode_security(key->inode);
+    bool hit = false;
+
+    spin_lock(&is->lock);
+    for (int i = 0; i < TLSM_VERDICT_WAYS; i++)
+    {
+        if (tlsm_verdict_key_eq(&is->cache[i].key, key))
+        {
+            *verdict = is->cache[i].verdict;
+            *policy_id = is->cache[i].policy_id;
+            *modes = is->cache[i].modes;
+            hit = true;
+            break;
+        }
+    }
+    spin_unlock(&is->lock);
+
+    return hit;
+}
+
+/**
+ * tlsm_verdict_store - cache a verdict computed for a key
+ *
+ * The verdict is dropped if the inode was invalidated since the key was made.
+ */
+void tlsm_verdict_store(struct tlsm_verdict_key *key, int verdict, u64 policy_id, u8 modes)
+{
+    struct tlsm_inode_security *is = get_inode_security(key->inode);
+
+    spin_lock(&is->lock);
+    if (is->seq == key->seq)
+    {
+        struct tlsm_verdict *v = &is->cache[is->next];
+        is->next = (is->next + 1) % TLSM_VERDICT_WAYS;
+
+        v->key = *key;
+        v->verdict = verdict;
+        v->policy_id = policy_id;
+        v->modes = modes;
+    }
+    spin_unlock(&is->lock);
+}
+
+/**
+ * tlsm_verdict_invalidate - drop the cached verdicts of an inode
+ */
+void tlsm_verdict_invalidate(struct inode *inode)
+{
+    if (!inode || !inode->i_security)
+        return;
+
+    struct tlsm_inode_security *is = get_inode_security(inode);
+
+    spin_lock(&is->lock);
+    is->seq++;
+    for (int i = 0; i < TLSM_VERDICT_WAYS; i++)
+        is->cache[i].key.epoch = 0;
+    spin_unlock(&is->lock);
+}
+
+/**
+ * tlsm_verdict_flush - make every cached verdict stale
+ */
+void tlsm_verdict_flush(void)
+{
+    atomic64_inc(&tlsm_policies_epoch);
+}
+
+/**
+ * tlsm_verdict_epoch - the current policy epoch, verdicts computed from now on are tagged with it
+ */
+u64 tlsm_verdict_epoch(void)
+{
+    return atomic64_read(&tlsm_policies_epoch);
+}
+
+/* Open file verdicts */
+/* open policies are checked once per access mode of a file, then read(), write() and mmap()
+ * only look at the file's blob. A policy change bumps the epoch, the modes are then checked
+ * again on their next use. */
+
+static inline struct tlsm_file_security *get_file_security(struct file *f)
+{
+    return f->f_security + tlsm_blob_sizes.lbs_file;
+}
+
+void tlsm_file_verdict_init(struct file *f)
+{
+    atomic64_set(&get_file_security(f)->state, 0);
+}
+
+/**
+ * tlsm_file_tracked - checks if a file went through the open hook (pipes and sockets do not)
+ */
+bool tlsm_file_tracked(struct file *f)
+{
+    return atomic64_read(&get_file_security(f)->state) != 0;
+}
+
+/**
+ * tlsm_file_verdict_lookup - get the verdicts of some access modes of a file
+ *
+ * Return: true if every mode was checked in the current epoch, with the denied ones
+ */
+bool tlsm_file_verdict_lookup(struct file *f, u8 modes, u8 *denied)
+{
+    u64 state = atomic64_read(&get_file_security(f)->state);
+
+    if (state >> 8 != tlsm_verdict_epoch() || (state & modes) != modes)
+        return false;
+    *denied = (state >> 4) & modes;
+    return true;
+}
+
+/**
+ * tlsm_file_verdict_store - record the verdicts of some access modes of a file
+ *
+ * Verdicts of an older epoch than the stored ones are dropped, a newer epoch replaces them.
+ */
+void tlsm_file_verdict_store(struct file *f, u64 epoch, u8 checked, u8 denied)
+{
+    atomic64_t *state = &get_file_security(f)->state;
+    s64 old = atomic64_read(state);
+    s64 new;
+
+    do
+    {
+        if ((u64)old >> 8 > epoch)
+            return;
+        new = (epoch << 8) | ((denied & checked) << 4) | checked;
+        if ((u64)old >> 8 == epoch)
+            new |= old & 0xff;
+    } while (!atomic64_try_cmpxchg(state, &old, new));
+}
+
+/* Socket verdicts */
+/* the last verdict of a socket is kept in its blob, with the destination it was for. Like
+ * inode verdicts, they are only valid for the policy epoch they were computed in. */
+
+static inline struct tlsm_sock_security *get_sock_security(struct sock *sk)
+{
+    return sk->sk_security + tlsm_blob_sizes.lbs_sock;
+}
+
+void tlsm_sock_verdict_init(struct sock *sk)
+{
+    struct tlsm_sock_security *ss = get_sock_security(sk);
+
+    memset(ss, 0, sizeof(*ss));
+    spin_lock_init(&ss->lock);
+}
+
+void tlsm_sock_verdict_key_init(struct tlsm_sock_verdict_key *key, const struct tlsm_sock_dest *dest, struct tlsm_str *exe, u64 cgid)
+{
+    key->epoch = atomic64_read(&tlsm_policies_epoch);
+    key->subject = exe->serial;
+    key->cgid = cgid;
+    key->dest = *dest;
+}
+
+static bool tlsm_sock_verdict_key_eq(struct tlsm_sock_verdict_key *a, struct tlsm_sock_verdict_key *b)
+{
+    return a->epoch == b->epoch && a->subject == b->subject && a->cgid == b->cgid && a->dest.family == b->dest.family && a->dest.port == b->dest.port && memcmp(a->dest.addr, b->dest.addr, sizeof(a->dest.addr)) == 0;
+}
+
+/**
+ * tlsm_sock_verdict_lookup - get the last verdict of a socket, if it was for the same key
+ *
+ * Return: true on hit, with the verdict and the matching policy id (0 if none matched)
+ */
+bool tlsm_sock_verdict_lookup(struct sock *sk, struct tlsm_sock_verdict_key *key, int *verdict, u64 *policy_id)
+{
+    struct tlsm_sock_security *ss = get_sock_security(sk);
+    bool hit = false;
+
+    spin_lock(&ss->lock);
+    if (tlsm_sock_verdict_key_eq(&ss->key, key))
+    {
+        *verdict = ss->verdict;
+        *policy_id = ss->policy_id;
+        hit = true;
+    }
+    spin_unlock(&ss->lock);
+
+    return hit;
+}
+
+void tlsm_sock_verdict_store(struct sock *sk, struct tlsm_sock_verdict_key *key, int verdict, u64 policy_id)
+{
+    struct tlsm_sock_security *ss = get_sock_security(sk);
+
+    spin_lock(&ss->lock);
+    ss->key = *key;
+    ss->verdict = verdict;
+    ss->policy_id = policy_id;
+    spin_unlock(&ss->lock);
+}
@@ -0,0 +1,91 @@
+#ifndef _TLSM_VERDICT_H
+#define _TLSM_VERDICT_H
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/spinlock.h>
+#include <linux/path.h>
+
+#include "common.h"
+#include "intern.h"
+#include "net.h"
+
+#define TLSM_VERDICT_WAYS 4
+
+struct file;
+struct sock;
+
+/* what a verdict depends on, besides the policies: who asks, for what, and how the path is seen */
+struct tlsm_verdict_key
+{
+    u64 epoch;   // tlsm_policies_epoch when the key was made
+    u64 subject; // serial of the interned executable path
+    u64 cgid;
+    tlsm_ops_t op;
+    u8 mode; // TLSM_FILE_OPEN, TLSM_MODE_* asked for
+    struct vfsmount *mnt;     // the object path depends on the mount it is reached through
+    struct vfsmount *root_mnt; // ... and on the root of the task
+    struct dentry *root_dentry;
+    struct inode *inode;
+    u64 seq; // inode invalidation count when the key was made
+};
+
+struct tlsm_verdict
+{
+    struct tlsm_verdict_key key; // key.epoch is 0 for an empty entry
+    u64 policy_id;               // matching policy, 0 if none matched
+    int verdict;
+    u8 modes;                    // TLSM_FILE_OPEN, the asked modes the verdict is for
+};
+
+struct tlsm_inode_security
+{
+    spinlock_t lock;
+    u64 seq;           // bumped on every invalidation
+    unsigned int next; // next entry to replace
+    struct tlsm_verdict cache[TLSM_VERDICT_WAYS];
+};
+
+/* verdicts of the access modes of an open file, decided once per policy epoch */
+struct tlsm_file_security
+{
+    atomic64_t state; // epoch << 8 | denied modes << 4 | checked modes, 0 if not opened since TLSM init
+};
+
+/* what the verdict of a datagram depends on, besides the policies */
+struct tlsm_sock_verdict_key
+{
+    u64 epoch;   // tlsm_policies_epoch when the key was made
+    u64 subject; // serial of the interned executable path, the socket may be shared
+    u64 cgid;
+    struct tlsm_sock_dest dest;
+};
+
+/* the last verdict of a socket, high rate senders mostly send to the same destination */
+struct tlsm_sock_security
+{
+    spinlock_t lock;
+    struct tlsm_sock_verdict_key key; // key.epoch is 0 when empty
+    u64 policy_id;                    // matching policy, 0 if none matched
+    int verdict;
+};
+
+void tlsm_verdict_init(struct inode *inode);
+bool tlsm_verdict_key_init(struct tlsm_verdict_key *key, const struct path *path, tlsm_ops_t op, u8 mode, struct tlsm_str *exe, u64 cgid);
+bool tlsm_verdict_lookup(struct tlsm_verdict_key *key, int *verdict, u64 *policy_id, u8 *modes);
+void tlsm_verdict_store(struct tlsm_verdict_key *key, int verdict, u64 policy_id, u8 modes);
+void tlsm_verdict_invalidate(struct inode *inode);
+void tlsm_verdict_flush(void);
+u64 tlsm_verdict_epoch(void);
+
+void tlsm_file_verdict_init(struct file *f);
+bool tlsm_file_tracked(struct file *f);
+bool tlsm_file_verdict_lookup(struct file *f, u8 modes, u8 *denied);
+void tlsm_file_verdict_store(struct file *f, u64 epoch, u8 checked, u8 denied);
+
+void tlsm_sock_verdict_init(struct sock *sk);
+void tlsm_sock_verdict_key_init(struct tlsm_sock_verdict_key *key, const struct tlsm_sock_dest *dest, struct tlsm_str *exe, u64 cgid);
+bool tlsm_sock_verdict_lookup(struct sock *sk, struct tlsm_sock_verdict_key *key, int *verdict, u64 *policy_id);
+void tlsm_sock_verdict_store(struct sock *sk, struct tlsm_sock_verdict_key *key, int verdict, u64 policy_id);
+
+#endif // _TLSM_VERDICT_H
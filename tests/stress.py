@@ -0,0 +1,336 @@
+#!/usr/bin/python
+"""
+Multi-core stress test of TLSM, run as root in the VM:
+    sudo ./stress.py [--workers N] [--duration S] [--ops open,connect,send,signal,execve] [--no-churn]
+
+Workers hammer the hooks (open, connect, sendto, kill, exec) while a churn thread keeps adding and
+deleting rules, so the ruleset is recompiled and verdict caches flushed under their feet.
+For 1, 2, 4, ... N workers, it reports the throughput and its scaling, then checks:
+ - every access got the verdict of its rule (churned rules never apply to the workers)
+ - no counter update was lost: per-task stats (/proc/self/attr/tlsm/stats) and policy hit counts
+ - the kernel log stayed clean (BUG, KASAN, lockdep, RCU, ... reports)
+Lockdep and KASAN reports need a kernel built with CONFIG_PROVE_LOCKING and CONFIG_KASAN.
+"""
+
+from os import getpid, geteuid, cpu_count, open as os_open, close, read, lseek, kill, waitpid
+from os import posix_spawn, environ, makedirs, O_RDONLY, O_NONBLOCK, SEEK_END
+from os.path import join, realpath, exists
+from sys import argv, executable, exit
+from time import monotonic, sleep
+from multiprocessing import Process, Queue, Event
+import errno
+import re
+import select
+import signal
+import socket
+import threading
+
+SYSFS_ROOT = "/sys/kernel/security/tlsm/"
+SYSFS_ADD = join(SYSFS_ROOT, "add_policy")
+SYSFS_DEL = join(SYSFS_ROOT, "del_policy")
+TASK_STATS = "/proc/self/attr/tlsm/stats" # added to procfs by proc_base.diff
+SYSFS_LIST_RAW = join(SYSFS_ROOT, "list_policies_raw")
+SYSFS_WATCHDOG = join(SYSFS_ROOT, "add_watchdog")
+
+WORKDIR = "/tmp/tlsm-stress"
+ALLOWED = join(WORKDIR, "allowed")
+DENIED = join(WORKDIR, "denied")
+CONNECT_TO = ("127.0.0.1", 9) # udp, connect() does not send anything
+SEND_TO = ("127.0.0.1", 9)    # discard port, nothing listens: the datagrams are dropped
+EXEC = "/usr/bin/true"
+
+DENY_EVERY = 8   # one open out of DENY_EVERY targets the denied file
+EXEC_EVERY = 16  # exec is much slower than the other operations
+BATCH = 64       # iterations between two clock reads
+
+NOISE = "/tlsm-stress/noise" # churned rules, none of them can match a worker's access
+NOISE_RULES = 32
+
+KERNEL_REPORTS = re.compile(r"BUG:|KASAN|UBSAN|WARNING:|lockdep|possible (circular|recursive) locking|"
+                            r"suspicious RCU|Oops|general protection fault|soft lockup|"
+                            r"blocked for more than|list_(add|del) corruption|refcount_t:")
+
+python = realpath(executable) # the subject of the workers
+
+def probe_rules():
+    return [f"{python} allow open {ALLOWED}",
+            f"{python} deny open {DENIED}",
+            f"{python} allow connect {CONNECT_TO[0]} proto=udp",
+            f"{python} allow send {SEND_TO[0]} proto=udp port={SEND_TO[1]}",
+            f"{python} allow signal sig=URG",
+            f"{python} allow execve {EXEC}"]
+
+def noise_rules(round):
+    rules = []
+    for i in range(NOISE_RULES):
+        n = round * NOISE_RULES + i
+        kind = i % 4
+        if kind == 0:
+            rules.append(f"{NOISE}{i % 8} deny open /tlsm-stress-churn/{n}")
+        elif kind == 1:
+            rules.append(f"{NOISE}* deny open /tlsm-stress-churn/**/{n}") # glob, rebuilds the DFAs
+        elif kind == 2:
+            rules.append(f"{python} deny open /tlsm-stress-churn/{n}") # same subject as the workers
+        else:
+            rules.append(f"{python} deny {'connect' if n % 2 else 'send'} 10.255.{n % 256}.1 proto=tcp")
+    return rules
+
+def read_rules():
+    """(id, subject, category, op, object, hit count) of the active rules"""
+    rules = []
+    with open(SYSFS_LIST_RAW) as f:
+        for line in f:
+            rule_id, subject, category, op, obj, hits = line.rstrip("\n").split("\t")[:6]
+            rules.append((int(rule_id), subject, category, op, obj, int(hits)))
+    return rules
+
+def add_rules(rules):
+    # unbuffered, the whole batch is parsed and compiled by TLSM at once
+    with open(SYSFS_ADD, "wb", buffering=0) as f:
+        f.write("\n".join(rules).encode())
+
+def del_rule(rule_id):
+    with open(SYSFS_DEL, "w") as f:
+        f.write(f"id {rule_id}")
+
+def read_task_stats():
+    """{op: (deny, total)} of the calling task"""
+    with open(TASK_STATS) as f:
+        fields = f.read().split()
+    stats = dict()
+    for field in fields[1:]: # score first
+        op, _, counts = field.partition("=")
+        deny, _, total = counts.partition("/")
+        stats[op] = (int(deny), int(total))
+    return stats
+
+def worker(ops, duration, start, results):
+    counts = dict.fromkeys(["open", "connect", "send", "signal", "execve"], 0)
+    denied = 0
+    wrong = []
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    unconnected = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    pid = getpid()
+
+    before = read_task_stats()
+    start.wait()
+    end = monotonic() + duration
+    i = 0
+    while monotonic() < end:
+        for _ in range(BATCH):
+            i += 1
+            if "open" in ops:
+                target = DENIED if i % DENY_EVERY == 0 else ALLOWED
+                try:
+                    close(os_open(target, O_RDONLY))
+                    if target == DENIED:
+                        wrong.append("open of the denied file succeeded")
+                except PermissionError:
+                    if target == DENIED:
+                        denied += 1
+                    else:
+                        wrong.append("open of the allowed file was denied")
+                counts["open"] += 1
+            if "connect" in ops:
+                try:
+                    sock.connect(CONNECT_TO)
+                except PermissionError:
+                    wrong.append("connect was denied")
+                counts["connect"] += 1
+            if "send" in ops:
+                try:
+                    unconnected.sendto(b"", SEND_TO) # cached verdict after the first one
+                except PermissionError:
+                    wrong.append("send was denied")
+                except ConnectionRefusedError: # ICMP port unreachable of a previous datagram
+                    pass
+                counts["send"] += 1
+            if "signal" in ops:
+                try:
+                    kill(pid, signal.SIGURG) # ignored by default
+                except PermissionError:
+                    wrong.append("signal was denied")
+                counts["signal"] += 1
+            if "execve" in ops and i % EXEC_EVERY == 0:
+                try:
+                    waitpid(posix_spawn(EXEC, [EXEC], environ), 0)
+                except PermissionError:
+                    wrong.append("execve was denied")
+                counts["execve"] += 1
+    after = read_task_stats()
+    sock.close()
+    unconnected.close()
+
+    # the totals only count accesses a rule applied to, each access here has one
+    # execve is checked by the spawned task, not this one
+    lost = []
+    for op in ("open", "connect", "send", "signal"):
+        got = after[op][1] - before[op][1]
+        if got < counts[op]:
+            lost.append(f"{op}: {counts[op]} accesses, stats total grew by {got}")
+    if after["open"][0] - before["open"][0] < denied:
+        lost.append(f"open: {denied} denied, stats deny grew by {after['open'][0] - before['open'][0]}")
+
+    results.put((counts, denied, wrong[:5], len(wrong), lost))
+
+class Churn(threading.Thread):
+    """Adds and deletes rules in a loop, and makes TLSM parse (and reject) watchdogs"""
+    def __init__(self):
+        super().__init__(daemon=True)
+        self.stop = threading.Event()
+        self.rounds = 0
+        self.errors = []
+
+    def run(self):
+        while not self.stop.is_set():
+            try:
+                add_rules(noise_rules(self.rounds))
+                for rule in read_rules():
+                    if rule[1].startswith(NOISE) or rule[4].startswith(("/tlsm-stress-churn/", "10.255.")):
+                        del_rule(rule[0])
+                # this process is not tlsmd, parse_watchdog() refuses it after looking it up
+                try:
+                    with open(SYSFS_WATCHDOG, "w") as f:
+                        f.write(f"{getpid()} 65534")
+                except OSError:
+                    pass
+                self.rounds += 1
+            except OSError as e:
+                self.errors.append(str(e))
+                sleep(0.1)
+
+class KernelLog(threading.Thread):
+    """Collects the kernel log records that look like a bug report"""
+    def __init__(self):
+        super().__init__(daemon=True)
+        self.stop = threading.Event()
+        self.reports = []
+        self.overruns = 0
+        self.fd = os_open("/dev/kmsg", O_RDONLY | O_NONBLOCK)
+        lseek(self.fd, 0, SEEK_END) # only what happens from now on
+
+    def run(self):
+        while not self.stop.is_set():
+            select.select([self.fd], [], [], 0.2)
+            while True:
+                try:
+                    record = read(self.fd, 8192).decode(errors="replace")
+                except BlockingIOError:
+                    break
+                except BrokenPipeError: # overwritten before being read
+                    self.overruns += 1
+                    continue
+                message = record.split(";", 1)[-1].strip()
+                if KERNEL_REPORTS.search(message):
+                    self.reports.append(message)
+
+def run_step(n, ops, duration):
+    start = Event()
+    results = Queue()
+    workers = [Process(target=worker, args=(ops, duration, start, results)) for _ in range(n)]
+    for w in workers:
+        w.start()
+    sleep(0.5) # let them reach start.wait()
+    begin = monotonic()
+    start.set()
+    out = [results.get() for _ in workers]
+    elapsed = monotonic() - begin
+    for w in workers:
+        w.join()
+    crashed = sum(1 for w in workers if w.exitcode != 0)
+    return out, elapsed, crashed
+
+def main():
+    workers = cpu_count()
+    duration = 5.0
+    ops = ["open", "connect", "send", "signal", "execve"]
+    churn = "--no-churn" not in argv
+    if "--workers" in argv:
+        workers = int(argv[argv.index("--workers") + 1])
+    if "--duration" in argv:
+        duration = float(argv[argv.index("--duration") + 1])
+    if "--ops" in argv:
+        ops = argv[argv.index("--ops") + 1].split(",")
+
+    if geteuid() != 0 or not exists(SYSFS_ADD):
+        print("run as root on a TLSM kernel")
+        exit(1)
+    if not exists(TASK_STATS):
+        print(f"{TASK_STATS} is missing, the kernel was built without proc_base.diff")
+        exit(1)
+    if not exists("/proc/lockdep"):
+        print("note: lockdep is not enabled in this kernel, locking bugs may go unnoticed")
+
+    makedirs(WORKDIR, exist_ok=True)
+    for path in (ALLOWED, DENIED):
+        open(path, "w").close()
+
+    known = {r[0] for r in read_rules()}
+    add_rules(probe_rules())
+    probes = [r for r in read_rules() if r[0] not in known]
+    deny_probe = next(r for r in probes if r[2] == "deny")
+
+    log = KernelLog()
+    log.start()
+    churner = Churn()
+    if churn:
+        churner.start()
+
+    steps = []
+    n = 1
+    while n < workers:
+        steps.append(n)
+        n *= 2
+    steps.append(workers)
+
+    failures = []
+    total_denied = 0
+    rate1 = None
+    print(f"{'workers':>8} {'ops/s':>12} {'speedup':>8} {'efficiency':>10}")
+    try:
+        for n in steps:
+            out, elapsed, crashed = run_step(n, ops, duration)
+            done = sum(sum(counts.values()) for counts, *_ in out)
+            rate = done / elapsed
+            rate1 = rate1 or rate
+            print(f"{n:>8} {rate:>12.0f} {rate / rate1:>8.2f} {rate / rate1 / n:>10.0%}")
+
+            if crashed:
+                failures.append(f"{crashed} of {n} workers crashed")
+            for counts, denied, wrong, nwrong, lost in out:
+                total_denied += denied
+                if nwrong:
+                    failures.append(f"{nwrong} wrong verdicts, e.g. {wrong}")
+                failures.extend(f"lost per-task update, {l}" for l in lost)
+    finally:
+        churner.stop.set()
+        if churn:
+            churner.join()
+        sleep(1) # late reports
+        log.stop.set()
+        log.join()
+
+        hits = next((r[5] for r in read_rules() if r[0] == deny_probe[0]), None)
+        for rule in probes:
+            del_rule(rule[0])
+
+    if hits is None:
+        failures.append("the denied probe rule disappeared")
+    elif hits - deny_probe[5] != total_denied:
+        failures.append(f"lost policy hits: {total_denied} denied, hit count grew by {hits - deny_probe[5]}")
+    if churn:
+        print(f"churn: {churner.rounds} reloads of {NOISE_RULES} rules")
+        failures.extend(f"churn failed: {e}" for e in churner.errors[:5])
+    if log.overruns:
+        print(f"warning: {log.overruns} kernel log records were overwritten before being checked")
+    failures.extend(f"kernel: {r}" for r in log.reports[:20])
+
+    if failures:
+        print("FAILED")
+        for f in failures:
+            print(" -", f)
+        exit(1)
+    print("OK")
+
+if __name__ == "__main__":
+    main()
@@ -14,6 +14,14 @@ fi
 
 pyinstaller --collect-all "six" -F src/tlsm-daemon.py
 
+# replays captures with the kernel's parser and matcher, built from the same sources
+REPLAY_SRC="replay/replay.c ../src/rule.c ../src/common.c ../src/glob.c"
+# checked first against the match cases of the KUnit suite
+gcc -O2 -Wall -I../src -o build-replay-test replay/replay-test.c $REPLAY_SRC || exit 1
+./build-replay-test || exit 1
+rm -f build-replay-test
+gcc -O2 -Wall -I../src -o dist/tlsm-replay replay/tlsm-replay.c $REPLAY_SRC || exit 1
+
 rm -rf build
 mkdir build
 
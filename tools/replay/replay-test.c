@@ -0,0 +1,98 @@
+/*
+ * replay-test - run the match cases of the KUnit suite (src/tlsm_kunit_cases.h) through tlsm-replay
+ *
+ * The rule each request matches and its verdict must be the ones the kernel gives, with the
+ * DFAs and rule by rule. Run by build.sh before packaging tlsm-replay.
+ *
+ * usage: replay-test
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "replay.h"
+#include "tlsm_kunit_cases.h"
+
+/**
+ * test_request - a captured request of a case, as capture_next() reads them
+ */
+static void test_request(const struct tlsm_match_case *c, struct tlsm_capture_record *rec, struct request *q)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->op = c->op;
+    rec->mode = c->mode;
+    rec->signal = c->signal;
+    rec->family = c->family;
+    rec->protocol = c->protocol;
+    rec->port = c->port;
+    rec->subject_len = strlen(c->subject);
+    rec->object_len = strlen(c->object);
+
+    q->rec = rec;
+    strcpy(q->subject, c->subject);
+    strcpy(q->object, c->object);
+}
+
+/**
+ * test_set - run the cases of a set
+ *
+ * Return: the number of cases that failed
+ */
+static int test_set(const struct tlsm_match_set *set)
+{
+    struct ruleset rs = {.name = set->name};
+    struct tlsm_capture_record rec;
+    struct request q;
+    int failed = 0;
+
+    for (int i = 0; i < set->nrules; i++)
+    {
+        if (ruleset_add(&rs, set->rules[i]) != 0)
+        {
+            printf("%s: rule \"%s\" rejected\n", set->name, set->rules[i]);
+            ruleset_free(&rs);
+            return set->ncases;
+        }
+    }
+    ruleset_compile(&rs);
+    if (!rs.compiled->subjects)
+        printf("%s: no DFA, only the rule by rule path is tested\n", set->name);
+
+    for (int i = 0; i < set->ncases; i++)
+    {
+        const struct tlsm_match_case *c = &set->cases[i];
+        u8 expected = c->rule < 0 ? REPLAY_UNMATCHED : rs.rules[c->rule].text.category;
+
+        test_request(c, &rec, &q);
+        int rule = ruleset_match(&rs, &q, c->mode);
+        u8 verdict = ruleset_verdict(&rs, &q);
+
+        struct tlsm_dfa *subjects = rs.compiled->subjects;
+        rs.compiled->subjects = NULL; // forces the rule by rule path
+        int slow = ruleset_match(&rs, &q, c->mode);
+        rs.compiled->subjects = subjects;
+
+        if (rule != c->rule || slow != c->rule || verdict != expected)
+        {
+            printf("%s: %s %s %s: rule %d (rule by rule %d), verdict %s, expected rule %d, verdict %s\n", set->name,
+                   c->subject, tlsm_ops2str(c->op), c->object, rule, slow, tlsm_cat2str(verdict), c->rule, tlsm_cat2str(expected));
+            failed++;
+        }
+    }
+    ruleset_free(&rs);
+    return failed;
+}
+
+int main(void)
+{
+    int cases = 0;
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(tlsm_match_sets) / sizeof(tlsm_match_sets[0]); i++)
+    {
+        cases += tlsm_match_sets[i].ncases;
+        failed += test_set(&tlsm_match_sets[i]);
+    }
+    printf("replay-test: %d of %d cases failed\n", failed, cases);
+    return failed != 0;
+}
@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "replay.h"
+
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
+
+void *xcalloc(size_t n, size_t size)
+{
+    void *p = calloc(n ? n : 1, size);
+    if (!p)
+    {
+        perror("tlsm-replay");
+        exit(1);
+    }
+    return p;
+}
+
+static u64 elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000000ULL + end->tv_nsec - start->tv_nsec;
+}
+
+static u64 timer_overhead_ns; // of the clock reads around a match, not counted in its cost
+
+void timer_calibrate(void)
+{
+    struct timespec start, end;
+    u64 total = 0;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        total += elapsed_ns(&start, &end);
+    }
+    timer_overhead_ns = total / 1000;
+}
+
+/* Loading, as add_policy */
+
+/**
+ * ruleset_add - parse a rule with tlsm_rule_parse(), as parse_policy() does
+ *
+ * Return: 0 on success, -1 if TLSM would reject the rule
+ */
+int ruleset_add(struct ruleset *rs, const char *line)
+{
+    if (rs->count == rs->alloc)
+    {
+        rs->alloc = rs->alloc ? 2 * rs->alloc : 64;
+        rs->rules = realloc(rs->rules, rs->alloc * sizeof(*rs->rules));
+        if (!rs->rules)
+        {
+            perror("tlsm-replay");
+            exit(1);
+        }
+    }
+
+    struct replay_rule *r = &rs->rules[rs->count];
+    memset(r, 0, sizeof(*r));
+    r->line = strdup(line);
+    r->words = strdup(line);
+    if (!r->line || !r->words)
+    {
+        perror("tlsm-replay");
+        exit(1);
+    }
+    if (tlsm_rule_parse(r->words, REPLAY_DFA_MAX_STATES, &r->text) != 0)
+    {
+        free(r->line);
+        free(r->words);
+        return -1;
+    }
+    rs->count++;
+    return 0;
+}
+
+/**
+ * ruleset_compile - compile the rules added, as tlsm_ruleset_compile() does
+ */
+void ruleset_compile(struct ruleset *rs)
+{
+    size_t strings = 0;
+    u32 nports = 0;
+
+    for (u32 i = 0; i < rs->count; i++)
+    {
+        const struct tlsm_rule_text *t = &rs->rules[i].text;
+
+        strings += t->subject_len + 1;
+        if (t->object)
+            strings += t->object_len + 1;
+        if (t->target)
+            strings += t->target_len + 1;
+        nports += t->opts.nports;
+    }
+
+    size_t size = tlsm_ruleset_bytes(rs->count, nports, strings);
+    rs->compiled = xcalloc(1, sizeof(*rs->compiled) + size);
+    rs->compiled->size = size;
+    tlsm_ruleset_init(rs->compiled, rs->count, nports);
+    // rules are identified by their line, subjects by their string
+    for (u32 i = 0; i < rs->count; i++)
+    {
+        tlsm_ruleset_add(rs->compiled, i, 0, &rs->rules[i].text);
+        rs->op_rules[rs->rules[i].text.op]++;
+    }
+    if (!rs->count)
+        return;
+
+    struct tlsm_glob *globs = xcalloc(rs->count, sizeof(*globs));
+    int err = tlsm_ruleset_dfas(rs->compiled, globs, REPLAY_DFA_MAX_STATES);
+    if (err)
+        fprintf(stderr, "tlsm-replay: %s rules do not fit in DFAs (%d), they are matched one by one as TLSM would\n", rs->name, err);
+    if (rs->compiled->subjects)
+        rs->scratch = xcalloc(rs->compiled->scratch_words, sizeof(unsigned long));
+    free(globs);
+}
+
+/**
+ * ruleset_load - read and compile a rules file
+ *
+ * Return: 0 on success, -1 if the file cannot be read or TLSM would reject it (one write of
+ *         several rules adds all of them or none)
+ */
+int ruleset_load(struct ruleset *rs, const char *name, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+
+    if (!f)
+    {
+        fprintf(stderr, "tlsm-replay: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    rs->name = name;
+    while ((len = getline(&line, &cap, f)) >= 0)
+    {
+        if (len && line[len - 1] == '\n')
+            line[--len] = '\0';
+        if (!len || line[0] == '#')
+            continue;
+
+        if (ruleset_add(rs, line) != 0)
+        {
+            fprintf(stderr, "tlsm-replay: %s: TLSM would reject \"%s\"\n", path, line);
+            free(line);
+            fclose(f);
+            return -1;
+        }
+    }
+    free(line);
+    fclose(f);
+
+    ruleset_compile(rs);
+    return 0;
+}
+
+void ruleset_free(struct ruleset *rs)
+{
+    for (u32 i = 0; i < rs->count; i++)
+    {
+        free(rs->rules[i].line);
+        free(rs->rules[i].words);
+    }
+    free(rs->rules);
+    if (rs->compiled)
+    {
+        tlsm_dfa_free(rs->compiled->subjects);
+        for (int op = 0; op < TLSM_OPS_LEN; op++)
+            tlsm_dfa_free(rs->compiled->objects[op]);
+    }
+    free(rs->compiled);
+    free(rs->scratch);
+}
+
+/* Matching, with tlsm_ruleset_match_dfa() or tlsm_ruleset_match_slow() as the kernel */
+
+/**
+ * bits_before - set bits of a bitmap below end
+ */
+static u64 bits_before(const unsigned long *map, u32 end)
+{
+    u64 n = 0;
+
+    for (u32 w = 0; w < end / BITS_PER_LONG; w++)
+        n += __builtin_popcountl(map[w]);
+    if (end % BITS_PER_LONG)
+        n += __builtin_popcountl(map[end / BITS_PER_LONG] & ((1UL << (end % BITS_PER_LONG)) - 1));
+    return n;
+}
+
+/**
+ * ruleset_match - first rule of a ruleset applying to a request, for some of its modes
+ *
+ * Return: the index of the rule, -1 if none applies
+ */
+int ruleset_match(struct ruleset *rs, const struct request *q, u8 mode)
+{
+    const struct tlsm_ruleset *c = rs->compiled;
+    const struct tlsm_capture_record *rec = q->rec;
+    struct tlsm_rule_request req = {
+        .op = rec->op,
+        .subject = q->subject,
+        .object = q->object,
+        .mode = mode,
+        .signal = rec->signal,
+        .target = rec->object_len ? q->object : NULL, // the receiver's executable
+        .family = rec->family,
+        .protocol = rec->protocol,
+        .port = rec->port,
+    };
+    bool dfa = c->subjects && c->objects[rec->op];
+    const struct tlsm_rule *r;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (dfa)
+        r = tlsm_ruleset_match_dfa(c, &req, rs->scratch);
+    else
+        r = tlsm_ruleset_match_slow(c, &req);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    u64 ns = elapsed_ns(&start, &end);
+    rs->ns[rec->op] += ns > timer_overhead_ns ? ns - timer_overhead_ns : 0;
+
+    // rules looked at: up to the match, those the object DFA gave or those of the operation
+    u32 last = r ? r - c->rules + 1 : c->count;
+    if (dfa)
+    {
+        rs->examined[rec->op] += bits_before(rs->scratch + c->subjects->nwords, last);
+        rs->scanned[rec->op] += strlen(q->subject) + strlen(q->object);
+    }
+    else
+    {
+        for (u32 i = 0; i < last; i++)
+        {
+            if (c->rules[i].category == TLSM_ANALYZE || c->rules[i].op == rec->op)
+                rs->examined[rec->op]++;
+        }
+    }
+    return r ? (int)(r - c->rules) : -1;
+}
+
+/* ranks of the verdicts, to sum up the policies deciding the modes of one open */
+static int verdict_rank(u8 category)
+{
+    static const int rank[] = {[TLSM_ALLOW] = 1, [TLSM_DENY] = 4, [TLSM_ASK] = 3, [TLSM_ANALYZE] = 2, [TLSM_UNDEFINED] = 0};
+    return rank[category];
+}
+
+/**
+ * ruleset_verdict - category of the rule deciding a request, REPLAY_UNMATCHED if none does
+ *
+ * Opens are split as autorize_file_modes() splits them: each rule decides the modes it covers,
+ * latent ones included, and the strongest verdict for the modes in use is the request's.
+ */
+u8 ruleset_verdict(struct ruleset *rs, const struct request *q)
+{
+    const struct tlsm_capture_record *rec = q->rec;
+    u8 verdict = REPLAY_UNMATCHED;
+
+    rs->requests[rec->op]++;
+    // tlsm_rules_for_op(), nothing to match
+    if (!rs->op_rules[rec->op] && !rs->op_rules[TLSM_OP_UNDEFINED])
+        return verdict;
+
+    if (rec->op != TLSM_FILE_OPEN)
+    {
+        int i = ruleset_match(rs, q, 0);
+        if (i >= 0)
+        {
+            rs->rules[i].hits++;
+            verdict = rs->rules[i].text.category;
+        }
+        return verdict;
+    }
+
+    u8 checked = 0;
+    u8 todo = rec->mode | rec->latent;
+
+    while (todo & rec->mode)
+    {
+        int i = ruleset_match(rs, q, todo);
+        u8 covered = todo;
+
+        if (i >= 0)
+        {
+            const struct tlsm_rule_text *t = &rs->rules[i].text;
+
+            if (t->category != TLSM_ANALYZE)
+                covered &= t->opts.modes;
+            rs->rules[i].hits++;
+            if ((covered & rec->mode) && verdict_rank(t->category) > verdict_rank(verdict))
+                verdict = t->category;
+        }
+        checked |= covered;
+        todo = rec->mode & ~checked;
+    }
+    return verdict;
+}
@@ -0,0 +1,57 @@
+#ifndef _TLSM_REPLAY_H
+#define _TLSM_REPLAY_H
+
+/* rulesets as tlsm-replay loads and matches them: parsed, compiled and matched by src/rule.c,
+ * the code the kernel runs. Policies of cgroups are not modelled. */
+
+#include "rule.h"
+#include "capture.h"
+
+#define REPLAY_DFA_MAX_STATES 16384 // CONFIG_SECURITY_TLSM_DFA_MAX_STATES default
+
+#define REPLAY_UNMATCHED TLSM_UNDEFINED // verdict of a request no rule applies to, allowed
+
+struct replay_rule
+{
+    char *line;  // as read, for the report
+    char *words; // copy of the line split by tlsm_rule_parse(), the text points into it
+    struct tlsm_rule_text text;
+    u64 hits;
+};
+
+struct ruleset
+{
+    const char *name;
+    struct replay_rule *rules;
+    u32 count;
+    u32 alloc;
+    u32 op_rules[TLSM_OPS_LEN]; // per op, analyze rules under TLSM_OP_UNDEFINED (tlsm_rules_for_op)
+    struct tlsm_ruleset *compiled; // by ruleset_compile()
+    unsigned long *scratch;        // bitmaps of tlsm_ruleset_match_dfa()
+
+    // matching cost, per op
+    u64 requests[TLSM_OPS_LEN];
+    u64 examined[TLSM_OPS_LEN]; // rules looked at after the DFAs, or one by one without them
+    u64 scanned[TLSM_OPS_LEN];  // bytes run through the DFAs
+    u64 ns[TLSM_OPS_LEN];
+};
+
+/* a captured request, its strings NUL terminated */
+struct request
+{
+    const struct tlsm_capture_record *rec;
+    char subject[TLSM_CAPTURE_MAX_STR + 1];
+    char object[TLSM_CAPTURE_MAX_STR + 1];
+};
+
+void *xcalloc(size_t n, size_t size);
+void timer_calibrate(void);
+
+int ruleset_add(struct ruleset *rs, const char *line);
+void ruleset_compile(struct ruleset *rs);
+int ruleset_load(struct ruleset *rs, const char *name, const char *path);
+int ruleset_match(struct ruleset *rs, const struct request *q, u8 mode);
+u8 ruleset_verdict(struct ruleset *rs, const struct request *q);
+void ruleset_free(struct ruleset *rs);
+
+#endif // _TLSM_REPLAY_H
@@ -0,0 +1,238 @@
+/*
+ * tlsm-replay - evaluate rulesets against a capture of access requests, offline
+ *
+ * Rules are read one per line, as they are written to /sys/kernel/security/tlsm/add_policy,
+ * and parsed, compiled and matched by the kernel's own code (src/rule.c and src/glob.c, see
+ * replay.c): first match in load order, with the same subject and object DFAs. Policies of
+ * cgroups are not modelled.
+ *
+ * usage: tlsm-replay [-c <current rules>] [-n <examples>] <candidate rules> <capture>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "replay.h"
+
+#define REPLAY_EXAMPLES 20 // changed verdicts printed, unless -n is given
+
+/* Capture */
+
+static char *capture_load(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "r");
+    struct tlsm_capture_header h;
+    char *data = NULL;
+    size_t cap = 0;
+    size_t n;
+
+    if (!f)
+    {
+        fprintf(stderr, "tlsm-replay: cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, TLSM_CAPTURE_MAGIC, sizeof(h.magic)) ||
+        h.version != TLSM_CAPTURE_VERSION || h.record_size != sizeof(struct tlsm_capture_record))
+    {
+        fprintf(stderr, "tlsm-replay: %s is not a TLSM capture of version %d\n", path, TLSM_CAPTURE_VERSION);
+        fclose(f);
+        return NULL;
+    }
+
+    *size = 0;
+    do
+    {
+        if (*size == cap)
+        {
+            cap = cap ? 2 * cap : 1 << 20;
+            data = realloc(data, cap);
+            if (!data)
+            {
+                perror("tlsm-replay");
+                exit(1);
+            }
+        }
+        n = fread(data + *size, 1, cap - *size, f);
+        *size += n;
+    } while (n);
+    fclose(f);
+    return data;
+}
+
+/**
+ * capture_next - the request at an offset of a capture
+ *
+ * Return: the offset of the next request, 0 at the end or on a truncated record
+ */
+static size_t capture_next(const char *data, size_t size, size_t off, struct request *q)
+{
+    const struct tlsm_capture_record *rec = (const void *)(data + off);
+
+    if (off + sizeof(*rec) > size || rec->size < sizeof(*rec) || off + rec->size > size)
+        return 0;
+    if (sizeof(*rec) + rec->subject_len + rec->object_len > rec->size || rec->op == TLSM_OP_UNDEFINED || rec->op >= TLSM_OPS_LEN)
+        return 0;
+
+    q->rec = rec;
+    memcpy(q->subject, rec + 1, rec->subject_len);
+    q->subject[rec->subject_len] = '\0';
+    memcpy(q->object, (const char *)(rec + 1) + rec->subject_len, rec->object_len);
+    q->object[rec->object_len] = '\0';
+    return off + rec->size;
+}
+
+/* Report */
+
+static const char *verdict_str(u8 category)
+{
+    return category == REPLAY_UNMATCHED ? "unmatched" : category2str[category].str;
+}
+
+static void report_hits(const struct ruleset *rs)
+{
+    printf("\nrule hits (%s ruleset, %u rules)\n", rs->name, rs->count);
+    for (const struct replay_rule *r = rs->rules; r < rs->rules + rs->count; r++)
+        printf("%12" PRIu64 "  %s%s\n", r->hits, r->line, r->hits ? "" : "  (never matched)");
+}
+
+static void report_cost(const struct ruleset *rs)
+{
+    printf("\nmatching cost per request (%s ruleset)\n", rs->name);
+    printf("%-10s %12s %14s %14s %10s\n", "op", "requests", "rules looked", "bytes scanned", "ns");
+    for (int op = 1; op < TLSM_OPS_LEN; op++)
+    {
+        if (!rs->requests[op])
+            continue;
+        double n = rs->requests[op];
+        printf("%-10s %12" PRIu64 " %14.2f %14.1f %10.1f\n", op2data[op].str, rs->requests[op],
+               rs->examined[op] / n, rs->scanned[op] / n, rs->ns[op] / n);
+    }
+}
+
+/**
+ * parse_count - strict decimal number of the command line
+ */
+static bool parse_count(const char *s, unsigned long *n)
+{
+    char *end;
+
+    if (*s < '0' || *s > '9')
+        return false;
+    errno = 0;
+    *n = strtoul(s, &end, 10);
+    return !errno && !*end && *n <= UINT32_MAX;
+}
+
+static void print_help(void)
+{
+    fprintf(stderr, "usage: tlsm-replay [-c <current rules>] [-n <examples>] <candidate rules> <capture>\n");
+    fprintf(stderr, "rules are one per line, as written to add_policy; captures are saved by \"tlsm-py capture\"\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct ruleset current = {};
+    struct ruleset candidate = {};
+    const char *current_path = NULL;
+    unsigned long examples = REPLAY_EXAMPLES;
+    u64 changed[TLSM_UNDEFINED + 1][TLSM_UNDEFINED + 1] = {};
+    u64 ops[TLSM_OPS_LEN] = {};
+    u64 requests = 0;
+    u64 first_ns = 0, last_ns = 0;
+    struct request *q = xcalloc(1, sizeof(*q));
+    size_t size;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:h")) != -1)
+    {
+        if (opt == 'c')
+            current_path = optarg;
+        else if (opt == 'n' && parse_count(optarg, &examples))
+            continue;
+        else
+        {
+            print_help();
+            return 2;
+        }
+    }
+    if (argc - optind != 2)
+    {
+        print_help();
+        return 2;
+    }
+
+    if (ruleset_load(&candidate, "candidate", argv[optind]) != 0)
+        return 1;
+    if (current_path && ruleset_load(&current, "current", current_path) != 0)
+        return 1;
+    char *data = capture_load(argv[optind + 1], &size);
+    if (!data)
+        return 1;
+
+    timer_calibrate();
+    if (current_path)
+        printf("examples of changed verdicts (current -> candidate)\n");
+    size_t off = 0;
+    size_t next;
+    while ((next = capture_next(data, size, off, q)) != 0)
+    {
+        off = next;
+        if (!requests++)
+            first_ns = q->rec->time_ns;
+        last_ns = q->rec->time_ns;
+        ops[q->rec->op]++;
+
+        u8 after = ruleset_verdict(&candidate, q);
+        if (!current_path)
+            continue;
+        u8 before = ruleset_verdict(&current, q);
+        if (before == after)
+            continue;
+        if (!changed[before][after]++ || examples)
+        {
+            // the first change of each kind, then the first ones of any kind
+            if (examples)
+                examples--;
+            printf("  %s -> %s: %s %s %s\n", verdict_str(before), verdict_str(after), q->subject, op2data[q->rec->op].str, q->object);
+        }
+    }
+    if (off != size)
+        fprintf(stderr, "tlsm-replay: capture truncated after %" PRIu64 " requests\n", requests);
+
+    printf("\ncapture: %" PRIu64 " requests over %.1fs", requests, (last_ns - first_ns) / 1e9);
+    for (int op = 1; op < TLSM_OPS_LEN; op++)
+    {
+        if (ops[op])
+            printf(", %s %" PRIu64, op2data[op].str, ops[op]);
+    }
+    printf("\n");
+
+    if (current_path)
+    {
+        printf("\nverdict changes (current -> candidate)\n");
+        for (int a = 0; a <= TLSM_UNDEFINED; a++)
+        {
+            for (int b = 0; b <= TLSM_UNDEFINED; b++)
+            {
+                if (changed[a][b])
+                    printf("%12" PRIu64 "  %s -> %s\n", changed[a][b], verdict_str(a), verdict_str(b));
+            }
+        }
+    }
+
+    report_hits(&candidate);
+    if (current_path)
+        report_cost(&current);
+    report_cost(&candidate);
+
+    free(data);
+    free(q);
+    ruleset_free(&candidate);
+    ruleset_free(&current);
+    return 0;
+}
@@ -1,10 +1,13 @@
 #!/usr/bin/python
 
-from os import mkdir, getuid, listdir, getpid, write
+from os import mkdir, getuid, geteuid, listdir, getpid, write, read, close, cpu_count
+from os import open as os_open, O_RDONLY, O_WRONLY
 from os.path import join, isfile, isdir
 from sys import argv, stdout, stdin, exit
-from time import sleep
-from queue import Queue, Full, ShutDown
+from time import sleep, monotonic
+from collections import deque
+from array import array
+import importlib.util
 import signal
 import threading
 import subprocess
@@ -24,6 +27,9 @@ class TLSM_OPS(IntEnum):
     TLSM_SOCKET_CONNECT = 3
     TLSM_SIGNAL = 4
     TLSM_EXECVE = 5
+    TLSM_SOCKET_SEND = 6
+
+OP_NAMES = ["undefined", "open", "bind", "connect", "signal", "execve", "send"] # op2data, in TLSM_OPS order
 
 class Stats:
     def __init__(self, stat_list):
@@ -61,9 +67,104 @@ TAG_REQD = term_colors.BOLD + term_colors.FAIL + "[REQ]" + term_colors.ENDC
 
 SYSFS_ROOT = "/sys/kernel/security/tlsm/"
 WATCHDOG_REGISTER_ENDPOINT = join(SYSFS_ROOT, "add_watchdog")
-USER_REQUEST_PATH = join(SYSFS_ROOT, "user_" + str(getuid()))
 
-request_queue = Queue()
+def user_request_path(uid):
+    return join(SYSFS_ROOT, f"user_{uid}")
+
+REQUEST_READ_SIZE = 4096 # requests are read until EOF, subject and object can be PATH_MAX long each
+BATCH_MAX = 256 # pending requests handled together, the others wait for the next batch
+TENANT_QUEUE_MAX = 4 * BATCH_MAX # per uid, the kernel bounds them too (max_pending_per_uid)
+WATCHDOG_SIGNAL = 36 # TLSM_WATCHDOG_SIGNAL (src/utils.h), realtime: one queued signal per request
+RESCAN_INTERVAL = 5 # seconds, requests whose signal could not be queued are found by a scan
+
+# what answers the supervised (ask) requests of a user, analyze ones always go to the model
+HANDLERS = ("ask", "model", "allow", "deny")
+
+class Tenants:
+    """Users served by this tlsmd and the handler of each, "<uids>=<handler>" rules"""
+    def __init__(self, default_handler):
+        self.rules = [] # (lo, hi, handler), first match wins
+        self.default = default_handler # None: only the uids of the rules are served
+
+    def add(self, spec):
+        uids, _, handler = spec.partition("=")
+        if handler not in HANDLERS:
+            raise ValueError(f"unknown handler {handler!r}, one of {', '.join(HANDLERS)}")
+        for r in uids.split(","):
+            lo, _, hi = r.partition("-")
+            self.rules.append((int(lo), int(hi or lo), handler))
+
+    def handler(self, uid):
+        for lo, hi, handler in self.rules:
+            if lo <= uid <= hi:
+                return handler
+        return self.default
+
+    def register_spec(self):
+        """uids to give add_watchdog, "*" for every user"""
+        if self.default is not None:
+            return "*"
+        return ",".join(f"{lo}-{hi}" if lo != hi else str(lo) for lo, hi, _ in self.rules)
+
+class TenantQueue:
+    """Pending request numbers of each user. Workers take them round-robin across users, so a
+    flooding user only delays its own requests"""
+    def __init__(self, tenant_max):
+        self.cond = threading.Condition()
+        self.pending = dict()  # uid -> deque of request numbers
+        self.active = deque()  # uids with pending requests, in round-robin order
+        self.known = set()     # (uid, number) queued or being handled, a request can be both
+                               # signaled and found by a scan
+        self.rescan = set()    # uids that overflowed: their folder is rescanned once drained
+        self.tenant_max = tenant_max
+        self.closed = False
+
+    def put(self, uid, number):
+        with self.cond:
+            if (uid, number) in self.known:
+                return
+            q = self.pending.setdefault(uid, deque())
+            if len(q) >= self.tenant_max:
+                # the request file is still there, nothing is lost
+                self.rescan.add(uid)
+                return
+            if not q:
+                self.active.append(uid)
+            q.append(number)
+            self.known.add((uid, number))
+            self.cond.notify()
+
+    def take(self, max_reqs):
+        """Block until there are requests, then take up to max_reqs of them, one per user in
+        turn. Returns [] once shut down"""
+        with self.cond:
+            while not self.active and not self.closed:
+                self.cond.wait()
+            taken = []
+            while self.active and len(taken) < max_reqs:
+                uid = self.active.popleft()
+                q = self.pending[uid]
+                taken.append((uid, q.popleft()))
+                if q:
+                    self.active.append(uid)
+            return taken
+
+    def done(self, taken):
+        """Forget handled requests, returns the users whose folder must be rescanned"""
+        with self.cond:
+            self.known.difference_update(taken)
+            drained = [uid for uid in self.rescan if not self.pending.get(uid)]
+            self.rescan.difference_update(drained)
+            return drained
+
+    def shutdown(self):
+        with self.cond:
+            self.closed = True
+            self.cond.notify_all()
+
+tenants = None
+request_queue = TenantQueue(TENANT_QUEUE_MAX)
+term_lock = threading.Lock() # one question at a time on the terminal
 
 notify=True
 
@@ -77,148 +178,296 @@ def send_notify(req_str: str):
     except Exception as e:
         print(f"{TAG_WARN} libnotify failed. cannot send desktop notification. ({e})")
 
-def register_watchdog(uid):
+def register_watchdog(uids):
     try:
-        print(f"{TAG_INFO} Registering watchdog for user {uid} via securityfs")
+        print(f"{TAG_INFO} Registering watchdog for users {uids} via securityfs")
         f = open(WATCHDOG_REGISTER_ENDPOINT, 'w')
-        f.write(f"{getpid()} {uid}")
+        f.write(f"{getpid()} {uids}")
         f.close()    
     except Exception as e:
         print(f"{TAG_ERR} Failed to register watchdog", str(e))
 
-def answer_request(path, value, score_delta):
+def answer_request(path, value, score_delta, verbose=True):
     try:
-        print(f"{TAG_INFO} Answering request via securityfs")
-        f = open(path, 'w')
-        f.write(f"{value} {score_delta}")
-        f.close()
-        if value != ALLOW_STR:
+        if verbose:
+            print(f"{TAG_INFO} Answering request via securityfs")
+        fd = os_open(path, O_WRONLY)
+        try:
+            write(fd, f"{value} {score_delta}".encode())
+        finally:
+            close(fd)
+        if verbose and value != ALLOW_STR:
             print(f"{TAG_REQD} DENYING REQUEST")
-        else:
+        elif verbose:
             print(f"{TAG_REQ} ALLOWING REQUEST")
     except Exception as e:
         print(f"{TAG_WARN} Failed to write to request file. Request probably timed out (denied by default)\n", str(e))
 
-def analyze_request(req_str: str, stats: Stats, score: int):
-    print("perform autonomous analysis of request / malware detection / classification model here")
-    if(score < 50):
-        return (DENY_STR, 0) # deny
-    else:
-        return (ALLOW_STR, -5)
+class Request:
+    """A pending request, as serialized by tlsm_req_read()"""
+    __slots__ = ("path", "uid", "supervized", "score", "req_str", "subject", "op", "stats")
 
-        
-def process_request(path):
-    print(f"{TAG_REQ} Got request: ", path)
+def read_request(path, uid):
+    """Read and parse a request file, None if it is gone (timed out) or malformed"""
     try:
-        f = open(path)
-        req_str_list = f.read().strip('\n').split('\n')
-        f.close()
-        
-        supervized = req_str_list[0].split(" ")[0] == '1'
-        score = int(req_str_list[0].split(" ")[1])
-        req_str = req_str_list[1]
-        stats = Stats([[int(i) for i in d.split(" ")] for d in req_str_list[2:]])
-        print(term_colors.BOLD + "-> " + req_str + f" (score: {score})" + term_colors.ENDC)
-        # print(stats)
-
-        answer = DENY_STR
-        score_delta = 0
-        if supervized: # ask the human
-            if notify:
-                send_notify(req_str)
-            termios.tcflush(stdin, termios.TCIOFLUSH) # flush stdin before input
-            answer = input(f"{term_colors.BOLD}Allow ? y/n{term_colors.ENDC}: ")
-            answer = ALLOW_STR if answer in ['y', 'Y', ''] else DENY_STR
-        
-            termios.tcflush(stdin, termios.TCIOFLUSH) # flush stdin before input
-            sd_str = input(f"{term_colors.BOLD}Score update ? (default 0){term_colors.ENDC}: ")
-            if sd_str != '':
-                try:
-                    score_delta = int(sd_str)
-                except:
-                    print(f"{TAG_ERR} Failed to parse provided score.")
-
-        else: # ask the machine
-            (answer, score_delta) = analyze_request(req_str, stats, score)
-
-        answer_request(path, answer, score_delta)
+        fd = os_open(path, O_RDONLY)
+        try:
+            data = b""
+            while chunk := read(fd, REQUEST_READ_SIZE): # up to 2 PATH_MAX paths and the stats
+                data += chunk
+        finally:
+            close(fd)
+        lines = data.decode(errors="replace").split("\n")
+        req = Request()
+        req.path = path
+        req.uid = uid
+        head = lines[0].split(" ")
+        req.supervized = head[0] == '1'
+        req.score = int(head[1])
+        req.req_str = lines[1]
+        # "<subject> trying to <op> <object>"
+        req.subject, _, rest = req.req_str.partition(" trying to ")
+        op = rest.split(" ", 1)[0]
+        req.op = OP_NAMES.index(op) if op in OP_NAMES else 0
+        req.stats = [int(i) for d in lines[2:2 + len(TLSM_OPS)] for i in d.split(" ")]
+        if len(req.stats) != 2 * len(TLSM_OPS):
+            raise ValueError("truncated stats")
+        return req
+    except Exception as e:
+        print(f"{TAG_ERR} Failed to read request file {path}, probably timeout. {e}")
+        return None
+
+# one row per request: score, op, subject (index in AnalysisBatch.subjects), then
+# (deny, total) for each operation, as in tlsm_task_security.stats
+FEATURE_SCORE = 0
+FEATURE_OP = 1
+FEATURE_SUBJECT = 2
+FEATURE_STATS = 3
+FEATURES = FEATURE_STATS + 2 * len(TLSM_OPS)
+
+class AnalysisBatch:
+    """Feature vectors of the pending analyze requests, FEATURES integers per request"""
+    def __init__(self):
+        self.features = array('q')
+        self.subjects = [] # distinct subjects of the batch
+        self.subject_index = dict()
+        self.requests = []
+
+    def add(self, req: Request):
+        subject = self.subject_index.setdefault(req.subject, len(self.subjects))
+        if subject == len(self.subjects):
+            self.subjects.append(req.subject)
+        self.features.extend((req.score, req.op, subject))
+        self.features.extend(req.stats)
+        self.requests.append(req)
+
+    def __len__(self):
+        return len(self.requests)
+
+    def row(self, i):
+        return self.features[i * FEATURES:(i + 1) * FEATURES]
 
+class ThresholdModel:
+    """Default scoring model: trust the score TLSM keeps for the task"""
+    def score_batch(self, batch: AnalysisBatch):
+        answers = []
+        features = batch.features
+        for i in range(0, len(features), FEATURES):
+            if features[i + FEATURE_SCORE] < 50:
+                answers.append((DENY_STR, 0))
+            else:
+                answers.append((ALLOW_STR, -5))
+        return answers
+
+# anything with score_batch(batch) -> [(ALLOW_STR or DENY_STR, score delta)] in batch order
+model = ThresholdModel()
+
+def load_model(path):
+    """Load a scoring model from a python file defining score_batch(batch)"""
+    spec = importlib.util.spec_from_file_location("tlsmd_model", path)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    if not callable(getattr(module, "score_batch", None)):
+        raise ValueError(f"{path} does not define score_batch(batch)")
+    return module
+
+def analyze_batch(batch: AnalysisBatch):
+    """Score every analyze request of the batch in one model call, then answer them"""
+    try:
+        answers = model.score_batch(batch)
+        if len(answers) != len(batch):
+            raise ValueError(f"{len(answers)} answers for {len(batch)} requests")
     except Exception as e:
-        print(f"{TAG_ERR} Failed to open request file, probably timeout. {e}")
+        # unanswered requests get TLSM's default verdict
+        print(f"{TAG_ERR} Scoring model failed on {len(batch)} requests. {e}")
+        return
+
+    denied = 0
+    for req, (answer, score_delta) in zip(batch.requests, answers):
+        answer_request(req.path, answer, score_delta, verbose=False)
+        denied += answer != ALLOW_STR
+    print(f"{TAG_REQ} analyzed {len(batch)} requests of {len(batch.subjects)} programs, {denied} denied")
+
+def ask_user(req: Request):
+    with term_lock:
+        __ask_user(req)
 
-def request_scan(user_request_fpath):
-    files = [ join(user_request_fpath, f) for f in listdir(user_request_fpath) if isfile(join(user_request_fpath, f))]
-    for f in files:
-        print("Found request file", f)
+def __ask_user(req: Request):
+    print(term_colors.BOLD + "-> " + req.req_str + f" (score: {req.score})" + term_colors.ENDC)
+
+    answer = DENY_STR
+    score_delta = 0
+    if notify:
+        send_notify(req.req_str)
+    termios.tcflush(stdin, termios.TCIOFLUSH) # flush stdin before input
+    answer = input(f"{term_colors.BOLD}Allow ? y/n{term_colors.ENDC}: ")
+    answer = ALLOW_STR if answer in ['y', 'Y', ''] else DENY_STR
+
+    termios.tcflush(stdin, termios.TCIOFLUSH) # flush stdin before input
+    sd_str = input(f"{term_colors.BOLD}Score update ? (default 0){term_colors.ENDC}: ")
+    if sd_str != '':
         try:
-            request_queue.put_nowait(f.rsplit("_", 1)[1])
-        except Full:
-            print(f"{TAG_WARN} Request queue is full. Requests will be dropped")
+            score_delta = int(sd_str)
+        except:
+            print(f"{TAG_ERR} Failed to parse provided score.")
 
-def sig_handler(signum, frame):
-    write(stdout.fileno(), b"[ERROR] Oops, something went wrong. This handler shouldn't have been called")
+    answer_request(req.path, answer, score_delta)
 
-def fs_scan(uid: int):
-    if isdir(USER_REQUEST_PATH):
-        request_scan(USER_REQUEST_PATH)
-    else:
-        print(f"{TAG_WARN} tlsmd: {USER_REQUEST_PATH} folder does not exist yet")
+def process_requests(taken):
+    """Answer a batch of requests: analyze ones first, they do not wait for a human"""
+    batch = AnalysisBatch()
+    supervized = []
+    for uid, number in taken:
+        path = join(user_request_path(uid), f"request_{number}")
+        print(f"{TAG_REQ} Got request: ", path)
+        req = read_request(path, uid)
+        if req is None:
+            continue
+        handler = tenants.handler(uid)
+        if not req.supervized or handler == "model": # ask the machine
+            batch.add(req)
+        elif handler == "ask": # ask the human
+            supervized.append(req)
+        else:
+            answer_request(req.path, ALLOW_STR if handler == "allow" else DENY_STR, 0)
+
+    if len(batch):
+        analyze_batch(batch)
+    for req in supervized:
+        ask_user(req)
+
+def request_scan(uid):
+    folder = user_request_path(uid)
+    for f in listdir(folder):
+        if isfile(join(folder, f)) and f.startswith("request_"):
+            print("Found request file", join(folder, f))
+            request_queue.put(uid, int(f.rsplit("_", 1)[1]))
+
+def fs_scan(uids=None):
+    """Queue the pending requests of some served users, of all of them if None"""
+    if uids is None:
+        uids = [int(d.split("_", 1)[1]) for d in listdir(SYSFS_ROOT) if d.startswith("user_")]
+    for uid in uids:
+        if tenants.handler(uid) is None:
+            continue
+        if isdir(user_request_path(uid)):
+            request_scan(uid)
+        else:
+            print(f"{TAG_WARN} tlsmd: {user_request_path(uid)} folder does not exist yet")
 
 def queue_worker():
-    while not request_queue.is_shutdown:
+    while taken := request_queue.take(BATCH_MAX):
         try:
-            req = request_queue.get()
-            process_request(join(USER_REQUEST_PATH, f"request_{req}"))
-        except ShutDown:
-            break
+            process_requests(taken)
+        except Exception as e:
+            print(f"{TAG_ERR} Failed to handle {len(taken)} requests. {e}")
+        fs_scan(request_queue.done(taken))
 
 def auth():
     username = input("Username : ")
     password = getpass()
     return pam.authenticate(username, password)
 
+def arg_values(name):
+    return [argv[i + 1] for i, a in enumerate(argv[:-1]) if a == name]
+
 def main():
+    global tenants
 
     if "--no-notif" in argv:
         global notify
         notify = False
         print(f"{TAG_INFO} Dekstop notification disabled")
 
-    for i in range(3):
-        if(auth()):
-            break
-        else:
-            print(f"{TAG_ERR} Authentication failed.")
-        
-        if(i>=2): # if third attempt failed
+    if "--model" in argv:
+        global model
+        try:
+            model = load_model(argv[argv.index("--model") + 1])
+            print(f"{TAG_INFO} Using scoring model {argv[argv.index('--model') + 1]}")
+        except Exception as e:
+            print(f"{TAG_ERR} Failed to load scoring model. {e}")
             exit(1)
 
-           
-    uid = getuid()
-    print(f"{TAG_INFO} TLSMD running for user", uid)
-    t = threading.Thread(target=queue_worker)
-    t.start()
-    register_watchdog(uid)
-    signal.signal(signal.SIGUSR1, sig_handler) # actually will never be called 
-                                            # but necessary because not binding a handler 
-                                            # exits the program on reception of the signal
-    fs_scan(uid) # scan for pending requests fired before tlsmd was up
+    system = "--system" in argv
+    try:
+        if system:
+            # one tlsmd for the users of the --tenant rules, or for everyone with a default handler
+            default = arg_values("--default-handler")
+            tenants = Tenants(default[0] if default else None if arg_values("--tenant") else "ask")
+            if tenants.default not in HANDLERS + (None,):
+                raise ValueError(f"unknown handler {tenants.default!r}, one of {', '.join(HANDLERS)}")
+            for spec in arg_values("--tenant"):
+                tenants.add(spec)
+        else:
+            tenants = Tenants(None)
+            tenants.add(f"{getuid()}=ask")
+        workers = int(arg_values("--workers")[0]) if "--workers" in argv else (min(4, cpu_count() or 1) if system else 1)
+    except ValueError as e:
+        print(f"{TAG_ERR} {e}")
+        exit(1)
+
+    # root serving other users is checked by the kernel (CAP_SYS_ADMIN), no one to authenticate
+    if not (system and geteuid() == 0):
+        for i in range(3):
+            if(auth()):
+                break
+            else:
+                print(f"{TAG_ERR} Authentication failed.")
+            
+            if(i>=2): # if third attempt failed
+                exit(1)
+
+    if system:
+        print(f"{TAG_INFO} TLSMD running for users {tenants.register_spec()} with {workers} workers")
+    else:
+        print(f"{TAG_INFO} TLSMD running for user", getuid())
+    # blocked in every thread, so that signals stay queued until sigtimedwait takes them
+    signal.pthread_sigmask(signal.SIG_BLOCK, [WATCHDOG_SIGNAL])
+    threads = [threading.Thread(target=queue_worker) for _ in range(workers)]
+    for t in threads:
+        t.start()
+    register_watchdog(tenants.register_spec())
+    fs_scan() # scan for pending requests fired before tlsmd was up
+    next_scan = monotonic() + RESCAN_INTERVAL
     try:
         while True:
             try:
-                info = signal.sigwaitinfo([signal.SIGUSR1])
-                try:
-                    if info.si_pid == 0 and info.si_uid==0: #ensuring the signal has been sent by the kernel
-                        request_queue.put_nowait(info.si_status)
-                except Full:
-                    print(stdout, f"{TAG_WARN} request queue is FULL ! request will be lost !")
+                info = signal.sigtimedwait([WATCHDOG_SIGNAL], max(0, next_scan - monotonic()))
+                if monotonic() >= next_scan:
+                    # the kernel drops signals past RLIMIT_SIGPENDING, not the requests
+                    fs_scan()
+                    next_scan = monotonic() + RESCAN_INTERVAL
+                # ensuring the signal has been sent by the kernel, si_errno is the requester's uid
+                if info is not None and info.si_pid == 0 and info.si_uid==0 and tenants.handler(info.si_errno) is not None:
+                    request_queue.put(info.si_errno, info.si_status)
             except InterruptedError:
                 print("We were interrupted!")
                 break
     except KeyboardInterrupt as e:
         print(f"{TAG_INFO} received " + str(e))
         request_queue.shutdown()
-        t.join()
+        for t in threads:
+            t.join()
     
     print(term_colors.BOLD + "Goodbye." + term_colors.ENDC)
 
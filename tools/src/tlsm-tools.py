@@ -1,8 +1,12 @@
 #!/usr/bin/python
 
-from os import mkdir, getuid
+from os import mkdir, getuid, open as os_open, read as os_read, close as os_close, O_RDONLY, O_NONBLOCK
 from os.path import join
-from sys import argv
+from sys import argv, stdout
+from struct import pack
+from subprocess import run
+from tempfile import NamedTemporaryFile
+from time import monotonic, sleep
 
 class term_colors:
     HEADER = '\033[95m'
@@ -30,87 +34,597 @@ SYSFS_ROOT = "/sys/kernel/security/tlsm/"
 SYSFS_ADD = join(SYSFS_ROOT, "add_policy")
 SYSFS_DEL = join(SYSFS_ROOT, "del_policy")
 SYSFS_LIST = join(SYSFS_ROOT, "list_policies")
+SYSFS_LIST_RAW = join(SYSFS_ROOT, "list_policies_raw")
+SYSFS_CGROUP_ADD = join(SYSFS_ROOT, "cgroup_add_policy")
+SYSFS_CGROUP_DEL = join(SYSFS_ROOT, "cgroup_del_policy")
+SYSFS_CGROUP_LIST = join(SYSFS_ROOT, "cgroup_list_policies")
+SYSFS_STATS = join(SYSFS_ROOT, "stats")
+SYSFS_REQUESTS = join(SYSFS_ROOT, "requests")
+SYSFS_CAPTURE = join(SYSFS_ROOT, "capture")
+SYSFS_CAPTURE_STATUS = join(SYSFS_ROOT, "capture_status")
+CAPTURE_HEADER = b"TLSMCAP\0" + pack("=II", 1, 24) # struct tlsm_capture_header (src/capture.h)
+REPLAY = "tlsm-replay"
+MODULE_PARAMETERS = "/sys/module/tlsm/parameters"
+LIMITS = ("max_rules", "max_policy_memory_kb", "max_pending", "max_pending_per_uid", "max_pending_per_subject")
+
+cgroup = None # when set (--cgroup <path>), policies are managed for this cgroup v2 only
 
 def create_folders():
     mkdir(MAIN_FOLDER)
 
 def add_policy(policy: str):
+    endpoint = SYSFS_CGROUP_ADD if cgroup else SYSFS_ADD
     try:
-        f = open(SYSFS_ADD, "w")
-        f.write(policy)
+        # unbuffered, several rules must reach TLSM in a single write
+        f = open(endpoint, "wb", buffering=0)
+        f.write((f"{cgroup} {policy}" if cgroup else policy).encode())
         f.close()
-        print(f"{TAG_POL} Installing policy :", policy)
+        for rule in policy.split("\n"):
+            print(f"{TAG_POL} Installing policy :", rule)
     except OSError as e:
         if e.errno:
             print(f"{TAG_ERR} Policy Syntax Error - Policy parsing failed in TLSM")
         else:
-            print(f"{TAG_ERR} Failed to open", SYSFS_ADD, " - Is TLSM loaded ?")
+            print(f"{TAG_ERR} Failed to open", endpoint, " - Is TLSM loaded ?")
 
 
-def remove_policy(index: int):
-    assert(index >= 0)
+def _del_command(command: str):
+    endpoint = SYSFS_CGROUP_DEL if cgroup else SYSFS_DEL
     try:
-        f = open(SYSFS_DEL, "w")
-        f.write(str(index))
+        f = open(endpoint, "w")
+        f.write(f"{cgroup} {command}" if cgroup else command)
         f.close()
-        print(f"{TAG_POLD} Removing policy at index :", index)
+        return True
     except OSError as e:
         if e.errno:
-            print(f"{TAG_ERR} Policy Index Error - Invalid policy index {index}")
+            print(f"{TAG_ERR} Invalid deletion request \"{command}\"")
         else:
-            print(f"{TAG_ERR} Failed to open", SYSFS_ADD, " - Is TLSM loaded ?")
+            print(f"{TAG_ERR} Failed to open", endpoint, " - Is TLSM loaded ?")
+        return False
+
+def remove_policy(rule_id: int):
+    assert(rule_id >= 0)
+    if _del_command(f"id {rule_id}"):
+        print(f"{TAG_POLD} Removing policy with id :", rule_id)
+
+def remove_subject(subject: str):
+    if _del_command(f"subject {subject}"):
+        print(f"{TAG_POLD} Removing policies of :", subject)
 
+def remove_op(op: str):
+    if _del_command(f"op {op}"):
+        print(f"{TAG_POLD} Removing policies for operation :", op)
 
 def flush_policies():
     print(f"{TAG_INFO} Removing all policies")
-    lines = 0
-    with open(SYSFS_LIST, "r") as f:
-        lines = sum(1 for _ in f)
-    print(f"{TAG_INFO} Detected", lines, "lines to delete")
-    f = open(SYSFS_DEL, "w")
-    for _ in range(lines):
-        f.write('0')
-        f.flush()
-    f.close()
+    _del_command("all")
+
+def read_policies(policies_path):
+    """Yield the rules of a policies file, as they are written to add_policy"""
+    policies = open(policies_path, "r")
+    program = None
+    for i in policies.readlines():
+        try:
+            i = i.rstrip(" \n")
+            lt = i[0]
+            lh = i[1:]
+            if lt == "@":
+                program = lh
+            elif lt == "=":
+                yield program + " " + lh
+        except (IndexError, TypeError):
+            pass
+    policies.close()
 
 def apply_policies(policies_path=DEF_POLICY_PATH):
     print(f"{TAG_INFO} Loading policies from", policies_path)
     try:
-        policies = open(policies_path, "r")
-        program = None
-        for i in policies.readlines():
-            try:
-                i = i.rstrip(" \n")
-                lt = i[0]
-                lh = i[1:]
-                if lt == "@":
-                    program = lh
-                elif lt == "=":
-                    add_policy(program + " " + lh)
-            except IndexError:
-                pass
-        policies.close()
+        rules = list(read_policies(policies_path))
     except OSError:
         print(f"{TAG_ERR} Failed to open", policies_path)
         exit(1)
+    if not rules:
+        return
+    # one write, TLSM adds every rule or none and compiles the ruleset once
+    add_policy("\n".join(rules))
+
+# Offline policy optimizer
+# The model below mirrors autorize_access(): rules are evaluated first-match in load order,
+# "analyze" rules match any operation of the exact subject, other rules match a subject
+# prefix and, depending on the operation, an object substring (open) or prefix.
+# Glob subjects and objects (*, **, ? or [...]) are not modelled: such rules are only found
+# redundant when duplicated, and are assumed to overlap with every rule.
+
+CATEGORIES = ["allow", "deny", "ask", "analyze", "undefined"] # same order as tlsm_category_t
+OPS_ARGC = {"undefined": 0, "open": 1, "bind": 1, "connect": 1, "signal": 0, "execve": 1, "send": 1} # op2data
+SOCKET_OPS = ("bind", "connect", "send") # take the family, proto and port options
+RULE_OPTIONS = {("open", "mode"), ("signal", "sig"), ("signal", "target"), # (op, key) accepted by parse_policy_option()
+                ("bind", "family"), ("bind", "proto"), ("bind", "port"),
+                ("connect", "family"), ("connect", "proto"), ("connect", "port"),
+                ("send", "family"), ("send", "proto"), ("send", "port")}
+CATEGORY_OPTIONS = {("ask", "timeout"), ("ask", "default"), # (category, key), what to do without an answer
+                    ("analyze", "timeout"), ("analyze", "default"),
+                    ("analyze", "allow_above"), ("analyze", "deny_below")} # decided in the kernel
+
+SIGNAL_NAMES = {"HUP": 1, "INT": 2, "QUIT": 3, "ILL": 4, "TRAP": 5, "ABRT": 6, "BUS": 7, "FPE": 8,
+                "KILL": 9, "USR1": 10, "SEGV": 11, "USR2": 12, "PIPE": 13, "ALRM": 14, "TERM": 15,
+                "STKFLT": 16, "CHLD": 17, "CONT": 18, "STOP": 19, "TSTP": 20, "TTIN": 21, "TTOU": 22,
+                "URG": 23, "XCPU": 24, "XFSZ": 25, "VTALRM": 26, "PROF": 27, "WINCH": 28, "IO": 29,
+                "PWR": 30, "SYS": 31}
+ALL_SIGNALS = frozenset(range(1, 65))
+
+def parse_timeout(value):
+    """Milliseconds of a timeout=, seconds unless suffixed with "ms" """
+    if value.endswith("ms"):
+        ms = int(value[:-2])
+    else:
+        ms = int(value[:-1] if value.endswith("s") else value) * 1000
+    if ms <= 0:
+        raise ValueError(value)
+    return ms
+
+def parse_threshold(value):
+    """(score, score update) of an allow_above= or deny_below="""
+    score, _, delta = value.partition(":")
+    if int(score) < 0:
+        raise ValueError(value)
+    return (int(score), int(delta) if delta else 0)
+
+def parse_signals(value):
+    sigs = set()
+    for sig in value.split(","):
+        sig = sig.removeprefix("SIG")
+        n = int(sig) if sig.isdigit() else SIGNAL_NAMES.get(sig, 0)
+        if not 1 <= n <= 64:
+            raise ValueError(sig)
+        sigs.add(n)
+    return frozenset(sigs)
+
+MODE_NAMES = {"read": {"read"}, "write": {"write", "append"}, "append": {"append"}, "exec": {"exec"}} # mode2str
+ALL_MODES = frozenset(("read", "write", "append", "exec"))
+
+def parse_modes(value):
+    modes = set()
+    for mode in value.split(","):
+        if mode not in MODE_NAMES:
+            raise ValueError(mode)
+        modes |= MODE_NAMES[mode]
+    return frozenset(modes)
+
+FAMILY_NAMES = {"unix": 1, "inet": 2, "inet6": 10, "netlink": 16, "packet": 17} # family_names in net.c
+INET_FAMILIES = frozenset((2, 10)) # the only families with ports
+ALL_FAMILIES = frozenset(range(64))
+ALL_PROTOCOLS = frozenset(("tcp", "udp"))
+
+def parse_families(value):
+    families = set()
+    for family in value.split(","):
+        n = int(family) if family.isdigit() else FAMILY_NAMES.get(family, -1)
+        if not 0 <= n < 46: # AF_MAX
+            raise ValueError(family)
+        families.add(n)
+    return frozenset(families)
+
+def parse_protocols(value):
+    protocols = frozenset(value.split(","))
+    if not protocols <= ALL_PROTOCOLS:
+        raise ValueError(value)
+    return protocols
+
+MAX_PORTS = 8 # TLSM_POLICY_MAX_PORTS
+
+def parse_ports(value):
+    ports = []
+    if value.count(",") >= MAX_PORTS:
+        raise ValueError(value)
+    for r in value.split(","):
+        lo, _, hi = r.partition("-")
+        lo = int(lo)
+        hi = int(hi) if hi else lo
+        if not 0 <= lo <= hi <= 65535:
+            raise ValueError(r)
+        ports.append((lo, hi))
+    return ports
+
+def ports_cover(a, b):
+    """True if every port of the ranges b is in the ranges a (None for any port)"""
+    if a is None:
+        return True
+    if b is None:
+        return False
+    return all(any(alo <= lo and hi <= ahi for alo, ahi in a) for lo, hi in b)
+
+def ports_overlap(a, b):
+    if a is None or b is None:
+        return True
+    return any(alo <= hi and lo <= ahi for alo, ahi in a for lo, hi in b)
+
+class Rule:
+    def __init__(self, index, subject, category, op, obj, options=None):
+        self.index = index
+        self.subject = subject
+        self.category = category
+        self.op = op
+        self.obj = obj
+        self.options = options or dict() # "key=value" words, as written
+        self.modes = parse_modes(self.options["mode"]) if "mode" in self.options else ALL_MODES
+        self.signals = ALL_SIGNALS
+        self.target = None
+        if "sig" in self.options:
+            self.signals = parse_signals(self.options["sig"])
+        if "target" in self.options:
+            self.target = self.options["target"]
+        self.families = ALL_FAMILIES
+        self.protocols = ALL_PROTOCOLS
+        self.ports = None
+        if "family" in self.options:
+            self.families = parse_families(self.options["family"])
+        if "proto" in self.options:
+            self.protocols = parse_protocols(self.options["proto"])
+        if "port" in self.options:
+            self.ports = parse_ports(self.options["port"])
+        self.timeout = parse_timeout(self.options["timeout"]) if "timeout" in self.options else None
+        self.fallback = self.options.get("default")
+        if self.fallback not in (None, "allow", "deny"):
+            raise ValueError(self.fallback)
+        self.allow_above = parse_threshold(self.options["allow_above"]) if "allow_above" in self.options else None
+        self.deny_below = parse_threshold(self.options["deny_below"]) if "deny_below" in self.options else None
+
+    def outcome(self):
+        """What a matched request gets, rules with the same outcome can be merged"""
+        return (self.category, self.timeout, self.fallback, self.allow_above, self.deny_below)
+
+    def covers_net(self, other):
+        if not (self.families >= other.families and self.protocols >= other.protocols):
+            return False
+        # ports are ignored for families other than inet and inet6
+        return ports_cover(self.ports, other.ports) or not other.families & INET_FAMILIES
+
+    def overlaps_net(self, other):
+        families = self.families & other.families
+        if not families or not self.protocols & other.protocols:
+            return False
+        return ports_overlap(self.ports, other.ports) or bool(families - INET_FAMILIES)
+
+    def __str__(self):
+        acc = f"{self.subject} {self.category}"
+        if self.category != "analyze":
+            acc += f" {self.op}"
+        if self.obj is not None:
+            acc += f" {self.obj}"
+        for key, value in self.options.items():
+            acc += f" {key}={value}"
+        return acc
+
+    def is_analyze(self):
+        return self.category == "analyze"
+
+    def has_glob(self):
+        return is_glob(self.subject) or (self.obj is not None and is_glob(self.obj))
+
+    def any_object(self):
+        # kernel: strncmp(p->object, "any", strlen(p->object)) == 0
+        return "any".startswith(self.obj)
+
+MAX_WORDS = 16 # TLSM_MAX_WORDS
+
+def is_glob(s):
+    return any(c in s for c in "*?[\\")
+
+def parse_rule(index, rule: str):
+    """Parse a rule like parse_policy() does, None if the kernel would reject it"""
+    words = rule.split()
+    if not 2 <= len(words) <= MAX_WORDS:
+        return None
+    # str2tlsm_cat() accepts prefixes and falls back to deny
+    category = next((c for c in CATEGORIES if c.startswith(words[1])), "deny")
+    if category == "undefined":
+        return None
+    if category == "analyze":
+        op, obj, first_option = "undefined", None, 2
+    else:
+        if len(words) < 3:
+            return None
+        op = next((o for o in OPS_ARGC if o.startswith(words[2])), "undefined")
+        if op == "undefined" or len(words) < 3 + OPS_ARGC[op]:
+            return None
+        obj = words[3] if OPS_ARGC[op] else None
+        first_option = 3 + OPS_ARGC[op]
+    options = dict()
+    for word in words[first_option:]:
+        key, eq, value = word.partition("=")
+        if not eq or ((op, key) not in RULE_OPTIONS and (category, key) not in CATEGORY_OPTIONS):
+            return None
+        options[key] = value
+    try:
+        return Rule(index, words[0], category, op, obj, options)
+    except ValueError:
+        return None
+
+def rule_covers(a: Rule, b: Rule):
+    """True if every request matched by b is also matched by a"""
+    if a.has_glob() or b.has_glob():
+        return str(a) == str(b)
+    if a.is_analyze():
+        return b.is_analyze() and a.subject == b.subject
+    if b.is_analyze() or a.op != b.op or not b.subject.startswith(a.subject):
+        return False
+    if a.op == "open":
+        return a.modes >= b.modes and a.obj in b.obj
+    if a.op in SOCKET_OPS and not a.covers_net(b):
+        return False
+    if a.op in SOCKET_OPS or a.op == "execve":
+        if a.any_object():
+            return True
+        return not b.any_object() and b.obj.startswith(a.obj)
+    if a.op == "signal":
+        if not a.signals >= b.signals:
+            return False
+        return a.target is None or (b.target is not None and b.target.startswith(a.target))
+    return True
 
-def list_policies():
-    f = open(SYSFS_LIST, "r")
+def rule_overlaps(a: Rule, b: Rule):
+    """True if some request could be matched by both a and b"""
+    if a.has_glob() or b.has_glob():
+        return True
+    if a.is_analyze() and b.is_analyze():
+        return a.subject == b.subject
+    if a.is_analyze() or b.is_analyze():
+        exact, other = (a, b) if a.is_analyze() else (b, a)
+        return exact.subject.startswith(other.subject)
+    if a.op != b.op:
+        return False
+    if not (a.subject.startswith(b.subject) or b.subject.startswith(a.subject)):
+        return False
+    if a.op in SOCKET_OPS and not a.overlaps_net(b):
+        return False
+    if a.op == "open" and not a.modes & b.modes:
+        return False
+    if a.op in SOCKET_OPS or a.op == "execve":
+        return a.any_object() or b.any_object() or a.obj.startswith(b.obj) or b.obj.startswith(a.obj)
+    if a.op == "signal":
+        if not a.signals & b.signals:
+            return False
+        return a.target is None or b.target is None or a.target.startswith(b.target) or b.target.startswith(a.target)
+    return True # substrings can always appear in the same path
+
+def matching_cost(rules):
+    """Estimate, per operation, the work of a request that goes through the whole list"""
+    cost = dict()
+    for op in OPS_ARGC:
+        if op == "undefined":
+            continue
+        compared = sum(1 for r in rules if r.is_analyze() or r.op == op)
+        cost[op] = (len(rules), compared)
+    return cost
+
+def optimize_rules(rules):
+    """Return the minimal ruleset and the list of (kind, removed rule, reason rule) findings"""
+    findings = []
+    rules = list(rules)
+
+    changed = True
+    while changed:
+        changed = False
+
+        # shadowed rules: an earlier rule matches everything they would match
+        kept = []
+        for r in rules:
+            by = next((k for k in kept if rule_covers(k, r)), None)
+            if by is None:
+                kept.append(r)
+            else:
+                kind = "duplicate" if str(by) == str(r) else "shadowed"
+                findings.append((kind, r, by))
+                changed = True
+        rules = kept
+
+        # mergeable rules: a later rule with the same outcome matches everything they would
+        # match, and nothing in between can match the same requests
+        for i, r in enumerate(rules):
+            for j in range(i + 1, len(rules)):
+                later = rules[j]
+                if later.outcome() == r.outcome() and rule_covers(later, r):
+                    findings.append(("mergeable", r, later))
+                    del rules[i]
+                    changed = True
+                    break
+                if rule_overlaps(later, r):
+                    break
+            if changed:
+                break
+
+    return rules, findings
+
+def dump_rules(rules, out):
+    program = None
+    for r in rules:
+        if r.subject != program:
+            program = r.subject
+            out.write(f"\n@{program}\n")
+        line = f"={r.category}"
+        if not r.is_analyze():
+            line += f" {r.op}"
+        if r.obj is not None:
+            line += f" {r.obj}"
+        for key, value in r.options.items():
+            line += f" {key}={value}"
+        out.write(line + "\n")
+
+def optimize_policies(policies_path=DEF_POLICY_PATH, output_path=None):
+    try:
+        rules = []
+        for index, rule in enumerate(read_policies(policies_path)):
+            parsed = parse_rule(index, rule)
+            if parsed is None:
+                print(f"{TAG_WARN} rule #{index} \"{rule}\" would be rejected by TLSM, ignoring it")
+            else:
+                rules.append(parsed)
+    except OSError:
+        print(f"{TAG_ERR} Failed to open", policies_path)
+        exit(1)
+
+    optimized, findings = optimize_rules(rules)
+
+    for kind, r, by in findings:
+        print(f"{TAG_POLD} {kind} rule #{r.index} \"{r}\" (by rule #{by.index} \"{by}\")")
+
+    before = matching_cost(rules)
+    after = matching_cost(optimized)
+    print(f"{TAG_INFO} {len(rules)} rules -> {len(optimized)} rules")
+    print(f"{TAG_INFO} per-request matching cost when no rule applies (rules walked, rules compared):")
+    for op in before:
+        print(f" - {op} : {before[op]} -> {after[op]}")
+
+    header = f"Optimized from {policies_path} by tlsm-tools, rules are kept in evaluation order.\n"
+    if output_path:
+        with open(output_path, "w") as out:
+            out.write(header)
+            dump_rules(optimized, out)
+        print(f"{TAG_INFO} Minimal ruleset written to", output_path)
+    else:
+        stdout.write(header)
+        dump_rules(optimized, stdout)
+
+def iter_policies():
+    """Stream the active rules as (id, subject, category, op, object, hit_count, options) tuples"""
+    with open(SYSFS_LIST_RAW, "r") as f:
+        for line in f:
+            rule_id, subject, category, op, obj, hits, options = line.rstrip("\n").split("\t")
+            yield (int(rule_id), subject, category, op, obj, int(hits), options)
+
+def list_policies(raw=False):
+    if cgroup:
+        with open(SYSFS_CGROUP_LIST, "r") as f:
+            for line in f:
+                if line.split("\t", 1)[0] == cgroup:
+                    print(line, end="")
+        return
+    f = open(SYSFS_LIST_RAW if raw else SYSFS_LIST, "r")
     while t := f.read():
         print(t, end="")
     f.close()
 
+def show_stats():
+    with open(SYSFS_STATS, "r") as f:
+        print(f"{'memory':<20} {'objects':>8} {'bytes':>10}")
+        for line in f:
+            name, count, size = line.split("\t")
+            print(f"{name:<20} {count:>8} {size.strip():>10}")
+    # pending ask/analyze requests and the ones past the kernel's limits
+    with open(SYSFS_REQUESTS, "r") as f:
+        print(f"\n{'requests':<20} {'count':>8}")
+        for line in f:
+            name, count = line.split("\t")
+            print(f"{name:<20} {count.strip():>8}")
+    # 0 is no limit
+    print(f"\n{'limits':<24} {'value':>8}")
+    for name in LIMITS:
+        try:
+            with open(join(MODULE_PARAMETERS, name), "r") as f:
+                print(f"{name:<24} {f.read().strip():>8}")
+        except OSError:
+            pass
+
+def capture_requests(output_path, seconds=0):
+    """Record every access request to a file until Ctrl-C, or for some seconds"""
+    try:
+        with open(SYSFS_CAPTURE, "w") as f:
+            f.write("start")
+        fd = os_open(SYSFS_CAPTURE, O_RDONLY | O_NONBLOCK)
+    except OSError:
+        print(f"{TAG_ERR} Failed to start the capture - Is TLSM loaded ?")
+        exit(1)
+
+    print(f"{TAG_INFO} Capturing to", output_path, f"for {seconds}s" if seconds else "until Ctrl-C")
+    end = monotonic() + seconds
+    with open(output_path, "wb") as out:
+        out.write(CAPTURE_HEADER)
+        try:
+            while not seconds or monotonic() < end:
+                try:
+                    out.write(os_read(fd, 256 * 1024))
+                except BlockingIOError:
+                    sleep(0.1)
+        except KeyboardInterrupt:
+            pass
+        with open(SYSFS_CAPTURE, "w") as f:
+            f.write("stop")
+        # a stopped capture is read until its last record
+        while data := os_read(fd, 256 * 1024):
+            out.write(data)
+    os_close(fd)
+
+    with open(SYSFS_CAPTURE_STATUS, "r") as f:
+        status = dict(line.rstrip("\n").split("\t") for line in f)
+    print(f"{TAG_INFO} {status['recorded']} requests captured")
+    if status["dropped"] != "0":
+        print(f"{TAG_WARN} {status['dropped']} requests dropped, raise /sys/module/tlsm/parameters/capture_buffer_kb")
+
+def dump_active_rules(out):
+    """Write the active global rules, one per line as add_policy takes them"""
+    for _, subject, category, op, obj, _, options in iter_policies():
+        words = [subject, category] if category == "analyze" else [subject, category, op]
+        if obj and category != "analyze":
+            words.append(obj)
+        if options:
+            words.append(options)
+        out.write(" ".join(words) + "\n")
+
+def replay_capture(capture_path, policies_path=DEF_POLICY_PATH):
+    """Match a capture against a policies file, and against the active rules if TLSM is loaded"""
+    with NamedTemporaryFile("w", suffix=".rules") as candidate, NamedTemporaryFile("w", suffix=".rules") as current:
+        try:
+            for rule in read_policies(policies_path):
+                candidate.write(rule + "\n")
+        except OSError:
+            print(f"{TAG_ERR} Failed to open", policies_path)
+            exit(1)
+        candidate.flush()
+
+        cmd = [REPLAY]
+        try:
+            dump_active_rules(current)
+            current.flush()
+            cmd += ["-c", current.name]
+        except OSError:
+            print(f"{TAG_WARN} Cannot read the active rules, verdicts are not compared")
+        try:
+            exit(run(cmd + [candidate.name, capture_path]).returncode)
+        except OSError:
+            print(f"{TAG_ERR} Failed to run {REPLAY}")
+            exit(1)
+
 def print_help():
     print(f"{term_colors.BOLD} tlsm-tools {term_colors.ENDC} - userland configuration utility for TLSM")
-    print("usage: tlsm-py [ apply | list | add \"<policy>\" | del <index> | flush ]")
+    print("usage: tlsm-py [ apply | list [raw] | add \"<policy>\" | del <id> | del subject <path> | del op <op> | flush | stats ]")
+    print("       tlsm-py optimize [<policies.conf> [<output.conf>]]")
+    print("       tlsm-py capture <output> [<seconds>] | replay <capture> [<policies.conf>]")
+    print("prefix a command with --cgroup <path> to manage the policies of a cgroup v2 (e.g. /system.slice/foo.service)")
     print("Policy example : cat open /home/user/secret.txt")
     print("Policy example : python ask bind 192.168.1.1")
+    print("Policy example : /usr/bin/supervisord allow signal sig=TERM,HUP target=/usr/bin/worker")
+    print("Policy example : /usr/bin/*sh deny open /home/*/.ssh/**")
+    print("Policy example : /usr/bin/rsyslogd deny open /var/log/ mode=write,exec (appending is still allowed)")
+    print("Policy example : /usr/bin/curl ask connect any timeout=500ms default=deny")
+    print("Policy example : /usr/bin/python deny send any proto=udp port=53 (sendto without connect)")
+    print("Policy example : /usr/bin/python analyze allow_above=80:-5 deny_below=20")
 
 if __name__=="__main__":
+    if len(argv) > 1 and argv[1] == "optimize": # offline, does not need TLSM nor root
+        optimize_policies(*argv[2:4])
+        exit(0)
+    if len(argv) in (3, 4) and argv[1] == "replay": # the active rules are compared only as root
+        replay_capture(*argv[2:4])
+
     if getuid() != 0:
         print(f"{TAG_ERR} This tool must be run as root !")
         exit(1)
 
+    if len(argv) > 2 and argv[1] == "--cgroup":
+        cgroup = argv[2]
+        argv = argv[:1] + argv[3:]
+
     if len(argv) > 1:
         if argv[1] == "apply" or argv[1] == "a":
             if len(argv) == 3:
@@ -118,9 +632,16 @@ if __name__=="__main__":
             else:
                 apply_policies()
         elif argv[1] == "list":
-            list_policies()
+            list_policies(len(argv) == 3 and argv[2] == "raw")
         elif argv[1] == "flush":
             flush_policies()
+        elif argv[1] == "stats":
+            show_stats()
+        elif argv[1] == "capture" and len(argv) in (3, 4):
+            try:
+                capture_requests(argv[2], int(argv[3]) if len(argv) == 4 else 0)
+            except ValueError:
+                print(f"{TAG_ERR} Duration should be a valid integer.")
         elif argv[1] == "add":
             if len(argv) == 3:
                 pol = argv[2]
@@ -130,10 +651,14 @@ if __name__=="__main__":
         elif argv[1] == "del":
             if len(argv) == 3:
                 try:
-                    index = int(argv[2])
-                    remove_policy(index)
+                    rule_id = int(argv[2])
+                    remove_policy(rule_id)
                 except ValueError:
-                    print(f"{TAG_ERR} Index should be a valid integer.")
+                    print(f"{TAG_ERR} Rule id should be a valid integer.")
+            elif len(argv) == 4 and argv[2] == "subject":
+                remove_subject(argv[3])
+            elif len(argv) == 4 and argv[2] == "op":
+                remove_op(argv[3])
             else:
                 print_help()
         else: